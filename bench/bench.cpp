@@ -0,0 +1,623 @@
+#include "core/history_archive.hpp"
+#include "core/message.hpp"
+#include "core/wire.hpp"
+#include "crypto/crypto.hpp"
+#include "crypto/identity.hpp"
+#include "media/audio.hpp"
+#include "media/voice_channel.hpp"
+#include "network/connection.hpp"
+#include "network/peer.hpp"
+#include "network/stream.hpp"
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <utility>
+#include <unistd.h>
+#include <vector>
+
+// AEAD throughput per suite and frame size, plus the suite the startup
+// probe would pick for a pair of identical machines
+static void benchCrypto() {
+	using namespace std::chrono_literals;
+	const std::vector<size_t> frame_sizes = {64, 256, 1024, 4096, 16384, 65536};
+
+	std::printf("== crypto ==\n");
+	std::printf("%-20s", "suite \\ frame");
+	for (size_t frame_size : frame_sizes) {
+		std::printf("%10zu", frame_size);
+	}
+	std::printf("   (GB/s)\n");
+
+	for (size_t i = 0; i < CIPHER_SUITE_COUNT; ++i) {
+		auto suite = static_cast<CipherSuite>(i);
+		std::printf("%-20s", cipherSuiteName(suite));
+		for (size_t frame_size : frame_sizes) {
+			double bytes_per_second =
+				measureCipherThroughput(suite, frame_size, 200ms);
+			std::printf("%10.2f", bytes_per_second / 1e9);
+		}
+		std::printf("\n");
+	}
+
+	CipherScores scores = benchmarkCipherSuites();
+	std::printf("startup probe: %s -> %s\n\n",
+				encodeCipherScores(scores).c_str(),
+				cipherSuiteName(negotiateCipherSuite(scores, scores)));
+}
+
+// tone source that remembers when each frame was handed to the channel
+class TimedToneSource : public ToneSource {
+  public:
+	std::mutex mutex;
+	std::vector<std::chrono::steady_clock::time_point> sent;
+
+	bool read(AudioFrame &frame) override {
+		const std::lock_guard<std::mutex> lock(mutex);
+		sent.push_back(std::chrono::steady_clock::now());
+		return ToneSource::read(frame);
+	}
+};
+
+// records send to playout latency of every frame that made it through
+class LatencySink : public AudioSink {
+  public:
+	std::shared_ptr<TimedToneSource> source;
+	std::vector<double> latencies_ms;
+
+	void write(const AudioFrame &frame) override {
+		if (frame.concealed) {
+			return;
+		}
+		auto now = std::chrono::steady_clock::now();
+		size_t index = frame.timestamp / AUDIO_FRAME_SAMPLES;
+		const std::lock_guard<std::mutex> lock(source->mutex);
+		if (index < source->sent.size()) {
+			latencies_ms.push_back(std::chrono::duration<double, std::milli>(
+									   now - source->sent[index])
+									   .count());
+		}
+	}
+};
+
+class DiscardSink : public AudioSink {
+  public:
+	void write(const AudioFrame &) override {}
+};
+
+static double percentile(std::vector<double> values, double p) {
+	if (values.empty()) {
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	return values[static_cast<size_t>(p * (values.size() - 1))];
+}
+
+// one way voice over loopback with 5% of packets dropped at the sender
+static void benchVoice() {
+	using namespace std::chrono_literals;
+	boost::asio::io_context io_ctx;
+	VoiceChannel sender(io_ctx, 0);
+	VoiceChannel receiver(io_ctx, 0);
+	auto loopback = boost::asio::ip::address_v4::loopback();
+
+	auto source = std::make_shared<TimedToneSource>();
+	auto sink = std::make_shared<LatencySink>();
+	sink->source = source;
+	sender.setSendLossRate(0.05);
+	receiver.start({loopback, sender.getLocalPort()},
+				   std::make_shared<ToneSource>(), sink);
+	sender.start({loopback, receiver.getLocalPort()}, source,
+				 std::make_shared<DiscardSink>());
+	std::this_thread::sleep_for(5s);
+	sender.stop();
+	receiver.stop();
+
+	auto stats = receiver.getStats();
+	std::printf("== voice (loopback, 5%% loss) ==\n");
+	std::printf("send -> playout ms: p50 %.1f  p95 %.1f  p99 %.1f  max %.1f\n",
+				percentile(sink->latencies_ms, 0.50),
+				percentile(sink->latencies_ms, 0.95),
+				percentile(sink->latencies_ms, 0.99),
+				percentile(sink->latencies_ms, 1.0));
+	std::printf("played %llu  concealed %llu  late %llu  dropped %llu  "
+				"target %zu frame(s)  jitter %.2f ms\n\n",
+				static_cast<unsigned long long>(stats.played),
+				static_cast<unsigned long long>(stats.concealed),
+				static_cast<unsigned long long>(stats.late),
+				static_cast<unsigned long long>(stats.dropped),
+				stats.target_frames, stats.jitter_ms);
+}
+
+// a frame that carries the time it was queued
+struct Stamp {
+	std::int64_t sent_ns = 0;
+	std::string padding;
+};
+
+struct StampFrame {
+	using Type = Stamp;
+	static constexpr char KIND = 'B';
+	static constexpr auto FIELDS =
+		std::make_tuple(wireField<WireInt>(&Stamp::sent_ns),
+						wireField<WireText>(&Stamp::padding));
+};
+
+static std::int64_t nowNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+// records queue to handler latency of every frame received
+class StampSink {
+  public:
+	using Protocol = WireProtocol<StampFrame>;
+	std::mutex mutex;
+	std::vector<double> latencies_ms;
+
+	void onFrame(const std::shared_ptr<Peer> &, const Stamp &stamp) {
+		double ms = static_cast<double>(nowNanoseconds() - stamp.sent_ns) / 1e6;
+		const std::lock_guard<std::mutex> lock(mutex);
+		latencies_ms.push_back(ms);
+	}
+
+	size_t received() {
+		const std::lock_guard<std::mutex> lock(mutex);
+		return latencies_ms.size();
+	}
+};
+
+// counts reads and writes, each a syscall on a blocking socket
+class CountingStream : public Stream {
+  private:
+	std::unique_ptr<Stream> stream_;
+	std::atomic<std::uint64_t> &calls_;
+
+  public:
+	CountingStream(std::unique_ptr<Stream> stream,
+				   std::atomic<std::uint64_t> &calls)
+		: stream_(std::move(stream)), calls_(calls) {}
+
+	size_t readSome(std::uint8_t *data, size_t len) override {
+		++calls_;
+		return stream_->readSome(data, len);
+	}
+	void write(const std::uint8_t *data, size_t len) override {
+		++calls_;
+		stream_->write(data, len);
+	}
+	void shutdownSend() override { stream_->shutdownSend(); }
+	void shutdown() override { stream_->shutdown(); }
+	void close() override { stream_->close(); }
+};
+
+// two connections over a fresh loopback socket, handshaked
+static std::pair<std::shared_ptr<Connection>, std::shared_ptr<Connection>>
+connectedPair(boost::asio::io_context &io_ctx,
+			  boost::asio::ip::tcp::acceptor &acceptor,
+			  std::shared_ptr<SecurityContext> dialer,
+			  std::shared_ptr<SecurityContext> listener, FrameRoute route,
+			  const std::function<std::unique_ptr<Stream>(
+				  boost::asio::ip::tcp::socket)> &wrap) {
+	auto loopback = boost::asio::ip::address_v4::loopback();
+	boost::asio::ip::tcp::socket dialed(io_ctx);
+	boost::asio::ip::tcp::socket accepted(io_ctx);
+	dialed.connect(acceptor.local_endpoint());
+	acceptor.accept(accepted);
+	auto sender = std::make_shared<Connection>(
+		std::make_shared<Peer>(2, "b", loopback, 0), dialer, route, [] {},
+		wrap(std::move(dialed)), true);
+	auto receiver = std::make_shared<Connection>(
+		std::make_shared<Peer>(1, "a", loopback, 0), listener, route, [] {},
+		wrap(std::move(accepted)), false);
+	std::thread handshake([&receiver] { receiver->handshake(); });
+	sender->handshake();
+	handshake.join();
+	return {sender, receiver};
+}
+
+static std::uint64_t contextSwitches() {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return static_cast<std::uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+// one node fanning each tick's frame out to every peer over loopback, the
+// way a busy relay does. syscalls are the socket reads and writes, wakeups
+// between threads cost context switches, counted for the whole process
+static void benchTransport() {
+	using namespace std::chrono_literals;
+	constexpr int TICKS_PER_SECOND = 2000;
+	constexpr auto DURATION = 2s;
+	constexpr size_t FRAME_SIZE = 256;
+
+	auto data_root = std::filesystem::temp_directory_path() /
+					 ("p2p_bench_" + std::to_string(::getpid()));
+	std::filesystem::create_directories(data_root / "a");
+	std::filesystem::create_directories(data_root / "b");
+	auto security_a =
+		std::make_shared<SecurityContext>(1, (data_root / "a").string());
+	auto security_b =
+		std::make_shared<SecurityContext>(2, (data_root / "b").string());
+	auto loopback = boost::asio::ip::address_v4::loopback();
+
+	std::printf("== transport (loopback, %zu B frames, %d fan-outs/s) ==\n",
+				FRAME_SIZE, TICKS_PER_SECOND);
+	std::printf("%6s%10s%14s%14s%9s%9s\n", "peers", "msg/s",
+				"syscalls/msg", "switches/msg", "p50 ms", "p99 ms");
+
+	for (size_t peers : {1, 8, 32}) {
+		boost::asio::io_context io_ctx;
+		boost::asio::ip::tcp::acceptor acceptor(io_ctx, {loopback, 0});
+		std::atomic<std::uint64_t> socket_calls{0};
+		auto wrap = [&](boost::asio::ip::tcp::socket socket)
+			-> std::unique_ptr<Stream> {
+			return std::make_unique<CountingStream>(
+				std::make_unique<TcpStream>(std::move(socket)), socket_calls);
+		};
+
+		StampSink sink;
+		auto route = FrameRoute::to<StampSink::Protocol>(sink);
+		std::vector<std::shared_ptr<Connection>> senders;
+		std::vector<std::shared_ptr<Connection>> receivers;
+		for (size_t i = 0; i < peers; ++i) {
+			auto [sender, receiver] = connectedPair(
+				io_ctx, acceptor, security_a, security_b, route, wrap);
+			sender->start();
+			receiver->start();
+			senders.push_back(sender);
+			receivers.push_back(receiver);
+		}
+
+		auto calls_before = socket_calls.load();
+		auto switches_before = contextSwitches();
+		Stamp stamp;
+		stamp.padding.assign(FRAME_SIZE, 'x');
+		size_t ticks = static_cast<size_t>(
+			TICKS_PER_SECOND *
+			std::chrono::duration<double>(DURATION).count());
+		auto start = std::chrono::steady_clock::now();
+		for (size_t tick = 0; tick < ticks; ++tick) {
+			std::this_thread::sleep_until(
+				start + tick * std::chrono::microseconds(1000000 /
+														 TICKS_PER_SECOND));
+			stamp.sent_ns = nowNanoseconds();
+			auto payload =
+				std::make_shared<const std::string>(encodeFrame<StampFrame>(stamp));
+			for (auto &sender : senders) {
+				sender->sendFrame(payload);
+			}
+		}
+		size_t sent = ticks * peers;
+		auto deadline = std::chrono::steady_clock::now() + 5s;
+		while (sink.received() < sent &&
+			   std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(1ms);
+		}
+		double syscalls =
+			static_cast<double>(socket_calls.load() - calls_before);
+		double switches =
+			static_cast<double>(contextSwitches() - switches_before);
+		senders.clear();
+		receivers.clear();
+
+		const std::lock_guard<std::mutex> lock(sink.mutex);
+		double messages = static_cast<double>(sink.latencies_ms.size());
+		std::printf("%6zu%10.0f%14.2f%14.2f%9.3f%9.3f\n", peers,
+					messages / std::chrono::duration<double>(DURATION).count(),
+					syscalls / messages, switches / messages,
+					percentile(sink.latencies_ms, 0.50),
+					percentile(sink.latencies_ms, 0.99));
+	}
+	std::printf("\n");
+	std::error_code ec;
+	std::filesystem::remove_all(data_root, ec);
+}
+
+// counts the frames a connection delivers
+class FrameCounter {
+  public:
+	using Protocol = WireProtocol<StampFrame>;
+	std::atomic<size_t> frames{0};
+
+	void onFrame(const std::shared_ptr<Peer> &, const Stamp &) { ++frames; }
+};
+
+// what a connection does with frames minus the AEAD: copied behind their
+// length into a send buffer and written a batch at a time, read back
+// through a buffer of the size a connection reads at once and handed to
+// the route. returns bytes per second
+static double plaintextThroughput(const std::string &payload, size_t frames,
+								  FrameRoute route) {
+	constexpr size_t READ_CHUNK_SIZE = 16384;
+	constexpr size_t MAX_BATCH_SIZE = 64 * 1024;
+	boost::asio::io_context io_ctx;
+	boost::asio::ip::tcp::acceptor acceptor(
+		io_ctx, {boost::asio::ip::address_v4::loopback(), 0});
+	boost::asio::ip::tcp::socket dialed(io_ctx);
+	boost::asio::ip::tcp::socket accepted(io_ctx);
+	dialed.connect(acceptor.local_endpoint());
+	acceptor.accept(accepted);
+	TcpStream sending(std::move(dialed));
+	TcpStream receiving(std::move(accepted));
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread receiver([&] {
+		std::vector<std::uint8_t> buffer(READ_CHUNK_SIZE);
+		size_t pos = 0;
+		size_t end = 0;
+		auto readExactly = [&](std::uint8_t *data, size_t len) {
+			size_t done = 0;
+			while (done < len) {
+				if (pos < end) {
+					size_t n = std::min(len - done, end - pos);
+					std::memcpy(data + done, buffer.data() + pos, n);
+					pos += n;
+					done += n;
+				} else if (len - done >= READ_CHUNK_SIZE) {
+					done += receiving.readSome(data + done, len - done);
+				} else {
+					pos = 0;
+					end = receiving.readSome(buffer.data(), buffer.size());
+				}
+			}
+		};
+		std::vector<std::uint8_t> frame;
+		std::shared_ptr<Peer> from;
+		for (size_t i = 0; i < frames; ++i) {
+			std::uint8_t header[4];
+			readExactly(header, sizeof(header));
+			size_t len = (static_cast<size_t>(header[0]) << 24) |
+						 (static_cast<size_t>(header[1]) << 16) |
+						 (static_cast<size_t>(header[2]) << 8) | header[3];
+			frame.resize(len);
+			readExactly(frame.data(), len);
+			route.dispatch(route.handler, from,
+						   std::string_view(
+							   reinterpret_cast<const char *>(frame.data()), len));
+		}
+	});
+	std::vector<std::uint8_t> send_buffer;
+	for (size_t sent = 0; sent < frames;) {
+		size_t batch = 0;
+		for (; sent < frames && batch < MAX_BATCH_SIZE; ++sent) {
+			size_t len = payload.size();
+			send_buffer.resize(batch + 4 + len);
+			std::uint8_t *frame = send_buffer.data() + batch;
+			frame[0] = static_cast<std::uint8_t>(len >> 24);
+			frame[1] = static_cast<std::uint8_t>(len >> 16);
+			frame[2] = static_cast<std::uint8_t>(len >> 8);
+			frame[3] = static_cast<std::uint8_t>(len);
+			std::memcpy(frame + 4, payload.data(), len);
+			batch += 4 + len;
+		}
+		sending.write(send_buffer.data(), batch);
+	}
+	receiver.join();
+	double seconds = std::chrono::duration<double>(
+						 std::chrono::steady_clock::now() - start)
+						 .count();
+	return static_cast<double>(payload.size() * frames) / seconds;
+}
+
+// one connection streaming frames as fast as it can, against the same
+// frames in plaintext. the connection negotiates its suite the way two
+// peers on this machine would. the last column is the suite sealing and
+// opening on its own, the most the connection could reach if nothing but
+// the AEAD had to run on this machine
+static void benchEncryption() {
+	using namespace std::chrono_literals;
+	constexpr size_t BYTES_PER_RUN = 64 << 20;
+
+	auto data_root = std::filesystem::temp_directory_path() /
+					 ("p2p_bench_" + std::to_string(::getpid()));
+	std::filesystem::create_directories(data_root / "a");
+	std::filesystem::create_directories(data_root / "b");
+	auto security_a =
+		std::make_shared<SecurityContext>(1, (data_root / "a").string());
+	auto security_b =
+		std::make_shared<SecurityContext>(2, (data_root / "b").string());
+
+	std::printf("== encryption (one connection, loopback) ==\n");
+	std::printf("%-10s%16s%16s%11s%14s\n", "frame B", "plaintext MB/s",
+				"encrypted MB/s", "overhead", "AEAD MB/s");
+	CipherSuite suite = CipherSuite::ChaCha20Poly1305;
+	for (size_t frame_size : {256, 4096, 65536}) {
+		Stamp stamp;
+		stamp.padding.assign(frame_size, 'x');
+		auto payload =
+			std::make_shared<const std::string>(encodeFrame<StampFrame>(stamp));
+		size_t frames = BYTES_PER_RUN / payload->size();
+
+		FrameCounter plain_counter;
+		double plaintext = plaintextThroughput(
+			*payload, frames, FrameRoute::to<FrameCounter::Protocol>(plain_counter));
+
+		boost::asio::io_context io_ctx;
+		boost::asio::ip::tcp::acceptor acceptor(
+			io_ctx, {boost::asio::ip::address_v4::loopback(), 0});
+		FrameCounter counter;
+		auto [sender, receiver] = connectedPair(
+			io_ctx, acceptor, security_a, security_b,
+			FrameRoute::to<FrameCounter::Protocol>(counter),
+			[](boost::asio::ip::tcp::socket socket) -> std::unique_ptr<Stream> {
+				return std::make_unique<TcpStream>(std::move(socket));
+			});
+		suite = sender->getCipherSuite();
+		sender->start();
+		receiver->start();
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < frames; ++i) {
+			sender->sendFrame(payload);
+		}
+		auto deadline = start + 30s;
+		while (counter.frames < frames &&
+			   std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(100us);
+		}
+		double seconds = std::chrono::duration<double>(
+							 std::chrono::steady_clock::now() - start)
+							 .count();
+		double encrypted =
+			static_cast<double>(payload->size() * counter.frames) / seconds;
+		sender->disconnect();
+		receiver->disconnect();
+
+		// seal and open cost about the same
+		double aead = measureCipherThroughput(suite, payload->size(), 200ms) / 2;
+		std::printf("%-10zu%16.0f%16.0f%10.1f%%%14.0f\n", frame_size,
+					plaintext / 1e6, encrypted / 1e6,
+					100.0 * (plaintext - encrypted) / plaintext, aead / 1e6);
+	}
+	std::printf("suite: %s\n\n", cipherSuiteName(suite));
+	std::error_code ec;
+	std::filesystem::remove_all(data_root, ec);
+}
+
+// synthetic history: direct chats and groups of five, messages made of
+// common words and about five minutes apart
+static std::vector<ArchivedConversation> makeHistory(size_t conversations,
+													 size_t per_conversation) {
+	static const std::vector<std::string> words = {
+		"the", "to", "and", "a", "i", "you", "it", "is", "that", "of", "in",
+		"for", "on", "we", "this", "be", "can", "do", "have", "build", "test",
+		"later", "ok", "thanks", "review", "merge", "lunch", "fixed", "see",
+		"link", "branch", "deploy", "today", "call", "sure", "yes", "no",
+		"meeting", "tomorrow"};
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<size_t> word(0, words.size() - 1);
+	std::uniform_int_distribution<size_t> length(3, 25);
+	std::uniform_int_distribution<std::int64_t> gap_ms(1000, 600000);
+	std::vector<ArchivedConversation> history;
+	for (size_t c = 0; c < conversations; ++c) {
+		ArchivedConversation conversation;
+		conversation.group = c % 4 == 3;
+		conversation.name = conversation.group ? "group-" + std::to_string(c)
+											   : "peer-" + std::to_string(c);
+		std::vector<std::string> members = {"me", conversation.name};
+		if (conversation.group) {
+			members = {"me", "ana", "bo", "cy", "dee"};
+		}
+		auto time = std::chrono::system_clock::time_point(
+			std::chrono::milliseconds(1700000000000));
+		for (size_t i = 0; i < per_conversation; ++i) {
+			Message msg;
+			msg.sender = members[rng() % members.size()];
+			for (size_t n = length(rng); n > 0; --n) {
+				msg.content += words[word(rng)];
+				msg.content += n > 1 ? " " : "";
+			}
+			time += std::chrono::milliseconds(gap_ms(rng));
+			msg.timestamp = time;
+			if (conversation.group) {
+				msg.group_id = conversation.name;
+				msg.group_members = members;
+			}
+			conversation.messages.push_back(std::move(msg));
+		}
+		history.push_back(std::move(conversation));
+	}
+	return history;
+}
+
+// the archive against one serialized message per line, written and read
+// back whole, then a read of one day out of about two months of history
+static void benchArchive() {
+	constexpr size_t CONVERSATIONS = 32;
+	constexpr size_t PER_CONVERSATION = 16384;
+	auto history = makeHistory(CONVERSATIONS, PER_CONVERSATION);
+	size_t total = CONVERSATIONS * PER_CONVERSATION;
+	auto dir = std::filesystem::temp_directory_path();
+	auto lines_path = (dir / ("p2p_bench_" + std::to_string(::getpid()) +
+							  ".lines")).string();
+	auto archive_path = (dir / ("p2p_bench_" + std::to_string(::getpid()) +
+								".archive")).string();
+	auto seconds = [](auto start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+											 start)
+			.count();
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	{
+		std::ofstream file(lines_path, std::ios::binary | std::ios::trunc);
+		for (const auto &conversation : history) {
+			for (const auto &msg : conversation.messages) {
+				file << msg.serialize() << '\n';
+			}
+		}
+	}
+	double lines_write = seconds(start);
+	start = std::chrono::steady_clock::now();
+	size_t lines_read = 0;
+	{
+		std::ifstream file(lines_path, std::ios::binary);
+		std::string line;
+		while (std::getline(file, line)) {
+			Message::deserialize(line);
+			++lines_read;
+		}
+	}
+	double lines_read_time = seconds(start);
+
+	start = std::chrono::steady_clock::now();
+	writeHistoryArchive(archive_path, history);
+	double archive_write = seconds(start);
+	start = std::chrono::steady_clock::now();
+	size_t archive_read = 0;
+	for (const auto &conversation : readHistoryArchive(archive_path)) {
+		archive_read += conversation.messages.size();
+	}
+	double archive_read_time = seconds(start);
+
+	// one day in the middle of the history
+	std::int64_t day_from = 1700000000000 + PER_CONVERSATION / 2 * 300000;
+	std::int64_t day_to = day_from + 24 * 3600 * 1000;
+	start = std::chrono::steady_clock::now();
+	size_t day_read = 0;
+	for (const auto &conversation :
+		 readHistoryArchive(archive_path, day_from, day_to)) {
+		day_read += conversation.messages.size();
+	}
+	double day_read_time = seconds(start);
+
+	auto mib = [](const std::string &path) {
+		return static_cast<double>(std::filesystem::file_size(path)) /
+			   (1 << 20);
+	};
+	std::printf("== history archive (%zu conversations, %zu messages) ==\n",
+				CONVERSATIONS, total);
+	std::printf("%-22s%10s%12s%12s\n", "", "MiB", "write ms", "read ms");
+	std::printf("%-22s%10.1f%12.0f%12.0f\n", "message per line",
+				mib(lines_path), lines_write * 1e3, lines_read_time * 1e3);
+	std::printf("%-22s%10.1f%12.0f%12.0f\n", "column blocks",
+				mib(archive_path), archive_write * 1e3, archive_read_time * 1e3);
+	std::printf("one day: %zu message(s) in %.1f ms, read back %zu of %zu and "
+				"%zu of %zu\n\n",
+				day_read, day_read_time * 1e3, lines_read, total, archive_read,
+				total);
+	std::filesystem::remove(lines_path);
+	std::filesystem::remove(archive_path);
+}
+
+int main() {
+	benchCrypto();
+	benchEncryption();
+	benchVoice();
+	benchTransport();
+	benchArchive();
+	return 0;
+}
@@ -46,6 +46,8 @@
             valgrind
             boost
             openssl
+            zlib
+            lz4
             fmt
             spdlog
             bear
@@ -1,67 +1,192 @@
 #pragma once
+#include "core/config.hpp"
+#include "core/envelope.hpp"
+#include "core/history_archive.hpp"
+#include "core/history_sync.hpp"
 #include "core/message.hpp"
+#include "core/view_model.hpp"
+#include "core/wire.hpp"
+#include "crypto/identity.hpp"
 #include "network/connection.hpp"
 #include "network/peer.hpp"
 #include "network/discovery.hpp"
+#include "network/peer_cache.hpp"
+#include "network/peer_registry.hpp"
+#include "network/relay.hpp"
+#include "network/rendezvous.hpp"
+#include "network/stream.hpp"
 #include <mutex>
 #include <string>
 #include <vector>
 #include <memory>
 #include <boost/asio.hpp>
 #include <map>
-#include <queue>
 #include <utility>
 #include <vector>
 #include <set>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
 
 class App {
   private:
+  // with the host name and data dir filled in
+  Config config_;
   std::string my_hostname_;
+  std::uint64_t node_id_;
+  std::string data_dir_;
+  // peers we connected to in earlier runs, saved on stop
+  PeerCache peer_cache_;
+  std::shared_ptr<SecurityContext> security_;
+  // everyone we know of, filled by discovery, the cache and the
+  // rendezvous server. declared before discovery, which writes to it
+  PeerRegistry peer_registry_;
   Discovery discovery_;
-  std::vector<std::shared_ptr<Peer>> peers_;
-  int selected_index_;
+  // selection belongs to the UI thread
+  std::shared_ptr<Peer> selected_peer_;
   boost::asio::io_context &io_context_;
   std::map<std::shared_ptr<Peer>, std::shared_ptr<Connection>> connections_;
-  std::map<std::shared_ptr<Peer>, std::vector<Message>> message_history_;
-  std::queue<std::pair<std::shared_ptr<Peer>, Message>> incoming_messages_;
+  std::map<std::shared_ptr<Peer>, MessageLog> message_history_;
+  // group conversations by group id, members are hostnames including ours
+  std::map<std::string, std::vector<std::string>> groups_;
+  std::map<std::string, MessageLog> group_history_;
+  // ids of every message held per conversation, for history sync
+  std::map<std::shared_ptr<Peer>, HistoryIndex> history_index_;
+  std::map<std::string, HistoryIndex> group_index_;
+  std::string selected_group_;
+  // envelopes held for offline peers, ours and ones relayed through us
+  RelayStore relay_store_;
+  // relayed messages whose sender hasn't been discovered yet
+  std::vector<Message> orphaned_messages_;
   mutable std::mutex message_queue_mutex_;
+  // latest published snapshot for the UI, swapped atomically
+  std::shared_ptr<const ViewModel> view_;
+  std::atomic<bool> view_dirty_{true};
+  std::uint64_t view_version_ = 0;
+  std::mutex publish_mutex_;
+  // called from connection threads for every message received
+  std::function<void(std::shared_ptr<Peer>, const Message&)> message_listener_;
+  // startup to the first message handed to a live connection, -1 before
+  std::chrono::steady_clock::time_point started_ = std::chrono::steady_clock::now();
+  std::atomic<std::int64_t> first_message_us_{-1};
+  void markMessageSent();
+  void markViewDirty();
   std::shared_ptr<Connection> getConnection(std::shared_ptr<Peer> peer) const;
   boost::asio::ip::tcp::acceptor acceptor_;
   std::thread listener_thread;
   std::mutex listener_mutex_;
   std::atomic<bool> listening_;
+  // every frame type a connection may carry, routed to the onFrame
+  // overload for its type
+  using Protocol = WireProtocol<DirectMessageFrame, GroupMessageFrame, EnvelopeFrame, SyncWireFrame>;
+  friend Protocol;
+  void onFrame(const std::shared_ptr<Peer>& from, const Message& msg);
+  void onFrame(const std::shared_ptr<Peer>& from, const Envelope& envelope);
+  void onFrame(const std::shared_ptr<Peer>& from, const SyncFrame& frame);
   void onMessageReceived(std::shared_ptr<Peer> from, const Message& msg);
+  void onConnectionLost(std::shared_ptr<Peer> peer);
+  void onEnvelopeReceived(std::shared_ptr<Peer> from, const Envelope& envelope);
+  // adds a message to its conversation unless we hold it already, returns
+  // false for a duplicate. message_queue_mutex_ must be held
+  bool recordMessage(std::shared_ptr<Peer> peer, const Message& msg);
+  // records messages of one conversation together, the conversation is
+  // the direct chat with peer when empty. returns the new ones in time
+  // order. message_queue_mutex_ must be held
+  std::vector<Message> recordMessages(std::shared_ptr<Peer> peer, const std::string& conversation, std::vector<Message> msgs);
+  // reconciles every conversation we share with a peer that just connected
+  void beginHistorySync(std::shared_ptr<Peer> peer, std::shared_ptr<Connection> connection);
+  void onSyncReceived(std::shared_ptr<Peer> from, const SyncFrame& frame);
+  void deliverEnvelope(const Envelope& envelope);
+  // seals a message for an offline peer and hands it to everyone connected
+  bool relayMessage(std::shared_ptr<Peer> peer, const Message& msg);
+  void flushEnvelopes(std::shared_ptr<Peer> peer, std::shared_ptr<Connection> connection);
   void listenerLoop();
+  // runs the handshake of an accepted socket on a connector thread
+  void spawnAccept(boost::asio::ip::tcp::socket socket);
+  void acceptConnection(boost::asio::ip::tcp::socket socket);
+  // reaches peers outside the LAN, registered with port 0
+  std::unique_ptr<RendezvousClient> rendezvous_;
+  bool isRendezvousPeer(std::shared_ptr<Peer> peer) const;
+  void acceptStream(const std::string& hostname, std::unique_ptr<Stream> stream);
+  std::shared_ptr<Connection> makeConnection(std::shared_ptr<Peer> peer, std::unique_ptr<Stream> stream, bool initiated);
+  bool adoptConnection(std::shared_ptr<Peer> peer, std::shared_ptr<Connection> connection);
+  // runs the handshake, after dialing when dial is set, where stop can
+  // abort it. throws like the handshake does
+  void runHandshake(std::shared_ptr<Connection> connection, bool dial);
+  // connections in runHandshake, guarded by app_mutex_
+  std::set<std::shared_ptr<Connection>> handshaking_;
+  // destroys closed connections and joins finished connector threads
+  void reapConnections();
+  // drops peers from the registry that went quiet and we have nothing
+  // with, called with the peer refresh
+  void expirePeers();
   mutable std::mutex connecting_peers_mutex_;
   std::set<std::shared_ptr<Peer>> connecting_peers_;
   std::string status_message_;
   mutable std::mutex app_mutex_;
   mutable std::mutex connector_thread_mutex_;
   std::vector<std::thread> connector_threads_;
+  // connector threads that are done and wait to be joined
+  std::vector<std::thread::id> finished_connectors_;
+  void spawnConnector(std::function<void()> work);
+  // retired or dead connections waiting for their receive thread to finish
+  std::vector<std::shared_ptr<Connection>> closed_connections_;
 
   public:
-  explicit App(boost::asio::io_context& io_ctx);
+  App(boost::asio::io_context& io_ctx, const Config& config);
 
   ~App();
 
-  // Peer managment
-  const std::vector<std::shared_ptr<Peer>>& getPeers() const;
+  std::uint64_t getNodeId() const;
+
+  // Peer managment, lock free
+  std::shared_ptr<const PeerRegistry::Snapshot> getPeers() const;
 
   // Selection management
-  void selectPeer(int index);
+  void selectPeer(std::shared_ptr<Peer> peer);
   std::shared_ptr<Peer> getSelectedPeer() const;
-  int getSelectedIndex() const;
-  void connectToPeer(std::shared_ptr<Peer> peer);
+  // a speculative connect fails silently
+  void connectToPeer(std::shared_ptr<Peer> peer, bool speculative = false);
   void disconnectFromPeer(std::shared_ptr<Peer> peer);
   bool isConnectedTo(std::shared_ptr<Peer> peer) const;
   bool isConnectingTo(std::shared_ptr<Peer> peer) const;
   void sendMessageToSelected(const std::string& text);
-  std::vector<std::pair<std::shared_ptr<Peer>, Message>> pollIncomingMessages();
-  const std::vector<Message>& getMessageHistory(std::shared_ptr<Peer> peer);
+  void sendMessage(std::shared_ptr<Peer> peer, const std::string& text);
+  // set before connecting to anyone, it isn't synchronized with the
+  // connection threads
+  void setMessageListener(std::function<void(std::shared_ptr<Peer>, const Message&)> listener);
+
+  // Group chats
+  // throws std::invalid_argument if a host name can't be sent, see
+  // isWireName
+  std::string createGroup(const std::vector<std::string>& hostnames);
+  void selectGroup(const std::string& group_id);
+  std::string getSelectedGroup() const;
+  std::vector<std::string> getGroupIds() const;
+  std::vector<std::string> getGroupMembers(const std::string& group_id) const;
+  void sendGroupMessage(const std::string& group_id, const std::string& text);
+
+  // History archive, see history_archive.hpp. both return at once, the
+  // work runs on a connector thread and reports in the status line. an
+  // import adds the messages we don't hold yet, direct chats with peers
+  // we don't know are left out
+  void exportHistory(const std::string& path);
+  void importHistory(const std::string& path);
+
+  // rebuilds the snapshot if anything changed since the last one, returns
+  // true if a new version was published
+  bool publishView();
+  // lock free, the snapshot stays valid for as long as it is held
+  std::shared_ptr<const ViewModel> getView() const;
+
+  // starts discovery from the cached peer table and dials the peers we
+  // talked to recently, so the first message doesn't wait for either
   void performInitialDiscovery();
   void refreshPeers();
   void stop();
   //   const std::string& getStatusMessage() const;
   std::string getStatusMessage() const;
+  void setStatusMessage(const std::string& message);
 };
@@ -0,0 +1,38 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+
+// everything that tells one node apart from another on the same machine.
+// defaults match a single node per machine on the LAN
+struct Config {
+  // name announced to peers, empty means the machine's host name
+  std::string hostname;
+  // chats are accepted and dialed from this address. nodes sharing a
+  // machine need an address each, incoming connections are matched to
+  // peers by address
+  boost::asio::ip::address bind_address = boost::asio::ip::address_v4::any();
+  unsigned short port = 9000;           // TCP, chats
+  unsigned short discovery_port = 9001; // UDP, pings and pongs
+  // broadcast pings to the LAN, and ping these directly as well
+  bool broadcast = true;
+  std::vector<boost::asio::ip::udp::endpoint> discovery_seeds;
+  // identity key and pinned peers, empty means ~/.p2p_chat
+  std::string data_dir;
+  // host:port of a rendezvous server for peers behind NAT, empty for none
+  std::string rendezvous;
+  // inbound limits, per second. bursts of twice the rate pass and 0 turns
+  // a limit off. a peer over its limit is read more slowly, a discovery
+  // source over its limit is ignored
+  double peer_frame_rate = 500;       // frames from one peer
+  double peer_byte_rate = 1 << 20;    // bytes from one peer
+  double discovery_rate = 5;          // packets from one address
+  // a connected peer silent for this many seconds is dropped and dialed
+  // again. heartbeats keep live peers from going silent, 0 turns them off
+  double dead_peer_timeout = 5;
+
+  // parses command line flags over the defaults, throws
+  // std::invalid_argument with a message for the user
+  static Config fromArgs(int argc, char** argv);
+  static const char* usage();
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include "core/wire.hpp"
+#include <chrono>
+#include <string>
+
+// a message sealed to an offline recipient, carried and held by other peers
+// until the recipient shows up
+class Envelope {
+  public:
+  std::string id;        // random, used to drop duplicates
+  std::string recipient; // hostname
+  std::string origin;    // hostname of the sender
+  std::chrono::system_clock::time_point expires;
+  int hops = 0;          // how many more times relays may pass it on
+  std::string signature; // origin's identity signature over signedData()
+  std::string sealed;    // serialized Message sealed to the recipient
+
+  // serialization
+  std::string serialize() const;
+  static Envelope deserialize(const std::string& data);
+
+  // hops are left out since relays change them
+  std::string signedData() const;
+  bool isExpired() const;
+};
+
+// E|id|recipient|origin|expires|hops|signature hex|sealed bytes, the
+// sealed bytes may hold anything
+struct EnvelopeFrame {
+  using Type = Envelope;
+  static constexpr char KIND = 'E';
+  static constexpr auto FIELDS = std::make_tuple(
+    wireField<WireText>(&Envelope::id),
+    wireField<WireText>(&Envelope::recipient),
+    wireField<WireText>(&Envelope::origin),
+    wireField<WireMillis>(&Envelope::expires),
+    wireField<WireInt>(&Envelope::hops),
+    wireField<WireHex>(&Envelope::signature),
+    wireField<WireText>(&Envelope::sealed));
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include "core/message.hpp"
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// chat history written as blocks of columns, for archiving and for loading
+// it back in bulk. a block holds up to a thousand messages of one
+// conversation: timestamps as deltas, senders and group members as
+// indexes into a dictionary of the block, and the content compressed with
+// lz4. every conversation lists the earliest and latest timestamp and a
+// crc of each of its blocks up front, so reading a time range skips the
+// blocks outside it without reading them. conversations are encoded and
+// decoded in parallel.
+//
+// the file is "P2PHIST2" and the conversations, followed by where each
+// one starts and how long it is and then their count. a conversation is
+// its kind and name, its block index and then the blocks
+
+struct ArchivedConversation {
+  // the peer's host name for a direct chat, the group id for a group
+  std::string name;
+  bool group = false;
+  std::vector<Message> messages;
+};
+
+// throws std::runtime_error if the file can't be written, and then leaves
+// whatever was at path before alone
+void writeHistoryArchive(const std::string& path, const std::vector<ArchivedConversation>& conversations);
+// the messages sent in [from, to), in milliseconds since the epoch, in
+// the order they were written. throws std::runtime_error on a missing or
+// damaged file
+std::vector<ArchivedConversation> readHistoryArchive(
+  const std::string& path,
+  std::int64_t from = std::numeric_limits<std::int64_t>::min(),
+  std::int64_t to = std::numeric_limits<std::int64_t>::max());
@@ -0,0 +1,104 @@
+#pragma once
+#include "core/message.hpp"
+#include "core/wire.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// reconciles two peers' copies of a conversation after they were apart.
+// both sides hash the messages they hold over the same time ranges, and
+// only ranges whose hashes differ are split and compared again, so the
+// exchange grows with how far the copies diverged rather than with the
+// length of the history.
+//
+// frames are S|kind|conversation|body, the conversation is empty for the
+// direct chat between the two peers and the group id otherwise:
+//   F  lo:hi:count:hash,...  our fingerprint of each range
+//   I  lo:hi|time:id,...     every message we hold in a small range
+//   W  time:id,...           messages we are missing, please send them
+//   M  length:message...     messages the peer is missing, each behind
+//                            its length in bytes
+
+using MessageId = std::array<std::uint8_t, 16>;
+
+// hash of everything that makes a message, the same on both peers
+MessageId messageId(const Message& msg);
+// milliseconds since the epoch, the precision messages travel with
+std::int64_t messageTime(const Message& msg);
+
+struct SyncEntry {
+  std::int64_t time;
+  MessageId id;
+};
+
+// count and xor of the ids in [lo, hi)
+struct RangeFingerprint {
+  std::int64_t lo;
+  std::int64_t hi;
+  size_t count;
+  MessageId hash;
+};
+
+// the ids of one conversation ordered by time. xor prefixes make any
+// range's fingerprint two binary searches away
+class HistoryIndex {
+  private:
+  std::vector<SyncEntry> entries_;
+  // prefix_[i] is the xor of the first i ids
+  std::vector<MessageId> prefix_{MessageId{}};
+
+  size_t lowerBound(std::int64_t time) const;
+
+  public:
+  // returns false if the message is already indexed
+  bool insert(const Message& msg);
+  // indexes many at once, the prefixes are rebuilt once. says for each of
+  // msgs whether it was new, a repeat within msgs counts as held
+  std::vector<bool> insertAll(const std::vector<Message>& msgs);
+  bool contains(const SyncEntry& entry) const;
+  RangeFingerprint fingerprint(std::int64_t lo, std::int64_t hi) const;
+  std::vector<SyncEntry> range(std::int64_t lo, std::int64_t hi) const;
+  // times of the first and last message in [lo, hi), false if it is empty
+  bool span(std::int64_t lo, std::int64_t hi, std::int64_t& first, std::int64_t& last) const;
+  size_t size() const { return entries_.size(); }
+};
+
+struct SyncFrame {
+  char kind = 0;
+  std::string conversation;
+  std::string body;
+
+  // throws std::invalid_argument on anything that isn't a sync frame
+  static SyncFrame parse(const std::string& payload);
+  std::string serialize() const;
+};
+
+// S|kind|conversation|body
+struct SyncWireFrame {
+  using Type = SyncFrame;
+  static constexpr char KIND = 'S';
+  static constexpr auto FIELDS = std::make_tuple(
+    wireField<WireLetter>(&SyncFrame::kind),
+    wireField<WireText>(&SyncFrame::conversation),
+    wireField<WireText>(&SyncFrame::body));
+};
+
+// what to do after a sync frame: frames to answer with, and our messages
+// the peer is missing, to be sent as M frames
+struct SyncReply {
+  std::vector<std::string> frames;
+  std::vector<SyncEntry> missing;
+};
+
+// opens a sync of one conversation, sent by one side only
+std::string beginSync(const std::string& conversation, const HistoryIndex& index);
+// answers an F, I or W frame against our side of the conversation, throws
+// std::invalid_argument on a malformed body
+SyncReply answerSync(const SyncFrame& frame, const HistoryIndex& index);
+// M frames carrying msgs, as few as fit. the receiver applies each frame's
+// messages together
+std::vector<std::string> messageSyncFrames(const std::string& conversation, const std::vector<Message>& msgs);
+// throws std::invalid_argument on a malformed body
+std::vector<Message> parseMessageSync(const SyncFrame& frame);
@@ -1,6 +1,8 @@
 #pragma once
+#include "core/wire.hpp"
 #include <string>
 #include <chrono>
+#include <vector>
 
 class Message {
   public:
@@ -8,13 +10,43 @@ class Message {
   std::string content;
   std::chrono::system_clock::time_point timestamp;
 
+  // set for group messages, members are hostnames and include the sender
+  std::string group_id;
+  std::vector<std::string> group_members;
+
   Message(const std::string& sender, const std::string& content); // create new message
   Message() = default;
 
+  bool isGroupMessage() const { return !group_id.empty(); }
+
   // serialization
   std::string serialize() const;
+  // into out, reusing its capacity
+  void serialize(std::string& out) const;
   static Message deserialize(const std::string& data);
 
   // helpers
   std::string getFormattedTime() const;
 };
+
+// D|sender|timestamp|content
+struct DirectMessageFrame {
+  using Type = Message;
+  static constexpr char KIND = 'D';
+  static constexpr auto FIELDS = std::make_tuple(
+    wireField<WireText>(&Message::sender),
+    wireField<WireMillis>(&Message::timestamp),
+    wireField<WireText>(&Message::content));
+};
+
+// G|group id|member,member|sender|timestamp|content
+struct GroupMessageFrame {
+  using Type = Message;
+  static constexpr char KIND = 'G';
+  static constexpr auto FIELDS = std::make_tuple(
+    wireField<WireText>(&Message::group_id),
+    wireField<WireList>(&Message::group_members),
+    wireField<WireText>(&Message::sender),
+    wireField<WireMillis>(&Message::timestamp),
+    wireField<WireText>(&Message::content));
+};
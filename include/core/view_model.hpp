@@ -0,0 +1,79 @@
+#pragma once
+#include "core/message.hpp"
+#include "network/peer.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// message history ordered by timestamp, stored in fixed size chunks. copies
+// share every chunk, and appending to a copy only duplicates the last chunk
+// if another copy still holds it, so snapshotting a long history is cheap
+class MessageLog {
+  private:
+  static constexpr size_t CHUNK_SIZE = 256;
+  std::vector<std::shared_ptr<std::vector<Message>>> chunks_;
+  size_t size_ = 0;
+  std::uint64_t reorders_ = 0;
+
+  public:
+  void push_back(const Message& msg);
+  // keeps timestamp order. a message older than the newest one rebuilds
+  // the chunks from its position on
+  void insert(const Message& msg);
+  // inserts messages ordered by timestamp, rebuilding the chunks at most
+  // once rather than once per late message
+  void insertAll(const std::vector<Message>& msgs);
+  // index of the first message sent at or after time
+  size_t lowerBound(std::chrono::system_clock::time_point time) const;
+  const Message& operator[](size_t index) const;
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  // bumped whenever a message lands before the end, indexes into the log
+  // taken earlier are stale then
+  std::uint64_t reorders() const { return reorders_; }
+};
+
+enum class ConnectionState { Disconnected, Connecting, Connected };
+
+struct PeerView {
+  std::shared_ptr<Peer> peer;
+  ConnectionState state;
+  // the peer is sending faster than its limits allow
+  bool throttled = false;
+  std::uint64_t throttled_frames = 0;
+  // smoothed round trip of the live connection, -1 before the first
+  double rtt_ms = -1;
+  double rtt_jitter_ms = 0;
+  // node id of the side that dialed the live connection, the same on both
+  // ends. 0 without one
+  std::uint64_t dialer_node_id = 0;
+};
+
+struct GroupView {
+  std::string id;
+  std::vector<std::string> members; // hostnames including ours
+};
+
+// everything the UI draws, published by App as one immutable snapshot.
+// the version increases with every snapshot
+struct ViewModel {
+  std::uint64_t version = 0;
+  std::string hostname; // ours, the sender of our own messages
+  std::vector<PeerView> peers;
+  std::vector<GroupView> groups;
+  std::string status;
+  // discovery packets dropped for coming too fast from their address
+  std::uint64_t discovery_dropped = 0;
+  // startup to our first message going out over a connection, -1 before
+  double first_message_ms = -1;
+  std::map<std::shared_ptr<Peer>, MessageLog> histories;
+  std::map<std::string, MessageLog> group_histories;
+
+  const MessageLog& getHistory(std::shared_ptr<Peer> peer) const;
+  const MessageLog& getGroupHistory(const std::string& group_id) const;
+  const GroupView* findGroup(const std::string& group_id) const;
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// the wire protocol as a schema. every frame is a kind letter followed by
+// pipe separated fields, the last of which runs to the end of the frame
+// and may hold anything:
+//   K|field|field|...|last
+// a frame type names its kind and lists its fields once, as member
+// pointers with a codec each. the encoder, the bounds checked decoder and
+// the table routing kinds to typed handlers are all generated from that
+// list, so a new frame type is a struct rather than more string parsing:
+//   struct PingFrame {
+//     using Type = Ping;
+//     static constexpr char KIND = 'P';
+//     static constexpr auto FIELDS = std::make_tuple(
+//       wireField<WireText>(&Ping::from),
+//       wireField<WireMillis>(&Ping::sent));
+//   };
+
+// field codecs. encoders throw std::invalid_argument for a value that
+// can't be framed, decoders for text that isn't a valid value
+struct WireText {
+  // anything but a pipe, the last field may hold pipes too
+  static void encode(std::string& out, const std::string& value, bool last);
+  static void decode(std::string_view text, std::string& value);
+};
+struct WireLetter {
+  static void encode(std::string& out, char value, bool last);
+  static void decode(std::string_view text, char& value);
+};
+struct WireInt {
+  static void encode(std::string& out, int value, bool last);
+  static void decode(std::string_view text, int& value);
+  static void encode(std::string& out, std::int64_t value, bool last);
+  static void decode(std::string_view text, std::int64_t& value);
+};
+// a time as milliseconds since the epoch, the precision it travels with
+struct WireMillis {
+  static void encode(std::string& out, std::chrono::system_clock::time_point value, bool last);
+  static void decode(std::string_view text, std::chrono::system_clock::time_point& value);
+};
+// arbitrary bytes as lowercase hex
+struct WireHex {
+  static void encode(std::string& out, const std::string& value, bool last);
+  static void decode(std::string_view text, std::string& value);
+};
+// names joined by commas, empty for none
+struct WireList {
+  static void encode(std::string& out, const std::vector<std::string>& value, bool last);
+  static void decode(std::string_view text, std::vector<std::string>& value);
+};
+// a host name goes out as a text field and in member lists, so it can't
+// be empty or hold either separator
+bool isWireName(std::string_view name);
+// a time_point can't hold every int64 of milliseconds, converting one out
+// of range overflows
+bool isWireMillis(std::int64_t millis);
+
+template <typename Codec, typename Class, typename T>
+struct WireField {
+  T Class::*member;
+};
+
+template <typename Codec, typename Class, typename T>
+constexpr WireField<Codec, Class, T> wireField(T Class::*member) {
+  return {member};
+}
+
+// walks a frame's fields, never past its end
+class WireReader {
+  private:
+  std::string_view frame_;
+  size_t pos_;
+
+  public:
+  // throws std::invalid_argument unless frame starts with kind and a pipe
+  WireReader(std::string_view frame, char kind);
+  // the next field, or the rest of the frame for the last one
+  std::string_view next(bool last);
+};
+
+template <typename Codec, typename Class, typename T>
+void encodeWireField(std::string& out, const Class& value, WireField<Codec, Class, T> field, bool last) {
+  out += '|';
+  Codec::encode(out, value.*field.member, last);
+}
+
+template <typename Codec, typename Class, typename T>
+void decodeWireField(WireReader& reader, Class& value, WireField<Codec, Class, T> field, bool last) {
+  Codec::decode(reader.next(last), value.*field.member);
+}
+
+template <typename Frame, size_t... I>
+void encodeWireFields(std::string& out, const typename Frame::Type& value, std::index_sequence<I...>) {
+  (encodeWireField(out, value, std::get<I>(Frame::FIELDS), I + 1 == sizeof...(I)), ...);
+}
+
+template <typename Frame, size_t... I>
+void decodeWireFields(WireReader& reader, typename Frame::Type& value, std::index_sequence<I...>) {
+  (decodeWireField(reader, value, std::get<I>(Frame::FIELDS), I + 1 == sizeof...(I)), ...);
+}
+
+template <typename Frame>
+constexpr size_t wireFieldCount() {
+  constexpr size_t count = std::tuple_size<decltype(Frame::FIELDS)>::value;
+  static_assert(count > 0, "a frame needs at least one field");
+  static_assert(Frame::KIND > ' ' && Frame::KIND < 127 && Frame::KIND != '|', "a frame kind is a printable letter");
+  return count;
+}
+
+// into out, replacing what it held, so a buffer kept around is reused
+template <typename Frame>
+void encodeFrame(std::string& out, const typename Frame::Type& value) {
+  out.assign(1, Frame::KIND);
+  encodeWireFields<Frame>(out, value, std::make_index_sequence<wireFieldCount<Frame>()>());
+}
+
+template <typename Frame>
+std::string encodeFrame(const typename Frame::Type& value) {
+  std::string out;
+  encodeFrame<Frame>(out, value);
+  return out;
+}
+
+// throws std::invalid_argument on anything that isn't a frame of this type
+template <typename Frame>
+typename Frame::Type decodeFrame(std::string_view frame) {
+  WireReader reader(frame, Frame::KIND);
+  typename Frame::Type value{};
+  decodeWireFields<Frame>(reader, value, std::make_index_sequence<wireFieldCount<Frame>()>());
+  return value;
+}
+
+// the frame types one side understands. dispatch decodes a frame by its
+// kind letter and calls handler.onFrame(context, value) with the decoded
+// value, picking the overload at compile time. the kind table is built at
+// compile time too, a frame costs an array lookup and a direct call
+template <typename... Frames>
+class WireProtocol {
+  private:
+  static constexpr bool distinctKinds() {
+    const char kinds[] = {Frames::KIND...};
+    for (size_t i = 0; i < sizeof...(Frames); ++i) {
+      for (size_t j = i + 1; j < sizeof...(Frames); ++j) {
+        if (kinds[i] == kinds[j]) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+  static_assert(sizeof...(Frames) > 0, "a protocol needs at least one frame type");
+  static_assert(distinctKinds(), "two frame types share a kind");
+
+  template <typename Handler, typename Context>
+  using Route = void (*)(Handler&, const Context&, std::string_view);
+
+  template <typename Frame, typename Handler, typename Context>
+  static void route(Handler& handler, const Context& context, std::string_view frame) {
+    handler.onFrame(context, decodeFrame<Frame>(frame));
+  }
+
+  template <typename Handler, typename Context>
+  static constexpr std::array<Route<Handler, Context>, 128> routes() {
+    std::array<Route<Handler, Context>, 128> table{};
+    ((table[static_cast<size_t>(Frames::KIND)] = &route<Frames, Handler, Context>), ...);
+    return table;
+  }
+
+  public:
+  // throws std::invalid_argument for an unknown kind or a malformed frame
+  template <typename Handler, typename Context>
+  static void dispatch(Handler& handler, const Context& context, std::string_view frame) {
+    static constexpr auto table = routes<Handler, Context>();
+    size_t kind = frame.empty() ? 0 : static_cast<unsigned char>(frame[0]);
+    if (kind >= table.size() || !table[kind]) {
+      throw std::invalid_argument("unknown frame kind");
+    }
+    table[kind](handler, context, frame);
+  }
+};
@@ -0,0 +1,119 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+typedef struct evp_pkey_st EVP_PKEY;
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+constexpr size_t AEAD_KEY_SIZE = 32;
+constexpr size_t AEAD_NONCE_SIZE = 12;
+constexpr size_t AEAD_TAG_SIZE = 16;
+
+using PublicKey = std::array<std::uint8_t, 32>;
+using SymmetricKey = std::array<std::uint8_t, AEAD_KEY_SIZE>;
+using Nonce = std::array<std::uint8_t, AEAD_NONCE_SIZE>;
+using TicketId = std::array<std::uint8_t, 16>;
+
+// AEAD suites a connection can use. AES-GCM is fastest with AES-NI,
+// ChaCha20-Poly1305 wins on CPUs without it
+enum class CipherSuite : std::uint8_t { ChaCha20Poly1305 = 0, Aes256Gcm = 1 };
+constexpr size_t CIPHER_SUITE_COUNT = 2;
+
+// measured throughput in MB/s, indexed by CipherSuite
+using CipherScores = std::array<std::uint32_t, CIPHER_SUITE_COUNT>;
+
+// keys and base nonces for both directions of one connection, plus the
+// secret and ticket id used to resume the session on the next connect
+struct SessionKeys {
+  SymmetricKey send_key;
+  Nonce send_nonce;
+  SymmetricKey receive_key;
+  Nonce receive_nonce;
+  SymmetricKey resumption_secret;
+  TicketId ticket;
+};
+
+// loads a private key of the given EVP_PKEY type from a PEM file, creating
+// it with owner only permissions on first run
+EVP_PKEY* loadOrCreateKey(const std::string& path, int type);
+
+// X25519 key pair used for handshakes and sealed envelopes
+class KeyExchange {
+  private:
+  EVP_PKEY* key_;
+
+  public:
+  // fresh key pair
+  KeyExchange();
+  // long term key pair kept on disk
+  explicit KeyExchange(const std::string& path);
+  ~KeyExchange();
+  KeyExchange(const KeyExchange&) = delete;
+  KeyExchange& operator=(const KeyExchange&) = delete;
+
+  PublicKey getPublicKey() const;
+  // runs X25519 against the peer's key
+  SymmetricKey deriveSharedSecret(const PublicKey& peer_key) const;
+};
+
+// expands a shared secret into session keys with HKDF-SHA256. both sides
+// get the same keys, swapped according to who dialed
+SessionKeys expandSessionKeys(const SymmetricKey& secret,
+                              const std::uint8_t* salt, size_t salt_len,
+                              bool initiator);
+
+// AEAD state for one direction of a connection. the cipher context is
+// allocated and keyed once, every frame only resets the nonce, so sealing
+// and opening never allocate
+class FrameCipher {
+  private:
+  EVP_CIPHER_CTX* ctx_;
+  Nonce base_nonce_;
+  std::uint64_t counter_ = 0;
+
+  // next per-frame nonce, base nonce xor frame counter
+  Nonce nextNonce();
+
+  public:
+  FrameCipher(CipherSuite suite, const SymmetricKey& key, const Nonce& nonce,
+              bool encrypt);
+  ~FrameCipher();
+  FrameCipher(const FrameCipher&) = delete;
+  FrameCipher& operator=(const FrameCipher&) = delete;
+
+  // encrypts len bytes from in to out and writes the tag. in and out may
+  // be the same buffer
+  void seal(const std::uint8_t* in, std::uint8_t* out, size_t len,
+            std::uint8_t* tag);
+  // decrypts data in place, returns false if the tag doesn't verify
+  bool open(std::uint8_t* data, size_t len, const std::uint8_t* tag);
+};
+
+// encrypts to a static X25519 key with a throwaway key pair, so only the
+// holder of that key can open it
+std::string sealToKey(const PublicKey& recipient, const std::string& plaintext);
+bool openSealed(const KeyExchange& own_key, const std::string& sealed,
+                std::string& plaintext);
+
+const char* cipherSuiteName(CipherSuite suite);
+
+// seals frames of frame_size bytes for roughly the given duration and
+// returns the throughput in bytes per second
+double measureCipherThroughput(CipherSuite suite, size_t frame_size,
+                               std::chrono::milliseconds duration);
+// quick startup probe of every suite, advertised in the handshake
+CipherScores benchmarkCipherSuites();
+// picks the suite whose slower side is fastest, so both peers agree on the
+// best suite for the pair. ties go to the lower suite id
+CipherSuite negotiateCipherSuite(const CipherScores& own,
+                                 const CipherScores& peer);
+// "name:score,name:score" form used in the handshake
+std::string encodeCipherScores(const CipherScores& scores);
+CipherScores parseCipherScores(const std::string& text);
+
+// hex helpers for putting keys into text handshakes
+std::string toHex(const std::uint8_t* data, size_t len);
+bool fromHex(const std::string& hex, std::uint8_t* out, size_t len);
@@ -0,0 +1,109 @@
+#pragma once
+#include "crypto/crypto.hpp"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+using Signature = std::array<std::uint8_t, 64>;
+using Digest = std::array<std::uint8_t, 32>;
+
+// long term Ed25519 identity key, created on first run and kept on disk
+class Identity {
+  private:
+  EVP_PKEY* key_;
+
+  public:
+  explicit Identity(const std::string& path);
+  ~Identity();
+  Identity(const Identity&) = delete;
+  Identity& operator=(const Identity&) = delete;
+
+  PublicKey getPublicKey() const;
+  Signature sign(const std::uint8_t* data, size_t len) const;
+};
+
+// remembers signatures that already verified, so checking the same peer's
+// identity again costs a hash instead of an Ed25519 verify
+class SignatureCache {
+  private:
+  mutable std::mutex mutex_;
+  std::set<Digest> verified_;
+  std::deque<Digest> order_; // oldest first, for eviction
+  size_t capacity_;
+
+  public:
+  explicit SignatureCache(size_t capacity = 1024);
+  bool verify(const PublicKey& key, const std::uint8_t* data, size_t len,
+              const Signature& signature);
+};
+
+// trust on first use pins of peer hostname to identity key, along with the
+// envelope key the peer last presented under that identity
+class TrustStore {
+  private:
+  struct Pin {
+    PublicKey identity;
+    bool has_envelope_key = false;
+    PublicKey envelope_key{};
+  };
+  std::string path_;
+  std::map<std::string, Pin> pins_;
+  mutable std::mutex mutex_;
+
+  void save() const;
+
+  public:
+  explicit TrustStore(const std::string& path);
+  // pins keys for unseen peers, returns false if the peer presented a
+  // different key than the one pinned for it
+  bool checkAndPin(const std::string& name, const PublicKey& key);
+  bool getPin(const std::string& name, PublicKey& key) const;
+  // only call after checkAndPin accepted the peer's identity
+  void setEnvelopeKey(const std::string& name, const PublicKey& key);
+  bool getEnvelopeKey(const std::string& name, PublicKey& key) const;
+};
+
+// resumption secrets from earlier sessions, keyed by peer identity. a
+// ticket is replaced every time it is used
+class SessionCache {
+  private:
+  struct Entry {
+    TicketId ticket;
+    SymmetricKey secret;
+  };
+  mutable std::mutex mutex_;
+  std::map<PublicKey, Entry> sessions_;
+
+  public:
+  void store(const PublicKey& identity, const TicketId& ticket,
+             const SymmetricKey& secret);
+  bool find(const PublicKey& identity, TicketId& ticket,
+            SymmetricKey& secret) const;
+};
+
+// per node handshake material shared by every connection. the X25519
+// handshake key lives for one run and is signed by the identity key once,
+// so peers can verify it from their signature cache on every reconnect
+struct SecurityContext {
+  std::uint64_t node_id;
+  Identity identity;
+  KeyExchange handshake_key;
+  Signature handshake_signature;
+  // long term X25519 key that relayed envelopes are sealed to
+  KeyExchange envelope_key;
+  CipherScores cipher_scores; // measured at startup, sent in the handshake
+  SignatureCache signatures;
+  TrustStore trust_store;
+  SessionCache sessions;
+
+  SecurityContext(std::uint64_t node_id, const std::string& data_dir);
+};
+
+// bytes covered by a node's handshake signature
+std::string handshakeSignedData(std::uint64_t node_id,
+                                const PublicKey& handshake_key,
+                                const PublicKey& envelope_key);
@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// 16 kHz mono 16 bit PCM in 20 ms frames
+constexpr unsigned int AUDIO_SAMPLE_RATE = 16000;
+constexpr size_t AUDIO_FRAME_SAMPLES = 320;
+constexpr unsigned int AUDIO_FRAME_MS = 20;
+
+struct AudioFrame {
+  std::uint32_t timestamp = 0; // in samples, like RTP
+  bool concealed = false;      // synthesized to cover a lost frame
+  std::array<std::int16_t, AUDIO_FRAME_SAMPLES> samples{};
+};
+
+// where outgoing audio comes from. read is called once per frame from the
+// pacing thread and should not block for long, the channel stamps frames
+// itself
+class AudioSource {
+  public:
+  virtual ~AudioSource() = default;
+  // fills one frame, returns false when the source has ended
+  virtual bool read(AudioFrame& frame) = 0;
+};
+
+// where received audio goes, called once per frame from the playout thread
+class AudioSink {
+  public:
+  virtual ~AudioSink() = default;
+  virtual void write(const AudioFrame& frame) = 0;
+};
+
+// synthetic sine tone, lets the media path run without audio hardware
+class ToneSource : public AudioSource {
+  private:
+  double frequency_;
+  double amplitude_;
+  std::uint64_t sample_ = 0;
+
+  public:
+  explicit ToneSource(double frequency = 440.0, double amplitude = 0.25);
+  bool read(AudioFrame& frame) override;
+};
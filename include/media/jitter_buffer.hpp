@@ -0,0 +1,65 @@
+#pragma once
+#include "media/audio.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+// reorders incoming frames and releases one per playout tick. the delay it
+// holds adapts to the measured interarrival jitter, and gaps are covered by
+// fading out the last good frame
+class JitterBuffer {
+  private:
+  static constexpr size_t MIN_DELAY_FRAMES = 1;
+  static constexpr size_t MAX_DELAY_FRAMES = 10;
+  static constexpr std::uint32_t MAX_CONCEALED_RUN = 3;
+  // ticks the buffer must stay above target before a frame is skipped
+  static constexpr std::uint32_t SHRINK_AFTER_TICKS = 50;
+
+  mutable std::mutex mutex_;
+  // keyed by extended sequence number so wraparound keeps the order
+  std::map<std::uint64_t, AudioFrame> frames_;
+  std::uint64_t next_sequence_ = 0;
+  bool playing_ = false;
+  size_t target_frames_ = MIN_DELAY_FRAMES;
+  std::uint32_t surplus_ticks_ = 0;
+  bool stretch_pending_ = false;
+
+  // RFC 3550 interarrival jitter, in milliseconds
+  double jitter_ms_ = 0;
+  bool has_previous_ = false;
+  std::chrono::steady_clock::time_point previous_arrival_;
+  std::uint32_t previous_timestamp_ = 0;
+  std::uint16_t highest_sequence_ = 0;
+  // starts at one so a reordered first packet can't wrap below zero
+  std::uint64_t sequence_cycles_ = 1;
+
+  AudioFrame last_frame_;
+  std::uint32_t concealed_run_ = 0;
+
+  // stats
+  std::uint64_t played_ = 0;
+  std::uint64_t concealed_ = 0;
+  std::uint64_t late_ = 0;
+  std::uint64_t dropped_ = 0;
+
+  std::uint64_t extendSequence(std::uint16_t sequence);
+  AudioFrame conceal(std::uint32_t timestamp);
+
+  public:
+  struct Stats {
+    std::uint64_t played;
+    std::uint64_t concealed;
+    std::uint64_t late;    // arrived after their playout time
+    std::uint64_t dropped; // discarded to shrink the delay
+    size_t target_frames;
+    double jitter_ms;
+  };
+
+  void push(std::uint16_t sequence, const AudioFrame& frame,
+            std::chrono::steady_clock::time_point arrival);
+  // the frame to play this tick, a concealed one if nothing is due
+  AudioFrame pop();
+  Stats getStats() const;
+};
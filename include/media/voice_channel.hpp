@@ -0,0 +1,52 @@
+#pragma once
+#include "media/audio.hpp"
+#include "media/jitter_buffer.hpp"
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+// one way pair of RTP style audio streams over UDP, kept apart from the
+// TCP connection so a lost packet never holds up the audio behind it.
+// frames are paced out every 20 ms and played out of a jitter buffer on
+// a clock of their own
+class VoiceChannel {
+  private:
+  boost::asio::ip::udp::socket socket_;
+  boost::asio::ip::udp::endpoint remote_;
+  std::uint32_t ssrc_;
+  std::shared_ptr<AudioSource> source_;
+  std::shared_ptr<AudioSink> sink_;
+  JitterBuffer jitter_buffer_;
+  std::thread send_thread_;
+  std::thread receive_thread_;
+  std::thread playout_thread_;
+  std::atomic<bool> running_{false};
+
+  // deliberate packet loss on send, for testing
+  std::atomic<double> send_loss_rate_{0.0};
+  std::mt19937 loss_rng_;
+
+  void sendLoop();
+  void receiveLoop();
+  void playoutLoop();
+
+  public:
+  // binds to the given UDP port, 0 picks a free one
+  VoiceChannel(boost::asio::io_context& io_ctx, unsigned short local_port);
+  ~VoiceChannel();
+  VoiceChannel(const VoiceChannel&) = delete;
+  VoiceChannel& operator=(const VoiceChannel&) = delete;
+
+  unsigned short getLocalPort() const;
+  // streams the source to remote and plays what remote sends into sink
+  void start(const boost::asio::ip::udp::endpoint& remote,
+             std::shared_ptr<AudioSource> source,
+             std::shared_ptr<AudioSink> sink);
+  void stop();
+  void setSendLossRate(double rate);
+  JitterBuffer::Stats getStats() const;
+};
@@ -1,47 +1,257 @@
 #pragma once
+#include "core/envelope.hpp"
 #include "core/message.hpp"
+#include "core/wire.hpp"
+#include "crypto/crypto.hpp"
+#include "crypto/identity.hpp"
 #include "network/peer.hpp"
+#include "network/stream.hpp"
+#include "network/token_bucket.hpp"
+#include <atomic>
 #include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <string_view>
+#include <vector>
+
+// where a connection hands the frames it receives: the handler, and the
+// dispatch function WireProtocol generated for its type. a frame costs
+// one plain call, no virtual call or std::function
+struct FrameRoute {
+  void* handler = nullptr;
+  void (*dispatch)(void* handler, const std::shared_ptr<Peer>& from, std::string_view frame) = nullptr;
+
+  // frames go to handler.onFrame(from, value) for each frame type in
+  // Protocol, anything else ends the connection
+  template <typename Protocol, typename Handler>
+  static FrameRoute to(Handler& handler) {
+    return {&handler, [](void* target, const std::shared_ptr<Peer>& from, std::string_view frame) {
+      Protocol::dispatch(*static_cast<Handler*>(target), from, frame);
+    }};
+  }
+};
+
+// a ping, or the answer echoing it. the stamp is the pinger's steady
+// clock in microseconds, so the answer alone gives the round trip
+struct Heartbeat {
+  char kind = 0; // P for a ping, A for its answer
+  std::int64_t stamp = 0;
+};
+
+// H|kind|stamp, handled by the connection itself
+struct HeartbeatFrame {
+  using Type = Heartbeat;
+  static constexpr char KIND = 'H';
+  static constexpr auto FIELDS = std::make_tuple(
+    wireField<WireLetter>(&Heartbeat::kind),
+    wireField<WireInt>(&Heartbeat::stamp));
+};
 
 class Connection {
   private:
   // member variables
   std::shared_ptr<Peer> peer_;
-  boost::asio::ip::tcp::socket socket_;
+  boost::asio::io_context* io_ctx_ = nullptr; // set when we dial over TCP
+  boost::asio::ip::address local_address_;
+  std::unique_ptr<Stream> stream_;
   std::thread receive_thread_;
-  std::function<void(const Message&)> on_message_received_;
+  std::thread send_thread_;
+  FrameRoute route_;
   std::function<void()> on_disconnect_;
   bool connected_;
   mutable std::mutex mutex_;
 
+  struct QueuedFrame {
+    std::shared_ptr<const std::string> payload;
+    // set when the payload is a buffer of spare_payloads_, which it goes
+    // back to once written
+    std::shared_ptr<std::string> spare;
+  };
+  // outgoing frame payloads, written by send_thread_. payloads are shared
+  // so a group message is encoded once and queued to every member as is
+  std::deque<QueuedFrame> send_queue_;
+  // bulk transfers such as history sync, only sent while send_queue_ is
+  // empty so chat messages never wait behind them
+  std::deque<QueuedFrame> bulk_queue_;
+  // buffers sendMessage encodes into, so a direct message doesn't allocate
+  // its payload once the connection is warm
+  std::vector<std::shared_ptr<std::string>> spare_payloads_;
+  // frames taken off the queues for one write, used by send_thread_
+  std::vector<QueuedFrame> send_batch_;
+  std::condition_variable send_cv_;
+  bool send_closed_ = false;
+
+  // handshake state
+  std::shared_ptr<SecurityContext> security_;
+  std::uint64_t local_node_id_;
+  std::uint64_t remote_node_id_ = 0;
+  PublicKey remote_identity_{};
+  bool initiated_; // true if we dialed out, false if accepted
+  bool resumed_ = false;
+  CipherSuite cipher_suite_ = CipherSuite::ChaCha20Poly1305;
+  bool retired_ = false;
+  // set once the handshake is over or aborted, wakes its deadline
+  bool handshake_ended_ = false;
+  std::condition_variable handshake_cv_;
+  std::atomic<bool> started_{false};
+  std::atomic<bool> finished_{false};
+  // bytes read from the stream but not consumed yet, [read_pos_,
+  // read_end_). reads fill it a chunk at a time, so a small frame's header
+  // and body usually come in with a single read
+  std::vector<std::uint8_t> read_buffer_;
+  size_t read_pos_ = 0;
+  size_t read_end_ = 0;
+
+  // per direction AEAD state, set up by the handshake. frame buffers are
+  // reused and frames are decrypted in place, so steady state sends and
+  // receives don't allocate
+  std::unique_ptr<FrameCipher> send_cipher_;
+  std::unique_ptr<FrameCipher> receive_cipher_;
+  std::vector<std::uint8_t> send_buffer_;
+  std::vector<std::uint8_t> receive_buffer_;
+
+  // inbound limits, checked against each frame's header before its body
+  // is read. a peer over them is read more slowly, so TCP pushes back on
+  // it instead of us parsing everything it sends
+  TokenBucket frame_bucket_;
+  TokenBucket byte_bucket_;
+  // wakes a throttled receive thread on disconnect
+  std::condition_variable throttle_cv_;
+  std::uint64_t throttled_frames_ = 0;
+  std::chrono::steady_clock::duration throttled_time_{};
+  std::chrono::steady_clock::time_point throttled_until_{};
+
+  // liveness. the send thread pings every interval and gives up on a peer
+  // it hasn't heard from within the dead timeout. 0 turns both off
+  std::chrono::steady_clock::duration heartbeat_interval_{};
+  std::chrono::steady_clock::duration dead_timeout_{};
+  // steady clock of the last frame read, or of the last wait while we hold
+  // the peer back, since its silence is ours then
+  std::atomic<std::chrono::steady_clock::rep> last_heard_{0};
+  std::atomic<bool> timed_out_{false};
+  // smoothed round trip and its mean deviation, the way TCP keeps them
+  double srtt_ms_ = -1;
+  double rttvar_ms_ = 0;
+
   // background thread function
   // listens for incoming messages
   void receiveLoop();
+  // drains send_queue_ onto the socket
+  void sendLoop();
+  // reads exactly len bytes, from read_buffer_ first
+  void readExactly(std::uint8_t* data, size_t len);
+  // reads more of the stream into read_buffer_
+  void fillReadBuffer();
+  std::string readLine();
+  // the handshake itself, handshake runs it against its deadline
+  void exchangeHandshake();
+  // encrypts a frame into send_buffer_ at offset and returns the offset
+  // past it, only called from send_thread_
+  size_t sealFrame(const std::string& payload, size_t offset);
+  // reads and decrypts a single frame, throws on a bad frame. the frame
+  // stays valid until the next read
+  std::string_view readFrame();
+  bool queueFrame(std::deque<QueuedFrame>& queue, QueuedFrame frame);
+  // waits until the limits let a frame of len bytes through, throws if
+  // the connection goes away meanwhile
+  void throttle(size_t len);
+  void onHeartbeat(const Heartbeat& heartbeat);
+  // the peer has been silent for too long, ends the connection like a
+  // failed read would
+  void expire();
+  // marks the connection lost and tells the owner, once
+  void fail();
 
   public:
   Connection(
     std::shared_ptr<Peer> peer,
+    std::shared_ptr<SecurityContext> security,
     boost::asio::io_context& io_ctx,
-    std::function<void(const Message&)> message_callback,
-    std::function<void()> on_disconnect
+    FrameRoute route,
+    std::function<void()> on_disconnect,
+    const boost::asio::ip::address& local_address
   );
 
   Connection(
     std::shared_ptr<Peer> peer,
-    std::function<void(const Message&)> message_callback,
+    std::shared_ptr<SecurityContext> security,
+    FrameRoute route,
     std::function<void()> on_disconnect,
     boost::asio::ip::tcp::socket socket
   );
 
+  // over an already established stream, such as a hole punched UDP path
+  Connection(
+    std::shared_ptr<Peer> peer,
+    std::shared_ptr<SecurityContext> security,
+    FrameRoute route,
+    std::function<void()> on_disconnect,
+    std::unique_ptr<Stream> stream,
+    bool initiated
+  );
+
   ~Connection();
 
+  struct Stats {
+    std::uint64_t throttled_frames; // frames held back by the limits
+    double throttled_ms;            // time spent holding them back
+    bool throttled;                 // held back in the last few seconds
+    double rtt_ms;                  // smoothed round trip, -1 before the first
+    double rtt_jitter_ms;           // mean deviation of the round trip
+  };
+
+  // dials the peer and runs the handshake, throws on failure
   void connect();
+  // exchanges node ids and keys with the remote side and checks its
+  // identity, resuming the previous session when both sides still hold its
+  // ticket. returns once both sides proved they hold the session keys, so
+  // a connection that made it through is authenticated. a peer that
+  // hasn't finished it within a few seconds fails it. throws on failure
+  void handshake();
+  // fails a handshake in progress from any thread, as if the peer went
+  // away. does nothing once the handshake is over
+  void abortHandshake();
+  // starts the receive and send threads once the connection has been
+  // adopted
+  void start();
+  // frames and bytes per second, bursts of twice that pass. 0 is no limit.
+  // set before start
+  void setInboundLimits(double frame_rate, double byte_rate);
+  // a peer silent for this long is dropped, found by heartbeats and by TCP
+  // giving up on unacknowledged data. 0 is never. set before start
+  void setDeadTimeout(std::chrono::milliseconds timeout);
+  // flushes queued frames, then stops sending and drains the socket until
+  // the peer closes its side. used for the losing socket of a simultaneous
+  // open
+  void retire();
   bool sendMessage(const Message& msg);
+  // queues an already encoded payload, returns false if the connection no
+  // longer accepts frames
+  bool sendFrame(std::shared_ptr<const std::string> payload);
+  // like sendFrame, on the low priority path
+  bool sendBulkFrame(std::shared_ptr<const std::string> payload);
   void disconnect();
   bool isConnected() const;
+  bool isRetired() const;
+  bool isFinished() const;
+  // ended because the peer went silent, rather than by closing
+  bool hasTimedOut() const;
+  // nothing heard for two heartbeat intervals, a live peer pings more
+  // often. always true with heartbeats off, there is nothing to tell by
+  bool hasGoneQuiet() const;
+
+  bool isResumed() const;
+  CipherSuite getCipherSuite() const;
+  Stats getStats() const;
 
+  std::uint64_t getRemoteNodeId() const;
+  PublicKey getRemoteIdentity() const;
+  // node id of the side that dialed, the lower one wins a simultaneous open
+  std::uint64_t getDialerNodeId() const;
 };
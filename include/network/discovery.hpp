@@ -1,9 +1,18 @@
 #pragma once
+#include "core/config.hpp"
 #include "network/peer.hpp"
+#include "network/peer_registry.hpp"
+#include "network/token_bucket.hpp"
 #include <vector>
 #include <memory>
+#include <atomic>
 #include <boost/asio.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <map>
 #include <mutex>
+#include <string>
 #include <thread>
 
 class Discovery{
@@ -12,22 +21,50 @@ class Discovery{
 
   boost::asio::ip::udp::socket socket_;
 
+  // who we are and where we look, from the node's config
+  std::string hostname_;
+  unsigned short chat_port_;
+  boost::asio::ip::udp::endpoint local_endpoint_;
+  bool broadcast_;
+  std::vector<boost::asio::ip::udp::endpoint> seeds_;
+
+  // packets per second from one source address, anything over it is
+  // dropped unread so the socket can't be used as a reflector. only the
+  // receive thread touches the buckets. they are kept most recently used
+  // first, a new source takes the place of the one heard from last
+  double source_rate_;
+  using SourceList = std::list<std::pair<boost::asio::ip::address, TokenBucket>>;
+  SourceList source_lru_;
+  std::map<boost::asio::ip::address, SourceList::iterator> source_buckets_;
+  std::atomic<std::uint64_t> received_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+
   std::thread broadcast_thread_;
   std::thread receive_thread_;
 
-  mutable std::mutex peers_mutex_;
-  std::vector<std::shared_ptr<Peer>> discovered_peers_;
+  // peers answering our pings are added or updated here
+  PeerRegistry& registry_;
 
-  bool running_ = false;
+  std::atomic<bool> running_{false};
+  // wakes the broadcast thread from its sleep on stop
+  std::mutex running_mutex_;
+  std::condition_variable running_cv_;
 
   void receiveLoop();
+  bool admit(const boost::asio::ip::address& source);
   void broadcastLoop();
 
   public:
-  Discovery();
+  // config.hostname has to be filled in already, the registry has to
+  // outlive discovery
+  Discovery(const Config& config, PeerRegistry& registry);
   ~Discovery();
   void start();
   void stop();
-  void addPeer(const std::shared_ptr<Peer>& new_peer);
-  std::vector<std::shared_ptr<Peer>> getPeers() const;
+
+  struct Stats {
+    std::uint64_t received; // packets, including dropped ones
+    std::uint64_t dropped;  // over their source's limit
+  };
+  Stats getStats() const;
 };
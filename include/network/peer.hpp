@@ -1,16 +1,36 @@
 #pragma once
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <boost/asio/ip/address.hpp>
 
+class PeerRegistry;
+
+// one node we know of. the address is what identifies it, the hostname
+// and last-seen time are updated in place by the registry while other
+// threads read them
 class Peer {
 private:
-  std::string hostname_;
+  std::uint64_t id_; // stable for the run, 0 outside a registry
+  std::shared_ptr<const std::string> hostname_;
   boost::asio::ip::address ip_addr_;
+  unsigned short port_; // where it accepts chats, 0 behind NAT
+  std::atomic<std::int64_t> last_seen_ms_{0}; // since the epoch
+
+  friend class PeerRegistry;
+  void setHostname(const std::string& hostname);
+  void touch(std::chrono::system_clock::time_point seen);
 
 public:
-  Peer(const std::string& hostname, const std::string& ip_str);
+  Peer(const std::string& hostname, const std::string& ip_str, unsigned short port);
+  Peer(std::uint64_t id, const std::string& hostname, const boost::asio::ip::address& ip_addr, unsigned short port);
 
   // Getters
-  const std::string& getHostname() const;
+  std::uint64_t getId() const;
+  std::string getHostname() const;
   boost::asio::ip::address getIpAddr() const;
+  unsigned short getPort() const;
+  std::chrono::system_clock::time_point getLastSeen() const;
 };
@@ -0,0 +1,45 @@
+#pragma once
+#include "crypto/crypto.hpp"
+#include "network/peer.hpp"
+#include <boost/asio/ip/address.hpp>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// the last known address of every peer, kept across runs so the peer list
+// is filled and recent peers are dialed before discovery answers. it holds
+// a bounded number of peers, the one seen longest ago makes room for a new
+// one
+class PeerCache {
+  public:
+  struct Entry {
+    std::string hostname;
+    boost::asio::ip::address address;
+    unsigned short port = 0;
+    bool has_identity = false;
+    PublicKey identity{};
+    std::chrono::system_clock::time_point last_seen;      // discovered or connected
+    std::chrono::system_clock::time_point last_connected; // epoch if never
+  };
+
+  private:
+  std::string path_;
+  size_t max_entries_;
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> entries_; // by hostname
+
+  // drops the entries seen longest ago until at most max are left
+  void trim(size_t max);
+  Entry& touch(const Peer& peer);
+
+  public:
+  // loads the table, a missing or damaged file leaves it empty
+  explicit PeerCache(const std::string& path, size_t max_entries = 1024);
+  void seen(const Peer& peer);
+  void connected(const Peer& peer, const PublicKey& identity);
+  std::vector<Entry> getEntries() const;
+  void save() const;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include "crypto/crypto.hpp"
+#include "network/peer.hpp"
+#include <boost/asio/ip/address.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// every peer the node knows of, shared by discovery and the app. a peer
+// keeps its Peer and id for the whole run, so connections and histories
+// keyed by it survive address book changes.
+//
+// readers take an immutable snapshot without locking and keep it for as
+// long as they like. writers copy the snapshot, change the copy and
+// publish it, so a reader never waits for them and never sees a list
+// that is half updated. a known peer answering again only has its
+// last-seen time and hostname updated in place, nothing is copied.
+//
+// it holds a bounded number of peers. once full, new peers are turned
+// away until expire drops ones that went quiet
+class PeerRegistry {
+  public:
+  struct AddressHash {
+    size_t operator()(const boost::asio::ip::address& address) const;
+  };
+  struct Endpoint {
+    boost::asio::ip::address address;
+    unsigned short port;
+    bool operator==(const Endpoint& other) const;
+  };
+  struct EndpointHash {
+    size_t operator()(const Endpoint& endpoint) const;
+  };
+  struct IdentityHash {
+    size_t operator()(const PublicKey& key) const;
+  };
+
+  struct Snapshot {
+    std::uint64_t version = 0;
+    // in the order they were first seen
+    std::vector<std::shared_ptr<Peer>> peers;
+    // peers reached directly, by where they accept chats
+    std::unordered_map<Endpoint, std::shared_ptr<Peer>, EndpointHash> by_endpoint;
+    // the first peer seen at an address, peers reached directly win
+    std::unordered_map<boost::asio::ip::address, std::shared_ptr<Peer>, AddressHash> by_address;
+    // peers reached directly win over ones behind NAT of the same name
+    std::unordered_map<std::string, std::shared_ptr<Peer>> by_hostname;
+    // peers behind NAT, port 0, one per hostname
+    std::unordered_map<std::string, std::shared_ptr<Peer>> remote;
+    // identity keys of peers we completed a handshake with
+    std::unordered_map<PublicKey, std::shared_ptr<Peer>, IdentityHash> by_identity;
+
+    // all of them return nullptr for an unknown peer
+    std::shared_ptr<Peer> findByEndpoint(const boost::asio::ip::address& address, unsigned short port) const;
+    std::shared_ptr<Peer> findByAddress(const boost::asio::ip::address& address) const;
+    std::shared_ptr<Peer> findByHostname(const std::string& hostname) const;
+    std::shared_ptr<Peer> findByIdentity(const PublicKey& key) const;
+  };
+
+  private:
+  // serializes writers, readers never take it
+  std::mutex write_mutex_;
+  std::shared_ptr<const Snapshot> snapshot_;
+  std::uint64_t next_id_ = 1;
+  size_t max_peers_;
+
+  static void index(Snapshot& snapshot, const std::shared_ptr<Peer>& peer);
+  void publish(std::shared_ptr<Snapshot> snapshot);
+
+  public:
+  explicit PeerRegistry(size_t max_peers = 1024);
+
+  // a peer that answered discovery at address:port, or one loaded from the
+  // cache with the time it was last seen. the Peer already at that
+  // endpoint is returned and renamed if its hostname changed. nullptr for
+  // a new peer when the registry is full
+  std::shared_ptr<Peer> upsert(const std::string& hostname, const boost::asio::ip::address& address, unsigned short port,
+                               std::chrono::system_clock::time_point seen = std::chrono::system_clock::now());
+  // a peer behind NAT, reached by name through the rendezvous server.
+  // nullptr for a new peer when the registry is full
+  std::shared_ptr<Peer> upsertRemote(const std::string& hostname, const boost::asio::ip::address& address);
+  // drops the peers last seen before cutoff, except the ones in keep.
+  // returns how many went
+  size_t expire(std::chrono::system_clock::time_point cutoff, const std::set<std::shared_ptr<Peer>>& keep);
+  // remembers who turned out to be behind a peer after a handshake
+  void bindIdentity(const std::shared_ptr<Peer>& peer, const PublicKey& key);
+
+  // lock free, the snapshot stays valid for as long as it is held
+  std::shared_ptr<const Snapshot> getSnapshot() const;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include "core/envelope.hpp"
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// bloom filter over recently seen envelope ids. two generations are kept
+// and the older one is dropped once the current one fills up, so memory
+// stays fixed and old ids age out instead of saturating the filter
+class RotatingBloomFilter {
+  private:
+  static constexpr size_t BITS = 1 << 16;
+  static constexpr int HASHES = 4;
+  std::bitset<BITS> current_;
+  std::bitset<BITS> previous_;
+  size_t inserted_ = 0;
+  size_t generation_capacity_;
+
+  public:
+  explicit RotatingBloomFilter(size_t generation_capacity = 4096);
+  bool contains(const std::string& id) const;
+  void insert(const std::string& id);
+};
+
+// envelopes this node holds for absent recipients, bounded by count and
+// bytes. when full the oldest envelope is dropped first
+class RelayStore {
+  private:
+  struct Held {
+    Envelope envelope;
+    // the expiry is signed, so a far off one can't be rewritten, only
+    // held for less
+    std::chrono::system_clock::time_point until;
+  };
+  mutable std::mutex mutex_;
+  std::deque<Held> envelopes_; // arrival order
+  size_t bytes_ = 0;
+  size_t max_envelopes_;
+  size_t max_bytes_;
+  std::chrono::system_clock::duration max_lifetime_;
+  RotatingBloomFilter seen_;
+
+  void dropExpired();
+
+  public:
+  // an envelope is held until it expires, and for max_lifetime at most
+  explicit RelayStore(size_t max_envelopes = 256, size_t max_bytes = 1 << 20,
+                      std::chrono::system_clock::duration max_lifetime = std::chrono::hours(24));
+  // records the id, returns false if it was seen before
+  bool markSeen(const std::string& id);
+  void store(const Envelope& envelope);
+  // removes and returns everything held for a recipient
+  std::vector<Envelope> takeFor(const std::string& recipient);
+  size_t size() const;
+};
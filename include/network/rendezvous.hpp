@@ -0,0 +1,61 @@
+#pragma once
+#include "network/stream.hpp"
+#include <atomic>
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// registers this node with a rendezvous server and sets up UDP paths to
+// peers behind NAT. both ends swap candidate addresses through the server
+// and punch towards each other at once; if no packet gets through, the
+// server relays instead
+class RendezvousClient {
+  private:
+  boost::asio::io_context& io_ctx_;
+  boost::asio::ip::udp::endpoint server_;
+  std::string name_;
+  boost::asio::ip::udp::socket control_;
+  std::thread control_thread_;
+  std::atomic<bool> running_{false};
+  std::function<void(const std::string&, std::unique_ptr<Stream>)> on_incoming_;
+
+  mutable std::mutex mutex_;
+  // names and public addresses of everyone registered, from the server
+  std::vector<std::pair<std::string, boost::asio::ip::address>> peers_;
+  std::vector<std::thread> invite_threads_;
+  // the server repeats invites until we answer, each is handled once
+  std::set<std::string> invited_sessions_;
+
+  void controlLoop();
+  void acceptInvite(const std::string& session, const std::string& from);
+  // asks the server until it answers with a PEER line for the session,
+  // returns the peer's candidates
+  std::vector<boost::asio::ip::udp::endpoint> exchangeCandidates(
+    boost::asio::ip::udp::socket& socket, const std::string& request,
+    const std::string& session);
+  std::unique_ptr<Stream> punch(
+    boost::asio::ip::udp::socket socket, const std::string& session,
+    const std::vector<boost::asio::ip::udp::endpoint>& candidates);
+
+  public:
+  // on_incoming is called from a worker thread with each stream a peer
+  // opened to us
+  RendezvousClient(
+    boost::asio::io_context& io_ctx,
+    const boost::asio::ip::udp::endpoint& server,
+    const std::string& name,
+    std::function<void(const std::string&, std::unique_ptr<Stream>)> on_incoming
+  );
+  ~RendezvousClient();
+  void start();
+  void stop();
+  std::vector<std::pair<std::string, boost::asio::ip::address>> getPeers() const;
+  // opens a stream to a registered peer, throws on failure
+  std::unique_ptr<Stream> connect(const std::string& name);
+};
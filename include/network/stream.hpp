@@ -0,0 +1,39 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// reliable ordered byte stream a Connection runs over. one thread may read
+// while another writes
+class Stream {
+  public:
+  virtual ~Stream() = default;
+  // blocks until some bytes arrive, throws once the stream has ended
+  virtual size_t readSome(std::uint8_t* data, size_t len) = 0;
+  // writes everything or throws
+  virtual void write(const std::uint8_t* data, size_t len) = 0;
+  // the peer reads to the end of what was written, then sees the end
+  virtual void shutdownSend() = 0;
+  // wakes blocked reads and writes, both fail from then on
+  virtual void shutdown() = 0;
+  virtual void close() = 0;
+  // how long written data may go unacknowledged before the stream fails.
+  // streams that check their peer themselves ignore it
+  virtual void setDeadTimeout(std::chrono::milliseconds) {}
+};
+
+class TcpStream : public Stream {
+  private:
+  boost::asio::ip::tcp::socket socket_;
+
+  public:
+  explicit TcpStream(boost::asio::ip::tcp::socket socket);
+  size_t readSome(std::uint8_t* data, size_t len) override;
+  void write(const std::uint8_t* data, size_t len) override;
+  void shutdownSend() override;
+  void shutdown() override;
+  void close() override;
+  // also turns on keepalive probes well within the timeout
+  void setDeadTimeout(std::chrono::milliseconds timeout) override;
+};
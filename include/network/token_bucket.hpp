@@ -0,0 +1,23 @@
+#pragma once
+#include <chrono>
+
+// refills at rate tokens per second up to burst. a take larger than the
+// burst goes through once the bucket is full and leaves it in debt, so
+// oversized frames are slowed down rather than stuck. a rate of 0 never
+// limits. not synchronized, each bucket belongs to one thread
+class TokenBucket {
+  private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  std::chrono::steady_clock::time_point last_refill_;
+
+  void refill(std::chrono::steady_clock::time_point now);
+
+  public:
+  TokenBucket(double rate = 0, double burst = 0);
+  // takes n tokens if they are there
+  bool take(double n, std::chrono::steady_clock::time_point now);
+  // how long until take(n) would succeed
+  std::chrono::steady_clock::duration waitFor(double n, std::chrono::steady_clock::time_point now);
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include "network/stream.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// reliable ordered stream over a UDP path, sent either straight to the peer
+// or through the rendezvous server's relay. segments are acknowledged
+// cumulatively, losses are repaired by fast retransmit and an RFC 6298 timer.
+// every segment carries the room left in the receive buffer, a reader that
+// falls behind stops the sender instead of growing the buffer
+class UdpStream : public Stream {
+  private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Segment {
+    std::vector<std::uint8_t> datagram; // header and payload, ready to send
+    Clock::time_point sent_at;
+    int transmissions = 0;
+  };
+
+  boost::asio::ip::udp::socket socket_;
+  boost::asio::ip::udp::endpoint remote_;
+  boost::asio::ip::udp::endpoint relay_;
+  std::string relay_prefix_;
+  bool relayed_;
+  std::thread io_thread_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable readable_cv_;
+  std::condition_variable writable_cv_;
+  bool shut_ = false;    // shutdown() was called
+  bool failed_ = false;  // the peer stopped acknowledging
+  bool stopping_ = false;
+
+  // send side, unacked segments by sequence number
+  std::uint32_t next_sequence_ = 0;
+  std::map<std::uint32_t, Segment> unacked_;
+  bool send_closed_ = false;
+  Clock::time_point last_sent_;
+  Clock::time_point timer_started_; // retransmission timer for the oldest
+  Clock::time_point last_retransmit_;
+  int duplicate_acks_ = 0;
+  bool recovering_ = false; // resending holes up to recovery_point_
+  std::uint32_t recovery_point_ = 0;
+  // segments past peer_ack_ the peer has room for, probed while it is 0
+  std::uint32_t peer_ack_ = 0;
+  std::uint32_t peer_window_;
+  Clock::time_point last_probe_;
+
+  // receive side
+  std::uint32_t expected_ = 0;
+  std::map<std::uint32_t, std::vector<std::uint8_t>> out_of_order_;
+  std::deque<std::uint8_t> received_;
+  bool fin_received_ = false;
+  std::uint32_t fin_sequence_ = 0;
+  bool peer_finished_ = false;
+  std::uint32_t advertised_window_;
+
+  // retransmission timer state, in milliseconds
+  bool has_rtt_ = false;
+  double srtt_ = 0;
+  double rttvar_ = 0;
+  double rto_ = 1000;
+  int backoff_ = 0; // doublings of rto_ since the last forward progress
+
+  void ioLoop();
+  void handleDatagram(const std::uint8_t* data, size_t len,
+                      const boost::asio::ip::udp::endpoint& sender);
+  void handleSegment(const std::uint8_t* data, size_t len);
+  // the rest are called with mutex_ held
+  // moves segments that are next into received_ while it has room
+  bool deliverInOrder();
+  std::uint32_t receiveWindow() const;
+  void writeHeader(std::uint8_t* header, std::uint8_t kind, std::uint32_t sequence);
+  void queueSegment(std::uint8_t kind, const std::uint8_t* data, size_t len);
+  void sendAck();
+  void sendProbe();
+  void transmit(const std::vector<std::uint8_t>& datagram);
+  void retransmitFirst();
+  void retransmitExpired();
+
+  public:
+  // relay_ and session are used once either side falls back to relaying
+  UdpStream(boost::asio::ip::udp::socket socket,
+            const boost::asio::ip::udp::endpoint& remote,
+            const boost::asio::ip::udp::endpoint& relay,
+            const std::string& session, bool relayed);
+  ~UdpStream() override;
+  UdpStream(const UdpStream&) = delete;
+  UdpStream& operator=(const UdpStream&) = delete;
+
+  size_t readSome(std::uint8_t* data, size_t len) override;
+  void write(const std::uint8_t* data, size_t len) override;
+  void shutdownSend() override;
+  void shutdown() override;
+  void close() override;
+  bool isRelayed() const;
+};
+
+// waits up to timeout for the socket to become readable
+bool waitReadable(boost::asio::ip::udp::socket& socket,
+                  std::chrono::milliseconds timeout);
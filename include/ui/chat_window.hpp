@@ -1,7 +1,14 @@
 #pragma once
 #include "core/app.hpp"
+#include "core/message.hpp"
+#include "core/view_model.hpp"
 #include <ftxui/component/component.hpp>
+#include <ftxui/dom/elements.hpp>
+#include <ftxui/screen/box.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 class ChatWindow{
   private:
@@ -11,6 +18,24 @@ class ChatWindow{
   ftxui::Component container_;
   ftxui::Component peer_list_;
 
+  // only the messages in view are turned into elements, each one is built
+  // once and reused until another conversation is selected
+  std::string cached_conversation_;
+  std::vector<ftxui::Element> line_cache_;
+  size_t last_history_size_ = 0;
+  std::uint64_t last_reorders_ = 0;
+  // ours, messages we sent are shown as from "You"
+  std::string hostname_;
+  // lines scrolled back from the newest message, 0 follows new messages
+  size_t scroll_offset_ = 0;
+  // where the message area was laid out last frame, sizes the viewport
+  ftxui::Box messages_box_;
+
+  int viewportHeight() const;
+  void scroll(int lines);
+  ftxui::Element renderMessage(const Message& msg) const;
+  ftxui::Element renderMessages(const MessageLog& history, const std::string& conversation);
+
   public:
   ChatWindow(App* app);
   ftxui::Component getInputComponent() { return input_component_; }
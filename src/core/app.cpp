@@ -2,79 +2,203 @@
 #include "core/message.hpp"
 #include "network/connection.hpp"
 #include "network/peer.hpp"
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <cstdlib>
+#include <filesystem>
 #include <memory>
 #include <mutex>
+#include <random>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
-constexpr unsigned short DEFAULT_PORT = 9000;
+// how many times an envelope may be passed on, and how long relays keep it
+constexpr int RELAY_HOPS = 2;
+constexpr std::chrono::hours RELAY_LIFETIME(24);
+// what this node holds for others at most
+constexpr size_t RELAY_ENVELOPES = 256;
+constexpr size_t RELAY_BYTES = 1 << 20;
+// cached peers connected to this recently are dialed at startup
+constexpr std::chrono::hours RECENT_PEER_WINDOW(24 * 7);
+constexpr size_t WARM_CONNECTIONS = 8;
+// peers not heard from for this long are forgotten, unless we are talking
+// to them or hold history with them
+constexpr std::chrono::hours PEER_EXPIRY(1);
+// a month, past anything a user means by a timeout
+constexpr double MAX_DEAD_PEER_TIMEOUT_MS = 30.0 * 24 * 3600 * 1000;
 
-App::App(boost::asio::io_context &io_ctx)
+static bool isMember(const std::vector<std::string> &members,
+					 const std::string &hostname) {
+	return std::find(members.begin(), members.end(), hostname) !=
+		   members.end();
+}
+
+static Config withDefaults(Config config) {
+	if (config.hostname.empty()) {
+		config.hostname = "unknown";
+		try {
+			config.hostname = boost::asio::ip::host_name();
+		} catch (const boost::system::system_error &) {
+			// fallback to "unknown"
+		}
+	}
+	// identity key and pinned peers live in ~/.p2p_chat
+	if (config.data_dir.empty()) {
+		const char *home = std::getenv("HOME");
+		config.data_dir = std::string(home ? home : ".") + "/.p2p_chat";
+	}
+	return config;
+}
 
-	: my_hostname_("unknown"), selected_index_(-1), io_context_(io_ctx),
+App::App(boost::asio::io_context &io_ctx, const Config &config)
+
+	: config_(withDefaults(config)), my_hostname_(config_.hostname),
+	  data_dir_(config_.data_dir), peer_cache_(data_dir_ + "/peers"),
+	  discovery_(config_, peer_registry_), io_context_(io_ctx),
+	  relay_store_(RELAY_ENVELOPES, RELAY_BYTES, RELAY_LIFETIME),
 	  acceptor_(io_context_), listening_(true) {
 
-	try {
-		my_hostname_ = boost::asio::ip::host_name();
-	} catch (const boost::system::system_error &) {
-		// fallback to "unknown"
-	}
+	// random per-run node id, used to break ties on simultaneous opens
+	std::random_device rd;
+	node_id_ = (static_cast<std::uint64_t>(rd()) << 32) | rd();
+
+	std::error_code ec;
+	std::filesystem::create_directories(data_dir_, ec);
+	security_ = std::make_shared<SecurityContext>(node_id_, data_dir_);
 
-	acceptor_.open(boost::asio::ip::tcp::v4());
+	boost::asio::ip::tcp::endpoint listen_endpoint(config_.bind_address,
+												   config_.port);
+	acceptor_.open(listen_endpoint.protocol());
 	acceptor_.set_option(boost::asio::socket_base::reuse_address(true));
-	acceptor_.bind(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(),
-												  DEFAULT_PORT));
+	acceptor_.bind(listen_endpoint);
 	acceptor_.listen();
 
 	listener_thread = std::thread(&App::listenerLoop, this);
+
+	// reaches peers behind NAT
+	if (!config_.rendezvous.empty()) {
+		const std::string &address = config_.rendezvous;
+		try {
+			size_t colon = address.rfind(':');
+			boost::asio::ip::udp::resolver resolver(io_context_);
+			auto server = *resolver
+							   .resolve(boost::asio::ip::udp::v4(),
+										address.substr(0, colon),
+										address.substr(colon + 1))
+							   .begin();
+			rendezvous_ = std::make_unique<RendezvousClient>(
+				io_context_, server.endpoint(), my_hostname_,
+				[this](const std::string &hostname,
+					   std::unique_ptr<Stream> stream) {
+					acceptStream(hostname, std::move(stream));
+				});
+			rendezvous_->start();
+		} catch (const std::exception &e) {
+			status_message_ = "Bad rendezvous address " + address;
+		}
+	}
 }
 
 App::~App() { stop(); }
 
 void App::stop() {
 	listening_ = false;
-	acceptor_.close();
+	// closing the acceptor doesn't wake a blocked accept, shutting it down
+	// does. it is closed once the listener is gone
+	if (acceptor_.is_open()) {
+		::shutdown(acceptor_.native_handle(), SHUT_RDWR);
+	}
 	if (listener_thread.joinable()) {
 		listener_thread.join();
 	}
+	boost::system::error_code ec;
+	acceptor_.close(ec);
+	// a silent peer would hold a connector or rendezvous invite thread in
+	// its handshake until the deadline. handshakes starting from here on
+	// abort themselves, listening_ is off
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		for (const auto &connection : handshaking_) {
+			connection->abortHandshake();
+		}
+	}
 	discovery_.stop();
-	const std::lock_guard<std::mutex> lock(connector_thread_mutex_);
-	for (auto &thread : connector_threads_) {
+	for (const auto &peer : peer_registry_.getSnapshot()->peers) {
+		if (peer->getPort() != 0) {
+			peer_cache_.seen(*peer);
+		}
+	}
+	peer_cache_.save();
+	if (rendezvous_) {
+		rendezvous_->stop();
+	}
+	// a finishing connector takes the lock too, so they are joined outside
+	// of it
+	std::vector<std::thread> connectors;
+	{
+		const std::lock_guard<std::mutex> lock(connector_thread_mutex_);
+		connectors.swap(connector_threads_);
+	}
+	for (auto &thread : connectors) {
 		if (thread.joinable()) {
 			thread.join();
 		}
 	}
-}
 
-const std::vector<std::shared_ptr<Peer>> &App::getPeers() const {
-	return peers_;
+	// connection threads call back into us, they have to be gone before
+	// the rest of the app is torn down
+	std::vector<std::shared_ptr<Connection>> connections;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		for (const auto &[peer, connection] : connections_) {
+			connections.push_back(connection);
+		}
+		connections_.clear();
+		connections.insert(connections.end(), closed_connections_.begin(),
+						   closed_connections_.end());
+		closed_connections_.clear();
+	}
+	for (const auto &connection : connections) {
+		connection->disconnect();
+	}
 }
 
-// checks that an index is within the bounds of the peers vector
-void App::selectPeer(int index) {
-	if (index < 0 || static_cast<size_t>(index) >= peers_.size()) {
-		selected_index_ = -1;
-		return;
-	}
+std::uint64_t App::getNodeId() const { return node_id_; }
 
-	selected_index_ = index;
+std::shared_ptr<const PeerRegistry::Snapshot> App::getPeers() const {
+	return peer_registry_.getSnapshot();
 }
 
-// returns a pointer to the selected peer object
-std::shared_ptr<Peer> App::getSelectedPeer() const {
-	if (selected_index_ == -1) {
-		return nullptr;
-	}
-	return peers_[selected_index_];
+void App::selectPeer(std::shared_ptr<Peer> peer) {
+	selected_peer_ = peer;
+	selected_group_.clear();
 }
 
-int App::getSelectedIndex() const { return selected_index_; }
+// returns a pointer to the selected peer object
+std::shared_ptr<Peer> App::getSelectedPeer() const { return selected_peer_; }
 
-void App::connectToPeer(std::shared_ptr<Peer> peer) {
+// runs work on a thread of its own, joined by reapConnections once it is
+// done
+void App::spawnConnector(std::function<void()> work) {
 	const std::lock_guard<std::mutex> lock(connector_thread_mutex_);
-	connector_threads_.emplace_back([this, peer] {
+	// stop takes the connector threads under this lock, none may start
+	// after it
+	if (!listening_) {
+		return;
+	}
+	connector_threads_.emplace_back([this, work = std::move(work)] {
+		work();
+		const std::lock_guard<std::mutex> lock(connector_thread_mutex_);
+		finished_connectors_.push_back(std::this_thread::get_id());
+	});
+}
+
+void App::connectToPeer(std::shared_ptr<Peer> peer, bool speculative) {
+	spawnConnector([this, peer, speculative] {
 		// check if we are connecting to a peer to prevent double connections
 		{
 			const std::lock_guard<std::mutex> lock(connecting_peers_mutex_);
@@ -83,6 +207,7 @@ void App::connectToPeer(std::shared_ptr<Peer> peer) {
 			}
 			connecting_peers_.insert(peer);
 		}
+		markViewDirty();
 
 		// check if the peer is valid
 		if (!peer) {
@@ -97,45 +222,37 @@ void App::connectToPeer(std::shared_ptr<Peer> peer) {
 			return;
 		}
 
-		auto on_message_callback = [this, peer](const Message &msg) {
-			this->onMessageReceived(peer, msg);
-		};
-
 		auto on_disconnect_callback = [this, peer] {
-			std::shared_ptr<Connection> old_connection;
-			{
-				const std::lock_guard<std::mutex> lock(app_mutex_);
-				auto it = connections_.find(peer);
-				if (it != connections_.end()) {
-					old_connection = it->second;
-					connections_.erase(it);
-				}
-				status_message_ =
-					"Connection to " + peer->getHostname() + " lost.";
-			}
+			this->onConnectionLost(peer);
 		};
 
-		auto new_connection = std::make_shared<Connection>(
-			peer, io_context_, on_message_callback, on_disconnect_callback);
-
-		{
-			const std::lock_guard<std::mutex> lock(app_mutex_);
-			connections_.insert({peer, new_connection});
-		}
-
 		try {
-			new_connection->connect();
-			status_message_ = "";
+			if (isRendezvousPeer(peer)) {
+				// outside the LAN, punch a UDP path through the NATs
+				auto new_connection = makeConnection(
+					peer, rendezvous_->connect(peer->getHostname()), true);
+				runHandshake(new_connection, false);
+				adoptConnection(peer, new_connection);
+			} else {
+				auto new_connection = std::make_shared<Connection>(
+					peer, security_, io_context_,
+					FrameRoute::to<Protocol>(*this), on_disconnect_callback,
+					config_.bind_address);
+				runHandshake(new_connection, true);
+				adoptConnection(peer, new_connection);
+			}
 		} catch (const std::exception &e) {
 			const std::lock_guard<std::mutex> lock(app_mutex_);
-			connections_.erase(peer);
-			status_message_ = "Failed to connect to " + peer->getHostname();
+			if (!speculative) {
+				status_message_ = "Failed to connect to " + peer->getHostname();
+			}
 		}
 
 		{
 			const std::lock_guard<std::mutex> lock(connecting_peers_mutex_);
 			connecting_peers_.erase(peer);
 		}
+		markViewDirty();
 	});
 }
 
@@ -150,6 +267,22 @@ bool App::isConnectedTo(std::shared_ptr<Peer> peer) const {
 	return connection_ptr->isConnected();
 }
 
+void App::disconnectFromPeer(std::shared_ptr<Peer> peer) {
+	std::shared_ptr<Connection> connection;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		auto it = connections_.find(peer);
+		if (it == connections_.end()) {
+			return;
+		}
+		connection = it->second;
+		connections_.erase(it);
+	}
+	// we are not on its receive thread, so it can be joined right here
+	connection->disconnect();
+	markViewDirty();
+}
+
 bool App::isConnectingTo(std::shared_ptr<Peer> peer) const {
 	const std::lock_guard<std::mutex> lock(connecting_peers_mutex_);
 	return connecting_peers_.count(peer);
@@ -165,20 +298,390 @@ App::getConnection(std::shared_ptr<Peer> peer) const {
 	return connection->second;
 }
 
+// installs a freshly handshaked connection as the canonical one for its
+// peer. when both sides dialed at once, the connection dialed by the lower
+// node id wins on both ends, and the loser is retired so it drains cleanly
+bool App::adoptConnection(std::shared_ptr<Peer> peer,
+						  std::shared_ptr<Connection> connection) {
+	std::shared_ptr<Connection> loser;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		auto it = connections_.find(peer);
+		if (it == connections_.end()) {
+			connections_.insert({peer, connection});
+		} else {
+			auto &existing = it->second;
+			// a different remote node id means the peer restarted and the
+			// existing connection is stale. a second connection from the
+			// same dialer replaces the first only once that went quiet, the
+			// dialer gave up on it even if our end hasn't noticed yet. a
+			// live one is never displaced by a redial. dialed both ways at
+			// once, the lower dialer wins on both ends
+			bool same_dialer =
+				connection->getDialerNodeId() == existing->getDialerNodeId();
+			bool replace =
+				!existing->isConnected() ||
+				existing->getRemoteNodeId() != connection->getRemoteNodeId() ||
+				(same_dialer ? existing->hasGoneQuiet()
+							 : connection->getDialerNodeId() <
+								   existing->getDialerNodeId());
+			if (replace) {
+				loser = existing;
+				existing = connection;
+			} else {
+				loser = connection;
+			}
+		}
+		if (loser != connection) {
+			status_message_ = "";
+		}
+	}
+
+	if (loser) {
+		loser->retire();
+	}
+	connection->setInboundLimits(config_.peer_frame_rate,
+								 config_.peer_byte_rate);
+	connection->setDeadTimeout(std::chrono::milliseconds(static_cast<long long>(
+		std::min(config_.dead_peer_timeout * 1000, MAX_DEAD_PEER_TIMEOUT_MS))));
+	connection->start();
+
+	if (loser) {
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		closed_connections_.push_back(loser);
+	}
+	if (loser != connection) {
+		peer_registry_.bindIdentity(peer, connection->getRemoteIdentity());
+		if (peer->getPort() != 0) {
+			peer_cache_.connected(*peer, connection->getRemoteIdentity());
+		}
+		flushEnvelopes(peer, connection);
+		// one side is enough, the dialer of the surviving connection
+		if (connection->getDialerNodeId() == node_id_) {
+			beginHistorySync(peer, connection);
+		}
+	}
+	markViewDirty();
+	return loser != connection;
+}
+
+// hands over everything we hold for a peer that just came online
+void App::flushEnvelopes(std::shared_ptr<Peer> peer,
+						 std::shared_ptr<Connection> connection) {
+	for (auto &envelope : relay_store_.takeFor(peer->getHostname())) {
+		auto payload = std::make_shared<const std::string>(envelope.serialize());
+		if (!connection->sendFrame(payload)) {
+			relay_store_.store(envelope);
+		}
+	}
+}
+
+void App::onConnectionLost(std::shared_ptr<Peer> peer) {
+	bool timed_out = false;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		auto it = connections_.find(peer);
+		// only drop the entry if it is the connection that died, a newer
+		// canonical connection may already have replaced it
+		if (it == connections_.end() || it->second->isConnected()) {
+			return;
+		}
+		timed_out = it->second->hasTimedOut();
+		// the receive thread calling us can't join itself, so the reaper
+		// destroys the connection later
+		closed_connections_.push_back(it->second);
+		connections_.erase(it);
+		status_message_ = "Connection to " + peer->getHostname() +
+						  (timed_out ? " timed out, reconnecting." : " lost.");
+	}
+	markViewDirty();
+	// a peer that closed meant to, one that went silent may be back on
+	// another path, or once its network returns
+	if (timed_out) {
+		connectToPeer(peer, true);
+	}
+}
+
+void App::reapConnections() {
+	std::vector<std::shared_ptr<Connection>> finished;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		auto it = closed_connections_.begin();
+		while (it != closed_connections_.end()) {
+			if ((*it)->isFinished()) {
+				finished.push_back(*it);
+				it = closed_connections_.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	// destroyed here, outside the lock
+
+	std::vector<std::thread> done;
+	{
+		const std::lock_guard<std::mutex> lock(connector_thread_mutex_);
+		for (auto id : finished_connectors_) {
+			auto it = std::find_if(
+				connector_threads_.begin(), connector_threads_.end(),
+				[id](const std::thread &thread) { return thread.get_id() == id; });
+			if (it != connector_threads_.end()) {
+				done.push_back(std::move(*it));
+				connector_threads_.erase(it);
+			}
+		}
+		finished_connectors_.clear();
+	}
+	for (auto &thread : done) {
+		thread.join();
+	}
+}
+
+void App::onFrame(const std::shared_ptr<Peer> &from, const Message &msg) {
+	// a peer speaks for itself on its own connection, what others said
+	// reaches us through a history sync or a relay
+	if (msg.sender != from->getHostname()) {
+		return;
+	}
+	onMessageReceived(from, msg);
+}
+
+void App::onFrame(const std::shared_ptr<Peer> &from,
+				  const Envelope &envelope) {
+	onEnvelopeReceived(from, envelope);
+}
+
+void App::onFrame(const std::shared_ptr<Peer> &from, const SyncFrame &frame) {
+	onSyncReceived(from, frame);
+}
+
 void App::onMessageReceived(std::shared_ptr<Peer> from, const Message &msg) {
 	{
 		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
-		message_history_[from].push_back(msg);
-		incoming_messages_.push({from, msg});
+		if (msg.isGroupMessage()) {
+			auto group = groups_.find(msg.group_id);
+			if (group == groups_.end()) {
+				// first message of a group we were added to creates it, a
+				// peer can't put us in a group it isn't in itself
+				if (!isMember(msg.group_members, my_hostname_) ||
+					!isMember(msg.group_members, from->getHostname())) {
+					return;
+				}
+				groups_.insert({msg.group_id, msg.group_members});
+			} else if (!isMember(group->second, from->getHostname())) {
+				return;
+			}
+		}
+		// the same message can come in through a relay and a sync
+		if (!recordMessage(from, msg)) {
+			return;
+		}
+	}
+	// our own messages only come back through a sync
+	if (message_listener_ && msg.sender != my_hostname_) {
+		message_listener_(from, msg);
+	}
+	markViewDirty();
+}
+
+bool App::recordMessage(std::shared_ptr<Peer> peer, const Message &msg) {
+	if (msg.isGroupMessage()) {
+		if (!group_index_[msg.group_id].insert(msg)) {
+			return false;
+		}
+		group_history_[msg.group_id].insert(msg);
+	} else {
+		if (!history_index_[peer].insert(msg)) {
+			return false;
+		}
+		message_history_[peer].insert(msg);
+	}
+	return true;
+}
+
+std::vector<Message> App::recordMessages(std::shared_ptr<Peer> peer,
+										 const std::string &conversation,
+										 std::vector<Message> msgs) {
+	std::stable_sort(msgs.begin(), msgs.end(),
+					 [](const Message &a, const Message &b) {
+						 return a.timestamp < b.timestamp;
+					 });
+	HistoryIndex &index = conversation.empty() ? history_index_[peer]
+											   : group_index_[conversation];
+	MessageLog &history = conversation.empty() ? message_history_[peer]
+											   : group_history_[conversation];
+	auto added = index.insertAll(msgs);
+	std::vector<Message> fresh;
+	for (size_t i = 0; i < msgs.size(); ++i) {
+		if (added[i]) {
+			fresh.push_back(std::move(msgs[i]));
+		}
+	}
+	history.insertAll(fresh);
+	return fresh;
+}
+
+static const Message *findMessage(const MessageLog &history,
+								  const SyncEntry &entry) {
+	auto time = std::chrono::system_clock::time_point(
+		std::chrono::milliseconds(entry.time));
+	for (size_t i = history.lowerBound(time);
+		 i < history.size() && messageTime(history[i]) == entry.time; ++i) {
+		if (messageId(history[i]) == entry.id) {
+			return &history[i];
+		}
+	}
+	return nullptr;
+}
+
+void App::beginHistorySync(std::shared_ptr<Peer> peer,
+						   std::shared_ptr<Connection> connection) {
+	static const HistoryIndex empty_index;
+	std::vector<std::string> frames;
+	{
+		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+		auto index = history_index_.find(peer);
+		frames.push_back(beginSync(
+			"", index == history_index_.end() ? empty_index : index->second));
+		for (const auto &[group_id, members] : groups_) {
+			if (!isMember(members, peer->getHostname())) {
+				continue;
+			}
+			auto group_index = group_index_.find(group_id);
+			frames.push_back(beginSync(group_id,
+									   group_index == group_index_.end()
+										   ? empty_index
+										   : group_index->second));
+		}
+	}
+	for (auto &frame : frames) {
+		connection->sendFrame(
+			std::make_shared<const std::string>(std::move(frame)));
+	}
+}
+
+// answers one step of a history sync. the conversation is the direct chat
+// with the peer, or a group both of us are in
+void App::onSyncReceived(std::shared_ptr<Peer> from, const SyncFrame &frame) {
+	std::vector<Message> msgs;
+	try {
+		if (frame.kind == 'M') {
+			msgs = parseMessageSync(frame);
+		}
+	} catch (const std::exception &e) {
+		return;
+	}
+
+	static const HistoryIndex empty_index;
+	static const MessageLog empty_history;
+	SyncReply reply;
+	std::vector<Message> missing;
+	{
+		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+		const HistoryIndex *index = &empty_index;
+		const MessageLog *history = &empty_history;
+		std::vector<std::string> members = {my_hostname_, from->getHostname()};
+		if (frame.conversation.empty()) {
+			auto found_index = history_index_.find(from);
+			auto found_history = message_history_.find(from);
+			if (found_index != history_index_.end() &&
+				found_history != message_history_.end()) {
+				index = &found_index->second;
+				history = &found_history->second;
+			}
+		} else {
+			auto group = groups_.find(frame.conversation);
+			if (group == groups_.end() ||
+				!isMember(group->second, from->getHostname())) {
+				return;
+			}
+			members = group->second;
+			auto found_index = group_index_.find(frame.conversation);
+			auto found_history = group_history_.find(frame.conversation);
+			if (found_index != group_index_.end() &&
+				found_history != group_history_.end()) {
+				index = &found_index->second;
+				history = &found_history->second;
+			}
+		}
+
+		if (frame.kind == 'M') {
+			// only messages of this conversation, sent by one of its members.
+			// what we said ourselves is shown as ours, so a peer may only
+			// hand back those we already hold
+			for (const auto &msg : msgs) {
+				bool belongs = msg.group_id == frame.conversation &&
+							   isMember(members, msg.sender);
+				bool forged_own =
+					msg.sender == my_hostname_ &&
+					!index->contains({messageTime(msg), messageId(msg)});
+				if (!belongs || forged_own) {
+					return;
+				}
+			}
+			// the frame is applied at once, so a late batch costs one
+			// rebuild of the history rather than one per message
+			msgs = recordMessages(from, frame.conversation, std::move(msgs));
+		} else {
+			try {
+				reply = answerSync(frame, *index);
+			} catch (const std::exception &e) {
+				return;
+			}
+			for (const auto &entry : reply.missing) {
+				if (const Message *held = findMessage(*history, entry)) {
+					missing.push_back(*held);
+				}
+			}
+		}
 	}
+
+	if (frame.kind == 'M') {
+		// our own messages only come back through a sync
+		for (const auto &msg : msgs) {
+			if (message_listener_ && msg.sender != my_hostname_) {
+				message_listener_(from, msg);
+			}
+		}
+		if (!msgs.empty()) {
+			markViewDirty();
+		}
+		return;
+	}
+	auto connection = getConnection(from);
+	if (!connection) {
+		return;
+	}
+	for (auto &reply_frame : reply.frames) {
+		connection->sendFrame(
+			std::make_shared<const std::string>(std::move(reply_frame)));
+	}
+	// the messages themselves don't hold up live chat
+	for (auto &batch : messageSyncFrames(frame.conversation, missing)) {
+		connection->sendBulkFrame(
+			std::make_shared<const std::string>(std::move(batch)));
+	}
+}
+
+void App::setMessageListener(
+	std::function<void(std::shared_ptr<Peer>, const Message &)> listener) {
+	message_listener_ = std::move(listener);
 }
 
 void App::sendMessageToSelected(const std::string &text) {
+	if (!selected_group_.empty()) {
+		sendGroupMessage(selected_group_, text);
+		return;
+	}
+
 	auto peer = getSelectedPeer();
 	if (!peer) {
 		return;
 	}
+	sendMessage(peer, text);
+}
 
+void App::sendMessage(std::shared_ptr<Peer> peer, const std::string &text) {
 	std::shared_ptr<Connection> connection;
 	{
 		const std::lock_guard<std::mutex> lock(app_mutex_);
@@ -188,44 +691,400 @@ void App::sendMessageToSelected(const std::string &text) {
 		}
 	}
 
-	if (connection == nullptr || !connection->isConnected()) {
-		connectToPeer(peer); // auto-connect on send
-		return;
-	}
-
 	// Create the message with our hostname to send over the network
 	auto message_to_send = Message(my_hostname_, text);
-	if (!connection->sendMessage(message_to_send)) {
+
+	// encoding throws on a field it can't carry
+	bool sent = false;
+	try {
+		if (connection == nullptr || !connection->isConnected()) {
+			connectToPeer(peer); // auto-connect on send
+			// peers we have talked to before can still be reached through
+			// whoever is online
+			if (relayMessage(peer, message_to_send)) {
+				{
+					const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+					recordMessage(peer, message_to_send);
+				}
+				const std::lock_guard<std::mutex> lock(app_mutex_);
+				status_message_ = peer->getHostname() +
+								  " is offline, message queued for relay.";
+			} else {
+				// no envelope key, we never completed a handshake with them
+				const std::lock_guard<std::mutex> lock(app_mutex_);
+				status_message_ = peer->getHostname() +
+								  " is offline, message could not be queued.";
+			}
+			markViewDirty();
+			return;
+		}
+
+		sent = connection->sendMessage(message_to_send);
+		if (!sent && connection->isRetired()) {
+			// lost a simultaneous open while sending, use the winner instead
+			connection = getConnection(peer);
+			sent = connection && connection->sendMessage(message_to_send);
+		}
+	} catch (const std::invalid_argument &e) {
+		setStatusMessage(std::string("Message not sent: ") + e.what());
+		return;
+	}
+	if (!sent) {
 		const std::lock_guard<std::mutex> lock(app_mutex_);
 		status_message_ = "Failed to send message.";
 	} else {
+		markMessageSent();
 		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
-		auto message_for_history = Message("You", text);
-		message_history_[peer].push_back(message_for_history);
-		incoming_messages_.push({peer, message_for_history});
+		recordMessage(peer, message_to_send);
 	}
+	markViewDirty();
 }
 
-std::vector<std::pair<std::shared_ptr<Peer>, Message>>
-App::pollIncomingMessages() {
+bool App::relayMessage(std::shared_ptr<Peer> peer, const Message &msg) {
+	PublicKey recipient_key;
+	if (!security_->trust_store.getEnvelopeKey(peer->getHostname(),
+											   recipient_key)) {
+		return false;
+	}
+
+	Envelope envelope;
+	std::random_device rd;
+	std::uint8_t id[16];
+	for (auto &byte : id) {
+		byte = static_cast<std::uint8_t>(rd());
+	}
+	envelope.id = toHex(id, sizeof(id));
+	envelope.recipient = peer->getHostname();
+	envelope.origin = my_hostname_;
+	envelope.expires = std::chrono::system_clock::now() + RELAY_LIFETIME;
+	envelope.hops = RELAY_HOPS;
+	envelope.sealed = sealToKey(recipient_key, msg.serialize());
+	std::string signed_data = envelope.signedData();
+	Signature signature = security_->identity.sign(
+		reinterpret_cast<const std::uint8_t *>(signed_data.data()),
+		signed_data.size());
+	envelope.signature.assign(signature.begin(), signature.end());
+
+	// kept here too, so it is delivered directly if the peer shows up
+	relay_store_.markSeen(envelope.id);
+	relay_store_.store(envelope);
+
+	auto payload = std::make_shared<const std::string>(envelope.serialize());
+	std::vector<std::shared_ptr<Connection>> targets;
 	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		for (const auto &[connected_peer, connection] : connections_) {
+			targets.push_back(connection);
+		}
+	}
+	for (const auto &connection : targets) {
+		connection->sendFrame(payload);
+	}
+	return true;
+}
+
+// floods envelopes for others at most RELAY_HOPS times, each node keeps a
+// copy until the recipient connects or it expires
+void App::onEnvelopeReceived(std::shared_ptr<Peer> from,
+							 const Envelope &envelope) {
+	if (envelope.isExpired() || !relay_store_.markSeen(envelope.id)) {
+		return;
+	}
+	if (envelope.recipient == my_hostname_) {
+		deliverEnvelope(envelope);
+		return;
+	}
+
+	std::shared_ptr<Connection> recipient_connection;
+	std::vector<std::shared_ptr<Connection>> others;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		for (const auto &[peer, connection] : connections_) {
+			if (peer->getHostname() == envelope.recipient) {
+				recipient_connection = connection;
+			} else if (peer != from) {
+				others.push_back(connection);
+			}
+		}
+	}
+
+	if (recipient_connection &&
+		recipient_connection->sendFrame(
+			std::make_shared<const std::string>(envelope.serialize()))) {
+		return;
+	}
+	// a peer picks the hops it sends, no more than we would. the store
+	// caps how long it is held, the expiry is covered by the signature
+	Envelope forwarded = envelope;
+	forwarded.hops = std::min(envelope.hops, RELAY_HOPS);
+	relay_store_.store(forwarded);
+	if (forwarded.hops <= 0) {
+		return;
+	}
+	--forwarded.hops;
+	auto payload = std::make_shared<const std::string>(forwarded.serialize());
+	for (const auto &connection : others) {
+		connection->sendFrame(payload);
+	}
+}
+
+void App::deliverEnvelope(const Envelope &envelope) {
+	// only senders we have pinned can be checked, anything else is dropped
+	PublicKey origin_identity;
+	Signature signature;
+	if (!security_->trust_store.getPin(envelope.origin, origin_identity) ||
+		envelope.signature.size() != signature.size()) {
+		return;
+	}
+	std::copy(envelope.signature.begin(), envelope.signature.end(),
+			  signature.begin());
+	std::string signed_data = envelope.signedData();
+	if (!security_->signatures.verify(
+			origin_identity,
+			reinterpret_cast<const std::uint8_t *>(signed_data.data()),
+			signed_data.size(), signature)) {
+		return;
+	}
+
+	std::string plaintext;
+	if (!openSealed(security_->envelope_key, envelope.sealed, plaintext)) {
+		return;
+	}
+	Message msg;
+	try {
+		msg = Message::deserialize(plaintext);
+	} catch (const std::exception &e) {
+		return;
+	}
+	// the sealed sender has to match the signed one
+	if (msg.isGroupMessage() || msg.sender != envelope.origin) {
+		return;
+	}
+
+	auto peers = peer_registry_.getSnapshot();
+	auto from = peers->findByIdentity(origin_identity);
+	if (!from) {
+		from = peers->findByHostname(envelope.origin);
+	}
+	if (from) {
+		onMessageReceived(from, msg);
+	} else {
 		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
-		std::vector<std::pair<std::shared_ptr<Peer>, Message>> messages;
-		while (!incoming_messages_.empty()) {
-			messages.push_back(incoming_messages_.front());
-			incoming_messages_.pop();
+		orphaned_messages_.push_back(msg);
+	}
+}
+
+std::string App::createGroup(const std::vector<std::string> &hostnames) {
+	std::vector<std::string> members = {my_hostname_};
+	for (const auto &hostname : hostnames) {
+		if (!isWireName(hostname)) {
+			throw std::invalid_argument("bad member name " + hostname);
+		}
+		if (!isMember(members, hostname)) {
+			members.push_back(hostname);
 		}
-		return messages;
 	}
+
+	std::random_device rd;
+	std::string group_id = std::to_string(node_id_) + "-" + std::to_string(rd());
+	{
+		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+		groups_[group_id] = members;
+	}
+	markViewDirty();
+	selectGroup(group_id);
+	return group_id;
+}
+
+void App::selectGroup(const std::string &group_id) {
+	selected_group_ = group_id;
+	selected_peer_ = nullptr;
 }
 
-const std::vector<Message> &App::getMessageHistory(std::shared_ptr<Peer> peer) {
-	auto history = message_history_.find(peer);
-	if (history == message_history_.end()) {
-		static const std::vector<Message> empty_history;
-		return empty_history;
+std::string App::getSelectedGroup() const { return selected_group_; }
+
+std::vector<std::string> App::getGroupIds() const {
+	const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+	std::vector<std::string> group_ids;
+	for (const auto &group : groups_) {
+		group_ids.push_back(group.first);
+	}
+	return group_ids;
+}
+
+std::vector<std::string>
+App::getGroupMembers(const std::string &group_id) const {
+	const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+	auto group = groups_.find(group_id);
+	if (group == groups_.end()) {
+		return {};
+	}
+	return group->second;
+}
+
+void App::sendGroupMessage(const std::string &group_id,
+						   const std::string &text) {
+	auto members = getGroupMembers(group_id);
+	if (members.empty()) {
+		return;
+	}
+
+	Message message(my_hostname_, text);
+	message.group_id = group_id;
+	message.group_members = members;
+
+	// encoded once, every member's connection queues this same buffer
+	std::shared_ptr<const std::string> payload;
+	try {
+		payload = std::make_shared<const std::string>(message.serialize());
+	} catch (const std::invalid_argument &e) {
+		setStatusMessage(std::string("Message not sent: ") + e.what());
+		return;
+	}
+
+	// match members to live connections in one pass under the lock
+	std::set<std::string> pending(members.begin(), members.end());
+	pending.erase(my_hostname_);
+	std::vector<std::shared_ptr<Connection>> targets;
+	std::vector<std::shared_ptr<Peer>> offline_peers;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		for (const auto &[peer, connection] : connections_) {
+			if (pending.erase(peer->getHostname())) {
+				targets.push_back(connection);
+			}
+		}
 	}
-	return history->second;
+	auto peers = peer_registry_.getSnapshot();
+	for (const auto &hostname : pending) {
+		if (auto peer = peers->findByHostname(hostname)) {
+			offline_peers.push_back(peer);
+		}
+	}
+
+	size_t failed = pending.size();
+	for (const auto &connection : targets) {
+		if (!connection->sendFrame(payload)) {
+			++failed;
+		} else {
+			markMessageSent();
+		}
+	}
+	// like direct messages, reaching an offline member starts a connect
+	for (const auto &peer : offline_peers) {
+		connectToPeer(peer);
+	}
+
+	{
+		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+		recordMessage(nullptr, message);
+	}
+	if (failed > 0) {
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		status_message_ = std::to_string(failed) + " group member(s) offline.";
+	}
+	markViewDirty();
+}
+
+void App::exportHistory(const std::string &path) {
+	// a long history takes a while to compress, the UI carries on and
+	// hears of it through the status line
+	setStatusMessage("Exporting history to " + path + "...");
+	spawnConnector([this, path] {
+		// the logs share their chunks, copying them under the lock is cheap
+		std::vector<std::pair<ArchivedConversation, MessageLog>> logs;
+		{
+			const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+			for (const auto &[peer, history] : message_history_) {
+				logs.push_back({{peer->getHostname(), false, {}}, history});
+			}
+			for (const auto &[group_id, history] : group_history_) {
+				logs.push_back({{group_id, true, {}}, history});
+			}
+		}
+		std::vector<ArchivedConversation> conversations;
+		size_t count = 0;
+		for (auto &[conversation, history] : logs) {
+			conversation.messages.reserve(history.size());
+			for (size_t i = 0; i < history.size(); ++i) {
+				conversation.messages.push_back(history[i]);
+			}
+			count += history.size();
+			conversations.push_back(std::move(conversation));
+		}
+
+		std::string status;
+		try {
+			writeHistoryArchive(path, conversations);
+			status = "Exported " + std::to_string(count) + " message(s) to " +
+					 path;
+		} catch (const std::exception &e) {
+			status = std::string("Export failed: ") + e.what();
+		}
+		setStatusMessage(status);
+	});
+}
+
+void App::importHistory(const std::string &path) {
+	setStatusMessage("Importing history from " + path + "...");
+	spawnConnector([this, path] {
+		std::vector<ArchivedConversation> conversations;
+		try {
+			conversations = readHistoryArchive(path);
+		} catch (const std::exception &e) {
+			setStatusMessage(std::string("Import failed: ") + e.what());
+			return;
+		}
+
+		auto peers = peer_registry_.getSnapshot();
+		size_t added = 0;
+		size_t unknown = 0;
+		{
+			const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+			for (auto &conversation : conversations) {
+				std::shared_ptr<Peer> peer;
+				if (!conversation.group) {
+					peer = peers->findByHostname(conversation.name);
+					if (!peer) {
+						unknown += conversation.messages.size();
+						continue;
+					}
+				} else if (!conversation.messages.empty()) {
+					groups_.emplace(
+						conversation.name,
+						conversation.messages.back().group_members);
+				}
+				auto &index = conversation.group
+								  ? group_index_[conversation.name]
+								  : history_index_[peer];
+				auto is_new = index.insertAll(conversation.messages);
+				std::vector<Message> fresh;
+				for (size_t i = 0; i < conversation.messages.size(); ++i) {
+					if (is_new[i]) {
+						fresh.push_back(std::move(conversation.messages[i]));
+					}
+				}
+				std::stable_sort(fresh.begin(), fresh.end(),
+								 [](const Message &a, const Message &b) {
+									 return a.timestamp < b.timestamp;
+								 });
+				auto &history = conversation.group
+									? group_history_[conversation.name]
+									: message_history_[peer];
+				history.insertAll(fresh);
+				added += fresh.size();
+			}
+		}
+
+		std::string status =
+			"Imported " + std::to_string(added) + " message(s)";
+		if (unknown > 0) {
+			// direct chats are kept per peer, one we never met has no place
+			status += ", " + std::to_string(unknown) +
+					  " with unknown peers left out";
+		}
+		setStatusMessage(status);
+	});
 }
 
 void App::listenerLoop() {
@@ -233,70 +1092,304 @@ void App::listenerLoop() {
 		try {
 			boost::asio::ip::tcp::socket socket(io_context_);
 			acceptor_.accept(socket);
+			spawnAccept(std::move(socket));
+		} catch (const boost::system::system_error &e) {
+			// Errors are expected here if the acceptor is closed.
+		}
+	}
+}
 
-			auto remote_ip = socket.remote_endpoint().address();
-			std::shared_ptr<Peer> connected_peer = nullptr;
+// the handshake runs off the accepting thread so a slow peer can't stall
+// other incoming connections
+void App::spawnAccept(boost::asio::ip::tcp::socket socket) {
+	spawnConnector([this, s = std::make_shared<boost::asio::ip::tcp::socket>(
+							  std::move(socket))] {
+		acceptConnection(std::move(*s));
+	});
+}
 
-			for (const auto &peer : peers_) {
-				if (peer->getIpAddr() == remote_ip) {
-					connected_peer = peer;
-					break;
-				}
-			}
+void App::acceptConnection(boost::asio::ip::tcp::socket socket) {
+	try {
+		auto remote_ip = socket.remote_endpoint().address();
+		auto connected_peer =
+			peer_registry_.getSnapshot()->findByAddress(remote_ip);
 
-			if (connected_peer) {
-				auto on_disconnect_callback = [this, connected_peer] {
-					std::shared_ptr<Connection> old_connection;
-					{
-						const std::lock_guard<std::mutex> lock(app_mutex_);
-						auto it = connections_.find(connected_peer);
-						if (it != connections_.end()) {
-							old_connection = it->second;
-							connections_.erase(it);
-						}
-						if (connected_peer) {
-							status_message_ = "Connection to " +
-											  connected_peer->getHostname() +
-											  " lost.";
-						}
-					}
-				};
+		if (!connected_peer) {
+			socket.close();
+			return;
+		}
 
-				auto on_message_callback =
-					[this, connected_peer](const Message &msg) {
-						this->onMessageReceived(connected_peer, msg);
-					};
+		auto new_connection = makeConnection(
+			connected_peer, std::make_unique<TcpStream>(std::move(socket)),
+			false);
+		runHandshake(new_connection, false);
+		adoptConnection(connected_peer, new_connection);
+	} catch (const std::exception &e) {
+		// the peer went away or spoke garbage during the handshake
+	}
+}
 
-				auto new_connection = std::make_shared<Connection>(
-					connected_peer, on_message_callback, on_disconnect_callback,
-					std::move(socket));
-				{
-					std::shared_ptr<Connection> old_connection;
-					const std::lock_guard<std::mutex> lock(app_mutex_);
-					auto it = connections_.find(connected_peer);
-					if (it != connections_.end()) {
-						old_connection = it->second;
-						it->second = new_connection;
-					} else {
-						connections_.insert({connected_peer, new_connection});
-						status_message_ = "";
-					}
-				}
+bool App::isRendezvousPeer(std::shared_ptr<Peer> peer) const {
+	return rendezvous_ && peer->getPort() == 0;
+}
+
+std::shared_ptr<Connection>
+App::makeConnection(std::shared_ptr<Peer> peer, std::unique_ptr<Stream> stream,
+					bool initiated) {
+	return std::make_shared<Connection>(
+		peer, security_, FrameRoute::to<Protocol>(*this),
+		[this, peer] { onConnectionLost(peer); }, std::move(stream),
+		initiated);
+}
+
+void App::runHandshake(std::shared_ptr<Connection> connection, bool dial) {
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		handshaking_.insert(connection);
+		if (!listening_) {
+			connection->abortHandshake();
+		}
+	}
+	try {
+		if (dial) {
+			connection->connect();
+		} else {
+			connection->handshake();
+		}
+	} catch (...) {
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		handshaking_.erase(connection);
+		throw;
+	}
+	const std::lock_guard<std::mutex> lock(app_mutex_);
+	handshaking_.erase(connection);
+}
+
+// a peer reached us through the rendezvous server
+void App::acceptStream(const std::string &hostname,
+					   std::unique_ptr<Stream> stream) {
+	auto peer = peer_registry_.getSnapshot()->findByHostname(hostname);
+	if (!peer) {
+		// not listed yet, the address only matters for TCP
+		peer = peer_registry_.upsertRemote(
+			hostname, boost::asio::ip::address_v4::any());
+		if (!peer) {
+			return;
+		}
+	}
+
+	try {
+		auto new_connection = makeConnection(peer, std::move(stream), false);
+		runHandshake(new_connection, false);
+		adoptConnection(peer, new_connection);
+	} catch (const std::exception &e) {
+		// the peer went away or spoke garbage during the handshake
+	}
+}
+
+void App::performInitialDiscovery() {
+	auto now = std::chrono::system_clock::now();
+	std::vector<std::pair<PeerCache::Entry, std::shared_ptr<Peer>>> recent;
+	for (const auto &entry : peer_cache_.getEntries()) {
+		// a peer that reinstalled would be refused at the handshake anyway
+		PublicKey pinned;
+		if (entry.has_identity &&
+			security_->trust_store.getPin(entry.hostname, pinned) &&
+			pinned != entry.identity) {
+			continue;
+		}
+		// discovery keeps this Peer when the peer answers from the same
+		// address, so connections and history stay with it
+		auto peer = peer_registry_.upsert(entry.hostname, entry.address,
+										  entry.port, entry.last_seen);
+		if (peer && now - entry.last_connected < RECENT_PEER_WINDOW) {
+			recent.push_back({entry, peer});
+		}
+	}
+	discovery_.start();
+	refreshPeers();
+
+	// most recent first
+	std::sort(recent.begin(), recent.end(),
+			  [](const auto &a, const auto &b) {
+				  return a.first.last_connected > b.first.last_connected;
+			  });
+	if (recent.size() > WARM_CONNECTIONS) {
+		recent.resize(WARM_CONNECTIONS);
+	}
+	for (const auto &[entry, peer] : recent) {
+		connectToPeer(peer, true);
+	}
+}
+
+void App::refreshPeers() {
+	// peers on the LAN are reached directly, the rest through the
+	// rendezvous server
+	if (rendezvous_) {
+		auto peers = peer_registry_.getSnapshot();
+		for (const auto &[hostname, address] : rendezvous_->getPeers()) {
+			auto peer = peers->findByHostname(hostname);
+			if (!peer || peer->getPort() == 0) {
+				peer_registry_.upsertRemote(hostname, address);
+			}
+		}
+	}
+	expirePeers();
+	markViewDirty();
+	reapConnections();
+
+	// relayed messages from peers that were not discovered at the time
+	std::vector<std::pair<std::shared_ptr<Peer>, Message>> adopted;
+	{
+		auto peers = peer_registry_.getSnapshot();
+		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+		auto it = orphaned_messages_.begin();
+		while (it != orphaned_messages_.end()) {
+			if (auto peer = peers->findByHostname(it->sender)) {
+				adopted.push_back({peer, *it});
+				it = orphaned_messages_.erase(it);
 			} else {
-				socket.close();
+				++it;
 			}
-		} catch (const boost::system::system_error &e) {
-			// Errors are expected here if the acceptor is closed.
 		}
 	}
+	for (const auto &[peer, msg] : adopted) {
+		onMessageReceived(peer, msg);
+	}
 }
 
-void App::performInitialDiscovery() { discovery_.start(); }
+void App::expirePeers() {
+	// cached peers are loaded with the time they were last seen, a run
+	// gives them that long to answer before they can go
+	if (std::chrono::steady_clock::now() - started_ < PEER_EXPIRY) {
+		return;
+	}
+	std::set<std::shared_ptr<Peer>> keep;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		for (const auto &[peer, connection] : connections_) {
+			keep.insert(peer);
+		}
+	}
+	{
+		const std::lock_guard<std::mutex> lock(connecting_peers_mutex_);
+		keep.insert(connecting_peers_.begin(), connecting_peers_.end());
+	}
+	{
+		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+		for (const auto &[peer, history] : message_history_) {
+			keep.insert(peer);
+		}
+	}
+	if (peer_registry_.expire(
+			std::chrono::system_clock::now() - PEER_EXPIRY, keep) > 0) {
+		markViewDirty();
+	}
+}
 
-void App::refreshPeers() { peers_ = discovery_.getPeers(); }
+void App::markMessageSent() {
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - started_);
+	std::int64_t unset = -1;
+	if (first_message_us_.compare_exchange_strong(unset, elapsed.count())) {
+		markViewDirty();
+	}
+}
+
+void App::markViewDirty() { view_dirty_ = true; }
+
+bool App::publishView() {
+	if (!view_dirty_.exchange(false)) {
+		return false;
+	}
+	const std::lock_guard<std::mutex> publish_lock(publish_mutex_);
+
+	// the locks are taken one at a time, never nested
+	auto view = std::make_shared<ViewModel>();
+	auto peers = peer_registry_.getSnapshot();
+	std::set<std::shared_ptr<Peer>> connected;
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		std::map<std::shared_ptr<Peer>, Connection::Stats> stats;
+		std::map<std::shared_ptr<Peer>, std::uint64_t> dialers;
+		for (const auto &[peer, connection] : connections_) {
+			if (connection->isConnected()) {
+				connected.insert(peer);
+				dialers.insert({peer, connection->getDialerNodeId()});
+			}
+			stats.insert({peer, connection->getStats()});
+		}
+		for (const auto &peer : peers->peers) {
+			// a peer behind NAT that turned up on the LAN is reached directly
+			if (peer->getPort() == 0 &&
+				peers->findByHostname(peer->getHostname()) != peer) {
+				continue;
+			}
+			PeerView peer_view{peer, ConnectionState::Disconnected};
+			auto peer_stats = stats.find(peer);
+			if (peer_stats != stats.end()) {
+				peer_view.throttled = peer_stats->second.throttled;
+				peer_view.throttled_frames = peer_stats->second.throttled_frames;
+				peer_view.rtt_ms = peer_stats->second.rtt_ms;
+				peer_view.rtt_jitter_ms = peer_stats->second.rtt_jitter_ms;
+			}
+			auto dialer = dialers.find(peer);
+			if (dialer != dialers.end()) {
+				peer_view.dialer_node_id = dialer->second;
+			}
+			view->peers.push_back(peer_view);
+		}
+		view->status = status_message_;
+	}
+	view->discovery_dropped = discovery_.getStats().dropped;
+	{
+		const std::lock_guard<std::mutex> lock(connecting_peers_mutex_);
+		for (auto &peer_view : view->peers) {
+			if (connected.count(peer_view.peer)) {
+				peer_view.state = ConnectionState::Connected;
+			} else if (connecting_peers_.count(peer_view.peer)) {
+				peer_view.state = ConnectionState::Connecting;
+			}
+		}
+	}
+	{
+		const std::lock_guard<std::mutex> lock(message_queue_mutex_);
+		for (const auto &[group_id, members] : groups_) {
+			view->groups.push_back({group_id, members});
+		}
+		// shares the history chunks, only the chunk pointers are copied
+		view->histories = message_history_;
+		view->group_histories = group_history_;
+	}
+
+	view->hostname = my_hostname_;
+	std::int64_t first_message_us = first_message_us_;
+	view->first_message_ms =
+		first_message_us < 0 ? -1 : first_message_us / 1000.0;
+	view->version = ++view_version_;
+	std::atomic_store(&view_, std::shared_ptr<const ViewModel>(view));
+	return true;
+}
+
+std::shared_ptr<const ViewModel> App::getView() const {
+	auto view = std::atomic_load(&view_);
+	if (!view) {
+		static const auto empty_view = std::make_shared<const ViewModel>();
+		return empty_view;
+	}
+	return view;
+}
 
 // const std::string& App::getStatusMessage() const {
 std::string App::getStatusMessage() const {
 	const std::lock_guard<std::mutex> lock(app_mutex_);
 	return status_message_;
 }
+
+void App::setStatusMessage(const std::string &message) {
+	{
+		const std::lock_guard<std::mutex> lock(app_mutex_);
+		status_message_ = message;
+	}
+	markViewDirty();
+}
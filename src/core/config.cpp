@@ -0,0 +1,118 @@
+#include "core/config.hpp"
+#include "core/wire.hpp"
+#include <boost/asio.hpp>
+#include <stdexcept>
+#include <string>
+
+static unsigned short parsePort(const std::string &text) {
+	size_t end = 0;
+	unsigned long port = 0;
+	try {
+		port = std::stoul(text, &end);
+	} catch (const std::exception &e) {
+		end = 0;
+	}
+	if (end != text.size() || port == 0 || port > 65535) {
+		throw std::invalid_argument("bad port " + text);
+	}
+	return static_cast<unsigned short>(port);
+}
+
+static boost::asio::ip::address parseAddress(const std::string &text) {
+	boost::system::error_code ec;
+	auto address = boost::asio::ip::make_address(text, ec);
+	if (ec) {
+		throw std::invalid_argument("bad address " + text);
+	}
+	return address;
+}
+
+// rates and timeouts, what names the value in the error
+static double parseAmount(const std::string &text, const std::string &what) {
+	size_t end = 0;
+	double amount = -1;
+	try {
+		amount = std::stod(text, &end);
+	} catch (const std::exception &e) {
+		end = 0;
+	}
+	if (end == 0 || end != text.size() || !(amount >= 0)) {
+		throw std::invalid_argument("bad " + what + " " + text);
+	}
+	return amount;
+}
+
+const char *Config::usage() {
+	return "usage: chat [options]\n"
+		   "  --name NAME            name announced to peers (host name)\n"
+		   "  --bind ADDRESS         address chats use (all addresses)\n"
+		   "  --port PORT            TCP port for chats (9000)\n"
+		   "  --discovery-port PORT  UDP port for discovery (9001)\n"
+		   "  --seed ADDRESS:PORT    also ping this discovery port, repeatable\n"
+		   "  --no-broadcast         don't broadcast discovery pings\n"
+		   "  --data-dir DIR         identity and pinned peers (~/.p2p_chat)\n"
+		   "  --rendezvous HOST:PORT rendezvous server for peers behind NAT\n"
+		   "  --peer-frame-rate N    frames per second from one peer (500)\n"
+		   "  --peer-byte-rate N     bytes per second from one peer (1048576)\n"
+		   "  --discovery-rate N     discovery packets per second from one\n"
+		   "                         address (5)\n"
+		   "  --dead-peer-timeout N  seconds before a silent peer is dropped\n"
+		   "                         and dialed again (5)\n"
+		   "rates and timeouts of 0 turn them off\n";
+}
+
+Config Config::fromArgs(int argc, char **argv) {
+	Config config;
+	for (int i = 1; i < argc; ++i) {
+		std::string flag = argv[i];
+		if (flag == "--no-broadcast") {
+			config.broadcast = false;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			throw std::invalid_argument("missing value for " + flag);
+		}
+		std::string value = argv[++i];
+
+		if (flag == "--name") {
+			// left empty, the host name is used
+			if (!value.empty() && !isWireName(value)) {
+				throw std::invalid_argument("bad name " + value +
+											", names can't hold | or ,");
+			}
+			config.hostname = value;
+		} else if (flag == "--bind") {
+			config.bind_address = parseAddress(value);
+		} else if (flag == "--port") {
+			config.port = parsePort(value);
+		} else if (flag == "--discovery-port") {
+			config.discovery_port = parsePort(value);
+		} else if (flag == "--seed") {
+			size_t colon = value.rfind(':');
+			if (colon == std::string::npos) {
+				throw std::invalid_argument("bad seed " + value);
+			}
+			config.discovery_seeds.emplace_back(
+				parseAddress(value.substr(0, colon)),
+				parsePort(value.substr(colon + 1)));
+		} else if (flag == "--data-dir") {
+			config.data_dir = value;
+		} else if (flag == "--rendezvous") {
+			if (value.rfind(':') == std::string::npos) {
+				throw std::invalid_argument("bad rendezvous address " + value);
+			}
+			config.rendezvous = value;
+		} else if (flag == "--peer-frame-rate") {
+			config.peer_frame_rate = parseAmount(value, "rate");
+		} else if (flag == "--peer-byte-rate") {
+			config.peer_byte_rate = parseAmount(value, "rate");
+		} else if (flag == "--discovery-rate") {
+			config.discovery_rate = parseAmount(value, "rate");
+		} else if (flag == "--dead-peer-timeout") {
+			config.dead_peer_timeout = parseAmount(value, "timeout");
+		} else {
+			throw std::invalid_argument("unknown option " + flag);
+		}
+	}
+	return config;
+}
@@ -0,0 +1,26 @@
+#include "core/envelope.hpp"
+#include <chrono>
+#include <string>
+
+static long long toMilliseconds(std::chrono::system_clock::time_point time) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			   time.time_since_epoch())
+		.count();
+}
+
+std::string Envelope::serialize() const {
+	return encodeFrame<EnvelopeFrame>(*this);
+}
+
+Envelope Envelope::deserialize(const std::string &data) {
+	return decodeFrame<EnvelopeFrame>(data);
+}
+
+std::string Envelope::signedData() const {
+	return id + "|" + recipient + "|" + origin + "|" +
+		   std::to_string(toMilliseconds(expires)) + "|" + sealed;
+}
+
+bool Envelope::isExpired() const {
+	return std::chrono::system_clock::now() >= expires;
+}
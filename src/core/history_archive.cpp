@@ -0,0 +1,589 @@
+#include "core/history_archive.hpp"
+#include "core/history_sync.hpp"
+#include "core/wire.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <lz4.h>
+#include <zlib.h>
+
+constexpr std::string_view MAGIC = "P2PHIST2";
+// messages per block. big enough for lz4 to find the repeats in chat
+// text, small enough that a time range reads little past its ends
+constexpr size_t BLOCK_SIZE = 1024;
+// lz4 can't expand more than about 255 to one
+constexpr size_t MAX_EXPANSION = 255;
+// per conversation: offset and size
+constexpr size_t DIRECTORY_ENTRY_SIZE = 16;
+// count and directory offset at the very end of the file
+constexpr size_t FOOTER_SIZE = 12;
+// a block index entry: earliest and latest time, count, offset, size and
+// crc32 of the block
+constexpr size_t INDEX_ENTRY_SIZE = 36;
+
+// headers use little endian fixed width integers, columns use varints
+static void putFixed(std::string &out, std::uint64_t value, size_t bytes) {
+	for (size_t i = 0; i < bytes; ++i) {
+		out += static_cast<char>(value >> (8 * i) & 0xff);
+	}
+}
+
+static void putVarint(std::string &out, std::uint64_t value) {
+	while (value >= 0x80) {
+		out += static_cast<char>((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += static_cast<char>(value);
+}
+
+// small deltas either way stay small
+static std::uint64_t zigzag(std::int64_t value) {
+	return (static_cast<std::uint64_t>(value) << 1) ^
+		   static_cast<std::uint64_t>(value >> 63);
+}
+
+static std::int64_t unzigzag(std::uint64_t value) {
+	return static_cast<std::int64_t>(value >> 1) ^
+		   -static_cast<std::int64_t>(value & 1);
+}
+
+static void putString(std::string &out, std::string_view value) {
+	putVarint(out, value.size());
+	out.append(value.data(), value.size());
+}
+
+static std::runtime_error damaged() {
+	return std::runtime_error("damaged history archive");
+}
+
+// reads back what the put functions wrote, throws on anything cut short
+class ArchiveReader {
+  private:
+	std::string_view data_;
+	size_t pos_ = 0;
+
+  public:
+	explicit ArchiveReader(std::string_view data) : data_(data) {}
+
+	std::uint64_t fixed(size_t bytes) {
+		auto field = take(bytes);
+		std::uint64_t value = 0;
+		for (size_t i = 0; i < bytes; ++i) {
+			value |= static_cast<std::uint64_t>(
+						 static_cast<unsigned char>(field[i]))
+					 << (8 * i);
+		}
+		return value;
+	}
+
+	std::uint64_t varint() {
+		std::uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			auto byte = static_cast<unsigned char>(take(1)[0]);
+			value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return value;
+			}
+		}
+		throw damaged();
+	}
+
+	std::string_view take(size_t len) {
+		if (len > data_.size() - pos_) {
+			throw damaged();
+		}
+		auto field = data_.substr(pos_, len);
+		pos_ += len;
+		return field;
+	}
+
+	std::string_view string() { return take(varint()); }
+};
+
+// each distinct value once, then the index of every message's value
+static void putDictionary(std::string &out,
+						  const std::vector<std::string_view> &values) {
+	std::unordered_map<std::string_view, size_t> indexes;
+	std::vector<std::string_view> dictionary;
+	std::string column;
+	for (auto value : values) {
+		auto [it, added] = indexes.emplace(value, dictionary.size());
+		if (added) {
+			dictionary.push_back(value);
+		}
+		putVarint(column, it->second);
+	}
+	putVarint(out, dictionary.size());
+	for (auto value : dictionary) {
+		putString(out, value);
+	}
+	out += column;
+}
+
+// the dictionary, and through indexes the value of every message
+static std::vector<std::string>
+readDictionary(ArchiveReader &reader, size_t count,
+			   std::vector<std::uint32_t> &indexes) {
+	size_t size = reader.varint();
+	if (size > count) {
+		throw damaged();
+	}
+	std::vector<std::string> dictionary;
+	dictionary.reserve(size);
+	for (size_t i = 0; i < size; ++i) {
+		dictionary.emplace_back(reader.string());
+	}
+	indexes.resize(count);
+	for (auto &index : indexes) {
+		std::uint64_t value = reader.varint();
+		if (value >= size) {
+			throw damaged();
+		}
+		index = static_cast<std::uint32_t>(value);
+	}
+	return dictionary;
+}
+
+// group members travel as a list, commas can't be in a member
+static std::string joinMembers(const std::vector<std::string> &members) {
+	std::string joined;
+	for (size_t i = 0; i < members.size(); ++i) {
+		joined += (i ? "," : "");
+		joined += members[i];
+	}
+	return joined;
+}
+
+static std::vector<std::string> splitMembers(std::string_view joined) {
+	std::vector<std::string> members;
+	if (joined.empty()) {
+		return members;
+	}
+	size_t start = 0;
+	while (true) {
+		size_t comma = joined.find(',', start);
+		members.emplace_back(joined.substr(start, comma - start));
+		if (comma == std::string_view::npos) {
+			return members;
+		}
+		start = comma + 1;
+	}
+}
+
+// four columns: time deltas starting from the block's earliest time,
+// senders, group members, and content compressed with lz4 as every length
+// followed by every text
+static std::string encodeBlock(const Message *messages, size_t count,
+							   std::int64_t first_time) {
+	std::string times;
+	std::vector<std::string_view> senders;
+	std::vector<std::string> members;
+	std::string content;
+	std::int64_t previous = first_time;
+	size_t text_size = 0;
+	for (size_t i = 0; i < count; ++i) {
+		std::int64_t time = messageTime(messages[i]);
+		putVarint(times, zigzag(time - previous));
+		previous = time;
+		senders.push_back(messages[i].sender);
+		members.push_back(joinMembers(messages[i].group_members));
+		putVarint(content, messages[i].content.size());
+		text_size += messages[i].content.size();
+	}
+	content.reserve(content.size() + text_size);
+	for (size_t i = 0; i < count; ++i) {
+		content += messages[i].content;
+	}
+
+	std::string sender_column;
+	putDictionary(sender_column, senders);
+	std::string member_column;
+	putDictionary(member_column,
+				  std::vector<std::string_view>(members.begin(), members.end()));
+	if (content.size() > LZ4_MAX_INPUT_SIZE) {
+		throw std::runtime_error("history block too large to compress");
+	}
+	int content_size = static_cast<int>(content.size());
+	std::string packed(LZ4_compressBound(content_size), '\0');
+	int packed_size =
+		LZ4_compress_default(content.data(), packed.data(), content_size,
+							 static_cast<int>(packed.size()));
+	if (packed_size <= 0) {
+		throw std::runtime_error("failed to compress history");
+	}
+	packed.resize(packed_size);
+
+	std::string block;
+	putVarint(block, times.size());
+	putVarint(block, sender_column.size());
+	putVarint(block, member_column.size());
+	putVarint(block, content.size());
+	putVarint(block, packed.size());
+	block += times;
+	block += sender_column;
+	block += member_column;
+	block += packed;
+	return block;
+}
+
+// appends the block's messages sent in [from, to) to out
+static void decodeBlock(std::string_view data, size_t count,
+						std::int64_t first_time,
+						const ArchivedConversation &conversation,
+						std::int64_t from, std::int64_t to,
+						std::vector<Message> &out) {
+	ArchiveReader reader(data);
+	size_t times_size = reader.varint();
+	size_t senders_size = reader.varint();
+	size_t members_size = reader.varint();
+	size_t content_size = reader.varint();
+	size_t packed_size = reader.varint();
+	ArchiveReader times(reader.take(times_size));
+	ArchiveReader sender_column(reader.take(senders_size));
+	ArchiveReader member_column(reader.take(members_size));
+	auto packed = reader.take(packed_size);
+
+	std::vector<std::uint32_t> sender_indexes;
+	auto senders = readDictionary(sender_column, count, sender_indexes);
+	std::vector<std::uint32_t> member_indexes;
+	auto member_lists = readDictionary(member_column, count, member_indexes);
+	std::vector<std::vector<std::string>> members;
+	for (const auto &joined : member_lists) {
+		members.push_back(splitMembers(joined));
+	}
+
+	// sizes the codec could never have produced are damage rather than
+	// something to allocate for
+	if (content_size > LZ4_MAX_INPUT_SIZE ||
+		content_size / MAX_EXPANSION > packed_size ||
+		packed_size > static_cast<size_t>(
+						  LZ4_compressBound(static_cast<int>(content_size)))) {
+		throw damaged();
+	}
+	std::string content(content_size, '\0');
+	if (LZ4_decompress_safe(packed.data(), content.data(),
+							static_cast<int>(packed.size()),
+							static_cast<int>(content_size)) !=
+		static_cast<int>(content_size)) {
+		throw damaged();
+	}
+	ArchiveReader lengths(content);
+	std::vector<size_t> text_sizes(count);
+	for (auto &size : text_sizes) {
+		size = lengths.varint();
+	}
+
+	// every step stays within what a time_point holds, so the sums can't
+	// overflow either
+	if (!isWireMillis(first_time)) {
+		throw damaged();
+	}
+	std::int64_t time = first_time;
+	for (size_t i = 0; i < count; ++i) {
+		std::int64_t delta = unzigzag(times.varint());
+		if (!isWireMillis(delta) || !isWireMillis(time + delta)) {
+			throw damaged();
+		}
+		time += delta;
+		auto text = lengths.take(text_sizes[i]);
+		if (time < from || time >= to) {
+			continue;
+		}
+		Message msg;
+		msg.sender = senders[sender_indexes[i]];
+		msg.content.assign(text.data(), text.size());
+		msg.timestamp = std::chrono::system_clock::time_point(
+			std::chrono::milliseconds(time));
+		if (conversation.group) {
+			msg.group_id = conversation.name;
+			msg.group_members = members[member_indexes[i]];
+		}
+		out.push_back(std::move(msg));
+	}
+}
+
+// header size, then kind, name and the block index, then the blocks
+static std::string encodeConversation(const ArchivedConversation &conversation) {
+	std::string index;
+	std::string blocks;
+	const auto &messages = conversation.messages;
+	for (size_t start = 0; start < messages.size(); start += BLOCK_SIZE) {
+		size_t count = std::min(BLOCK_SIZE, messages.size() - start);
+		std::int64_t lo = messageTime(messages[start]);
+		std::int64_t hi = lo;
+		for (size_t i = start; i < start + count; ++i) {
+			lo = std::min(lo, messageTime(messages[i]));
+			hi = std::max(hi, messageTime(messages[i]));
+		}
+		auto block = encodeBlock(&messages[start], count, lo);
+		putFixed(index, static_cast<std::uint64_t>(lo), 8);
+		putFixed(index, static_cast<std::uint64_t>(hi), 8);
+		putFixed(index, count, 4);
+		putFixed(index, blocks.size(), 8);
+		putFixed(index, block.size(), 4);
+		putFixed(index,
+				 crc32(0, reinterpret_cast<const Bytef *>(block.data()),
+					   static_cast<uInt>(block.size())),
+				 4);
+		blocks += block;
+	}
+
+	std::string header;
+	header += conversation.group ? 'G' : 'D';
+	putString(header, conversation.name);
+	putVarint(header, index.size() / INDEX_ENTRY_SIZE);
+	header += index;
+	std::string segment;
+	putFixed(segment, header.size(), 4);
+	segment += header;
+	segment += blocks;
+	return segment;
+}
+
+// reads the blocks of one conversation that overlap [from, to)
+static ArchivedConversation readConversation(std::ifstream &file,
+											 std::uint64_t offset,
+											 std::uint64_t size,
+											 std::int64_t from,
+											 std::int64_t to) {
+	auto read = [&file](std::uint64_t at, size_t len) {
+		std::string data(len, '\0');
+		file.seekg(static_cast<std::streamoff>(at));
+		if (!file.read(data.data(), static_cast<std::streamsize>(len))) {
+			throw damaged();
+		}
+		return data;
+	};
+	if (size < 4) {
+		throw damaged();
+	}
+	size_t header_size = ArchiveReader(read(offset, 4)).fixed(4);
+	if (header_size > size - 4) {
+		throw damaged();
+	}
+	auto header_data = read(offset + 4, header_size);
+	ArchiveReader header(header_data);
+	ArchivedConversation conversation;
+	char kind = header.take(1)[0];
+	if (kind != 'D' && kind != 'G') {
+		throw damaged();
+	}
+	conversation.group = kind == 'G';
+	conversation.name = std::string(header.string());
+	size_t block_count = header.varint();
+
+	std::uint64_t blocks_at = offset + 4 + header_size;
+	std::uint64_t blocks_size = size - 4 - header_size;
+	for (size_t i = 0; i < block_count; ++i) {
+		auto lo = static_cast<std::int64_t>(header.fixed(8));
+		auto hi = static_cast<std::int64_t>(header.fixed(8));
+		size_t count = header.fixed(4);
+		std::uint64_t block_offset = header.fixed(8);
+		size_t block_size = header.fixed(4);
+		std::uint64_t crc = header.fixed(4);
+		if (block_offset > blocks_size ||
+			block_size > blocks_size - block_offset || count > BLOCK_SIZE) {
+			throw damaged();
+		}
+		if (hi < from || lo >= to) {
+			continue;
+		}
+		auto block = read(blocks_at + block_offset, block_size);
+		if (crc32(0, reinterpret_cast<const Bytef *>(block.data()),
+				  static_cast<uInt>(block.size())) != crc) {
+			throw damaged();
+		}
+		decodeBlock(block, count, lo, conversation, from, to,
+					conversation.messages);
+	}
+	return conversation;
+}
+
+// how many threads to encode or decode count conversations on
+static size_t workerCount(size_t count) {
+	size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	return std::min(count, cores);
+}
+
+// writes the archive into file, path is only for the error messages
+static void writeArchive(std::ofstream &file, const std::string &path,
+						 const std::vector<ArchivedConversation> &conversations) {
+	file.write(MAGIC.data(), MAGIC.size());
+
+	// workers encode conversations while this thread writes them out in
+	// order, so the disk is busy from the first one on
+	std::mutex mutex;
+	std::condition_variable ready_cv;
+	std::vector<std::string> segments(conversations.size());
+	std::vector<bool> ready(conversations.size(), false);
+	std::exception_ptr error;
+	std::atomic<size_t> next{0};
+	auto work = [&] {
+		while (true) {
+			size_t i = next++;
+			if (i >= conversations.size()) {
+				return;
+			}
+			try {
+				auto segment = encodeConversation(conversations[i]);
+				const std::lock_guard<std::mutex> lock(mutex);
+				segments[i] = std::move(segment);
+				ready[i] = true;
+			} catch (...) {
+				const std::lock_guard<std::mutex> lock(mutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			ready_cv.notify_all();
+		}
+	};
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < workerCount(conversations.size()); ++i) {
+		workers.emplace_back(work);
+	}
+
+	std::string directory;
+	std::uint64_t offset = MAGIC.size();
+	for (size_t i = 0; i < conversations.size(); ++i) {
+		std::string segment;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			ready_cv.wait(lock, [&] { return ready[i] || error; });
+			if (error) {
+				break;
+			}
+			segment.swap(segments[i]);
+		}
+		file.write(segment.data(), static_cast<std::streamsize>(segment.size()));
+		putFixed(directory, offset, 8);
+		putFixed(directory, segment.size(), 8);
+		offset += segment.size();
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	putFixed(directory, conversations.size(), 4);
+	putFixed(directory, offset, 8);
+	file.write(directory.data(), static_cast<std::streamsize>(directory.size()));
+	file.close();
+	if (!file) {
+		throw std::runtime_error("failed to write " + path);
+	}
+}
+
+// written next to path and renamed over it once complete, so a failed
+// export leaves neither a partial archive nor a damaged earlier one
+void writeHistoryArchive(const std::string &path,
+						 const std::vector<ArchivedConversation> &conversations) {
+	std::string partial = path + ".part";
+	std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("failed to open " + path);
+	}
+	try {
+		writeArchive(file, path, conversations);
+		std::filesystem::rename(partial, path);
+	} catch (...) {
+		file.close();
+		std::error_code ec;
+		std::filesystem::remove(partial, ec);
+		throw;
+	}
+}
+
+std::vector<ArchivedConversation> readHistoryArchive(const std::string &path,
+													 std::int64_t from,
+													 std::int64_t to) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		throw std::runtime_error("failed to open " + path);
+	}
+	auto file_size = static_cast<std::uint64_t>(file.tellg());
+	std::string magic(MAGIC.size(), '\0');
+	file.seekg(0);
+	if (file_size < MAGIC.size() + FOOTER_SIZE ||
+		!file.read(magic.data(), static_cast<std::streamsize>(magic.size())) ||
+		magic != MAGIC) {
+		throw std::runtime_error(path + " is not a history archive");
+	}
+	std::string footer_data(FOOTER_SIZE, '\0');
+	file.seekg(static_cast<std::streamoff>(file_size - FOOTER_SIZE));
+	file.read(footer_data.data(), FOOTER_SIZE);
+	ArchiveReader footer(footer_data);
+	size_t count = footer.fixed(4);
+	std::uint64_t directory_at = footer.fixed(8);
+	if (directory_at > file_size - FOOTER_SIZE ||
+		count != (file_size - FOOTER_SIZE - directory_at) / DIRECTORY_ENTRY_SIZE) {
+		throw damaged();
+	}
+	std::string directory_data(count * DIRECTORY_ENTRY_SIZE, '\0');
+	file.seekg(static_cast<std::streamoff>(directory_at));
+	if (!file.read(directory_data.data(),
+				   static_cast<std::streamsize>(directory_data.size()))) {
+		throw damaged();
+	}
+	ArchiveReader directory(directory_data);
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> segments;
+	for (size_t i = 0; i < count; ++i) {
+		std::uint64_t offset = directory.fixed(8);
+		std::uint64_t size = directory.fixed(8);
+		if (offset > directory_at || size > directory_at - offset) {
+			throw damaged();
+		}
+		segments.emplace_back(offset, size);
+	}
+
+	// each worker reads through a file of its own
+	std::vector<ArchivedConversation> conversations(count);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	std::atomic<size_t> next{0};
+	auto work = [&] {
+		std::ifstream worker_file(path, std::ios::binary);
+		while (true) {
+			size_t i = next++;
+			if (i >= count) {
+				return;
+			}
+			try {
+				conversations[i] = readConversation(
+					worker_file, segments[i].first, segments[i].second, from, to);
+			} catch (...) {
+				const std::lock_guard<std::mutex> lock(error_mutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+				next = count;
+			}
+		}
+	};
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < workerCount(count); ++i) {
+		workers.emplace_back(work);
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	return conversations;
+}
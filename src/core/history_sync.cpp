@@ -0,0 +1,418 @@
+#include "core/history_sync.hpp"
+#include "crypto/crypto.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <openssl/evp.h>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// a differing range is split into this many time buckets, and listed
+// outright once one side holds at most LEAF_SIZE messages in it
+constexpr std::uint64_t BRANCHES = 16;
+constexpr size_t LEAF_SIZE = 16;
+// keeps F and W frames well under the frame size limit
+constexpr size_t MAX_ITEMS_PER_FRAME = 256;
+// messages an M frame carries, in bytes. a longer message goes alone
+constexpr size_t MAX_MESSAGE_BYTES_PER_FRAME = 64 * 1024;
+constexpr std::int64_t FIRST_TIME = std::numeric_limits<std::int64_t>::min();
+constexpr std::int64_t LAST_TIME = std::numeric_limits<std::int64_t>::max();
+
+MessageId messageId(const Message &msg) {
+	std::string encoded = msg.serialize();
+	std::array<std::uint8_t, EVP_MAX_MD_SIZE> digest;
+	if (EVP_Digest(encoded.data(), encoded.size(), digest.data(), nullptr,
+				   EVP_sha256(), nullptr) <= 0) {
+		throw std::runtime_error("failed to hash message");
+	}
+	MessageId id;
+	std::copy(digest.begin(), digest.begin() + id.size(), id.begin());
+	return id;
+}
+
+std::int64_t messageTime(const Message &msg) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			   msg.timestamp.time_since_epoch())
+		.count();
+}
+
+static bool operator<(const SyncEntry &a, const SyncEntry &b) {
+	return a.time != b.time ? a.time < b.time : a.id < b.id;
+}
+
+static MessageId xorIds(MessageId a, const MessageId &b) {
+	for (size_t i = 0; i < a.size(); ++i) {
+		a[i] ^= b[i];
+	}
+	return a;
+}
+
+size_t HistoryIndex::lowerBound(std::int64_t time) const {
+	return std::lower_bound(entries_.begin(), entries_.end(), time,
+							[](const SyncEntry &entry, std::int64_t t) {
+								return entry.time < t;
+							}) -
+		   entries_.begin();
+}
+
+bool HistoryIndex::insert(const Message &msg) {
+	SyncEntry entry{messageTime(msg), messageId(msg)};
+	auto it = std::lower_bound(entries_.begin(), entries_.end(), entry);
+	if (it != entries_.end() && it->time == entry.time && it->id == entry.id) {
+		return false;
+	}
+	// new messages land at the end, only late ones rebuild the tail
+	size_t position = it - entries_.begin();
+	entries_.insert(it, entry);
+	prefix_.resize(entries_.size() + 1);
+	for (size_t i = position; i < entries_.size(); ++i) {
+		prefix_[i + 1] = xorIds(prefix_[i], entries_[i].id);
+	}
+	return true;
+}
+
+std::vector<bool> HistoryIndex::insertAll(const std::vector<Message> &msgs) {
+	std::vector<std::pair<SyncEntry, size_t>> incoming;
+	incoming.reserve(msgs.size());
+	for (size_t i = 0; i < msgs.size(); ++i) {
+		incoming.push_back({{messageTime(msgs[i]), messageId(msgs[i])}, i});
+	}
+	std::sort(incoming.begin(), incoming.end(),
+			  [](const auto &a, const auto &b) { return a.first < b.first; });
+
+	std::vector<bool> added(msgs.size(), false);
+	std::vector<SyncEntry> fresh;
+	for (size_t i = 0; i < incoming.size(); ++i) {
+		const auto &entry = incoming[i].first;
+		bool repeat = i > 0 && incoming[i - 1].first.time == entry.time &&
+					  incoming[i - 1].first.id == entry.id;
+		if (!repeat && !contains(entry)) {
+			fresh.push_back(entry);
+			added[incoming[i].second] = true;
+		}
+	}
+	if (fresh.empty()) {
+		return added;
+	}
+
+	size_t position = lowerBound(fresh.front().time);
+	std::vector<SyncEntry> merged;
+	merged.reserve(entries_.size() + fresh.size());
+	std::merge(entries_.begin(), entries_.end(), fresh.begin(), fresh.end(),
+			   std::back_inserter(merged));
+	entries_.swap(merged);
+	prefix_.resize(entries_.size() + 1);
+	for (size_t i = position; i < entries_.size(); ++i) {
+		prefix_[i + 1] = xorIds(prefix_[i], entries_[i].id);
+	}
+	return added;
+}
+
+bool HistoryIndex::contains(const SyncEntry &entry) const {
+	return std::binary_search(entries_.begin(), entries_.end(), entry);
+}
+
+RangeFingerprint HistoryIndex::fingerprint(std::int64_t lo,
+										   std::int64_t hi) const {
+	size_t begin = lowerBound(lo);
+	size_t end = std::max(begin, lowerBound(hi));
+	return {lo, hi, end - begin, xorIds(prefix_[begin], prefix_[end])};
+}
+
+bool HistoryIndex::span(std::int64_t lo, std::int64_t hi, std::int64_t &first,
+						std::int64_t &last) const {
+	size_t begin = lowerBound(lo);
+	size_t end = lowerBound(hi);
+	if (begin >= end) {
+		return false;
+	}
+	first = entries_[begin].time;
+	last = entries_[end - 1].time;
+	return true;
+}
+
+std::vector<SyncEntry> HistoryIndex::range(std::int64_t lo,
+										   std::int64_t hi) const {
+	size_t begin = lowerBound(lo);
+	size_t end = std::max(begin, lowerBound(hi));
+	return std::vector<SyncEntry>(entries_.begin() + begin,
+								  entries_.begin() + end);
+}
+
+SyncFrame SyncFrame::parse(const std::string &payload) {
+	return decodeFrame<SyncWireFrame>(payload);
+}
+
+std::string SyncFrame::serialize() const {
+	return encodeFrame<SyncWireFrame>(*this);
+}
+
+// text as exactly count colon separated fields
+static std::vector<std::string_view> splitFields(std::string_view text,
+												 size_t count) {
+	std::vector<std::string_view> fields;
+	size_t start = 0;
+	while (fields.size() + 1 < count) {
+		size_t colon = text.find(':', start);
+		if (colon == std::string_view::npos) {
+			throw std::invalid_argument("missing field in sync frame");
+		}
+		fields.push_back(text.substr(start, colon - start));
+		start = colon + 1;
+	}
+	fields.push_back(text.substr(start));
+	return fields;
+}
+
+static std::vector<std::string> splitItems(std::string_view text) {
+	std::vector<std::string> items;
+	WireList::decode(text, items);
+	return items;
+}
+
+static std::int64_t parseTime(std::string_view text) {
+	std::int64_t time = 0;
+	WireInt::decode(text, time);
+	return time;
+}
+
+static MessageId parseId(std::string_view text) {
+	std::string bytes;
+	WireHex::decode(text, bytes);
+	MessageId id;
+	if (bytes.size() != id.size()) {
+		throw std::invalid_argument("bad id in sync frame");
+	}
+	std::copy(bytes.begin(), bytes.end(), id.begin());
+	return id;
+}
+
+static std::string encodeEntry(const SyncEntry &entry) {
+	return std::to_string(entry.time) + ":" +
+		   toHex(entry.id.data(), entry.id.size());
+}
+
+// entry times are looked up as time_points, range bounds stay numbers
+static SyncEntry parseEntry(std::string_view text) {
+	auto fields = splitFields(text, 2);
+	std::int64_t time = parseTime(fields[0]);
+	if (!isWireMillis(time)) {
+		throw std::invalid_argument("time out of range in sync frame");
+	}
+	return {time, parseId(fields[1])};
+}
+
+static std::string encodeRange(const RangeFingerprint &range) {
+	return std::to_string(range.lo) + ":" + std::to_string(range.hi) + ":" +
+		   std::to_string(range.count) + ":" +
+		   toHex(range.hash.data(), range.hash.size());
+}
+
+static RangeFingerprint parseRange(std::string_view text) {
+	auto fields = splitFields(text, 4);
+	RangeFingerprint range;
+	range.lo = parseTime(fields[0]);
+	range.hi = parseTime(fields[1]);
+	std::int64_t count = parseTime(fields[2]);
+	if (range.lo >= range.hi || count < 0) {
+		throw std::invalid_argument("bad range in sync frame");
+	}
+	range.count = static_cast<size_t>(count);
+	range.hash = parseId(fields[3]);
+	return range;
+}
+
+// items joined with commas, at most MAX_ITEMS_PER_FRAME to a frame
+static void appendFrames(std::vector<std::string> &frames, char kind,
+						 const std::string &conversation,
+						 const std::vector<std::string> &items) {
+	for (size_t start = 0; start < items.size();
+		 start += MAX_ITEMS_PER_FRAME) {
+		SyncFrame frame{kind, conversation, ""};
+		size_t end = std::min(items.size(), start + MAX_ITEMS_PER_FRAME);
+		for (size_t i = start; i < end; ++i) {
+			frame.body += (i > start ? "," : "") + items[i];
+		}
+		frames.push_back(frame.serialize());
+	}
+}
+
+static std::string listingFrame(const std::string &conversation,
+								const HistoryIndex &index, std::int64_t lo,
+								std::int64_t hi) {
+	SyncFrame frame{'I', conversation,
+					std::to_string(lo) + ":" + std::to_string(hi) + "|"};
+	auto entries = index.range(lo, hi);
+	for (size_t i = 0; i < entries.size(); ++i) {
+		frame.body += (i ? "," : "") + encodeEntry(entries[i]);
+	}
+	return frame.serialize();
+}
+
+// buckets [lo, hi) by time. the buckets only span the messages we hold
+// there, the stretches before and after them become a range each
+static std::vector<RangeFingerprint>
+splitRange(const HistoryIndex &index, std::int64_t lo, std::int64_t hi) {
+	std::int64_t first = 0;
+	std::int64_t last = 0;
+	if (!index.span(lo, hi, first, last)) {
+		return {index.fingerprint(lo, hi)};
+	}
+	std::vector<RangeFingerprint> ranges;
+	if (lo < first) {
+		ranges.push_back(index.fingerprint(lo, first));
+	}
+	// last < hi, so this can't overflow. the width is worked out unsigned
+	// since peers choose the times
+	std::int64_t end = last + 1;
+	std::uint64_t width = static_cast<std::uint64_t>(end) -
+						  static_cast<std::uint64_t>(first);
+	width = width / BRANCHES + (width % BRANCHES != 0);
+	for (std::int64_t start = first; start < end;) {
+		std::uint64_t left = static_cast<std::uint64_t>(end) -
+							 static_cast<std::uint64_t>(start);
+		std::int64_t stop =
+			left > width ? static_cast<std::int64_t>(
+							   static_cast<std::uint64_t>(start) + width)
+						 : end;
+		ranges.push_back(index.fingerprint(start, stop));
+		start = stop;
+	}
+	if (end < hi) {
+		ranges.push_back(index.fingerprint(end, hi));
+	}
+	return ranges;
+}
+
+static void appendRanges(std::vector<std::string> &items,
+						 const std::vector<RangeFingerprint> &ranges) {
+	for (const auto &range : ranges) {
+		items.push_back(encodeRange(range));
+	}
+}
+
+std::string beginSync(const std::string &conversation,
+					  const HistoryIndex &index) {
+	std::vector<std::string> items;
+	appendRanges(items, splitRange(index, FIRST_TIME, LAST_TIME));
+	std::vector<std::string> frames;
+	appendFrames(frames, 'F', conversation, items);
+	return frames.front();
+}
+
+SyncReply answerSync(const SyncFrame &frame, const HistoryIndex &index) {
+	SyncReply reply;
+	if (frame.kind == 'F') {
+		std::vector<std::string> ranges;
+		for (const auto &text : splitItems(frame.body)) {
+			auto theirs = parseRange(text);
+			auto mine = index.fingerprint(theirs.lo, theirs.hi);
+			if (mine.count == theirs.count && mine.hash == theirs.hash) {
+				continue;
+			}
+			if (theirs.count == 0) {
+				// they have nothing here, everything we have is missing
+				auto entries = index.range(theirs.lo, theirs.hi);
+				reply.missing.insert(reply.missing.end(), entries.begin(),
+									 entries.end());
+			} else if (mine.count <= LEAF_SIZE ||
+					   theirs.hi - 1 == theirs.lo) {
+				reply.frames.push_back(listingFrame(frame.conversation, index,
+													theirs.lo, theirs.hi));
+			} else if (theirs.count <= LEAF_SIZE) {
+				// the smaller side lists, hand the range back to them
+				ranges.push_back(encodeRange(mine));
+			} else {
+				appendRanges(ranges, splitRange(index, theirs.lo, theirs.hi));
+			}
+		}
+		appendFrames(reply.frames, 'F', frame.conversation, ranges);
+	} else if (frame.kind == 'I') {
+		size_t bar = frame.body.find('|');
+		if (bar == std::string::npos) {
+			throw std::invalid_argument("malformed sync listing");
+		}
+		auto bounds =
+			splitFields(std::string_view(frame.body).substr(0, bar), 2);
+		std::int64_t lo = parseTime(bounds[0]);
+		std::int64_t hi = parseTime(bounds[1]);
+
+		std::set<std::pair<std::int64_t, MessageId>> listed;
+		std::vector<std::string> wanted;
+		for (const auto &text :
+			 splitItems(std::string_view(frame.body).substr(bar + 1))) {
+			auto entry = parseEntry(text);
+			if (entry.time < lo || entry.time >= hi) {
+				throw std::invalid_argument("sync listing out of range");
+			}
+			listed.insert({entry.time, entry.id});
+			if (!index.contains(entry)) {
+				wanted.push_back(text);
+			}
+		}
+		for (const auto &entry : index.range(lo, hi)) {
+			if (!listed.count({entry.time, entry.id})) {
+				reply.missing.push_back(entry);
+			}
+		}
+		appendFrames(reply.frames, 'W', frame.conversation, wanted);
+	} else if (frame.kind == 'W') {
+		for (const auto &text : splitItems(frame.body)) {
+			auto entry = parseEntry(text);
+			if (index.contains(entry)) {
+				reply.missing.push_back(entry);
+			}
+		}
+	} else {
+		throw std::invalid_argument("unexpected sync frame");
+	}
+	return reply;
+}
+
+std::vector<std::string>
+messageSyncFrames(const std::string &conversation,
+				  const std::vector<Message> &msgs) {
+	std::vector<std::string> frames;
+	SyncFrame frame{'M', conversation, ""};
+	for (const auto &msg : msgs) {
+		std::string encoded = msg.serialize();
+		if (!frame.body.empty() &&
+			frame.body.size() + encoded.size() > MAX_MESSAGE_BYTES_PER_FRAME) {
+			frames.push_back(frame.serialize());
+			frame.body.clear();
+		}
+		frame.body += std::to_string(encoded.size()) + ":" + encoded;
+	}
+	if (!frame.body.empty()) {
+		frames.push_back(frame.serialize());
+	}
+	return frames;
+}
+
+std::vector<Message> parseMessageSync(const SyncFrame &frame) {
+	std::vector<Message> msgs;
+	std::string_view body = frame.body;
+	while (!body.empty()) {
+		size_t colon = body.find(':');
+		if (colon == std::string_view::npos) {
+			throw std::invalid_argument("missing length in sync frame");
+		}
+		std::int64_t length = 0;
+		WireInt::decode(body.substr(0, colon), length);
+		body.remove_prefix(colon + 1);
+		if (length <= 0 || static_cast<std::uint64_t>(length) > body.size()) {
+			throw std::invalid_argument("bad length in sync frame");
+		}
+		size_t size = static_cast<size_t>(length);
+		msgs.push_back(Message::deserialize(std::string(body.substr(0, size))));
+		body.remove_prefix(size);
+	}
+	return msgs;
+}
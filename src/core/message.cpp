@@ -1,51 +1,34 @@
 #include "core/message.hpp"
 #include <chrono>
 #include <ctime>
-#include <sstream>
 #include <string>
 
 Message::Message(const std::string &sender, const std::string &content)
 	: sender(sender), content(content),
-	  timestamp(std::chrono::system_clock::now()) {}
+	  // kept at the precision it travels with, so our copy and the peer's
+	  // are the same message
+	  timestamp(std::chrono::time_point_cast<std::chrono::milliseconds>(
+		  std::chrono::system_clock::now())) {}
 
 std::string Message::serialize() const {
-	// convert timestamp to str
-	auto since_epoch = timestamp.time_since_epoch();
-	auto ms_since_epoch =
-		std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch);
-	long long timestamp_value = ms_since_epoch.count();
-
-	// build string to send
-	std::ostringstream oss;
-	oss << sender << "|" << timestamp_value << "|" << content;
-	return oss.str();
+	std::string out;
+	serialize(out);
+	return out;
 }
 
-Message Message::deserialize(const std::string &data) {
-	// extract sender
-	size_t first_pipe = data.find("|");
-	std::string sender_str = data.substr(0, first_pipe);
-
-	// extract timestamp
-	size_t second_pipe = data.find("|", first_pipe + 1);
-	std::string timestamp_str =
-		data.substr(first_pipe + 1, second_pipe - first_pipe - 1);
-
-	// extract
-	std::string content_str = data.substr(second_pipe + 1);
-
-	// convert timestamp back
-	long long timestamp_value = std::stoll(timestamp_str);
-	auto ms_since_epoch = std::chrono::milliseconds(timestamp_value);
-	auto timepoint = std::chrono::system_clock::time_point(ms_since_epoch);
-
-	// build message
-	Message msg;
-	msg.sender = sender_str;
-	msg.timestamp = timepoint;
-	msg.content = content_str;
+void Message::serialize(std::string &out) const {
+	if (isGroupMessage()) {
+		encodeFrame<GroupMessageFrame>(out, *this);
+	} else {
+		encodeFrame<DirectMessageFrame>(out, *this);
+	}
+}
 
-	return msg;
+Message Message::deserialize(const std::string &packet) {
+	if (packet.rfind("G|", 0) == 0) {
+		return decodeFrame<GroupMessageFrame>(packet);
+	}
+	return decodeFrame<DirectMessageFrame>(packet);
 }
 
 // format time to HH:MM:SS
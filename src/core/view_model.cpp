@@ -0,0 +1,132 @@
+#include "core/view_model.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+void MessageLog::push_back(const Message &msg) {
+	if (size_ % CHUNK_SIZE == 0) {
+		chunks_.push_back(std::make_shared<std::vector<Message>>());
+		chunks_.back()->reserve(CHUNK_SIZE);
+	} else if (chunks_.back().use_count() > 1) {
+		// the partial chunk is shared with a snapshot, copy on write. copies
+		// are only made under the owner's lock, so a stale count can only
+		// cause an extra copy
+		auto copy = std::make_shared<std::vector<Message>>(*chunks_.back());
+		copy->reserve(CHUNK_SIZE);
+		chunks_.back() = copy;
+	}
+	chunks_.back()->push_back(msg);
+	++size_;
+}
+
+void MessageLog::insert(const Message &msg) {
+	if (size_ == 0 || !(msg.timestamp < (*this)[size_ - 1].timestamp)) {
+		push_back(msg);
+		return;
+	}
+	// after every message sent at the same time, so arrival order holds
+	size_t position = lowerBound(msg.timestamp + std::chrono::nanoseconds(1));
+
+	// snapshots may share the chunks past the position, they are rebuilt
+	// rather than changed
+	size_t first_chunk = position / CHUNK_SIZE;
+	std::vector<Message> tail;
+	tail.reserve(size_ - first_chunk * CHUNK_SIZE + 1);
+	for (size_t i = first_chunk * CHUNK_SIZE; i < size_; ++i) {
+		if (i == position) {
+			tail.push_back(msg);
+		}
+		tail.push_back((*this)[i]);
+	}
+	chunks_.resize(first_chunk);
+	size_ = first_chunk * CHUNK_SIZE;
+	for (const auto &message : tail) {
+		push_back(message);
+	}
+	++reorders_;
+}
+
+void MessageLog::insertAll(const std::vector<Message> &msgs) {
+	if (msgs.empty()) {
+		return;
+	}
+	if (size_ == 0 ||
+		!(msgs.front().timestamp < (*this)[size_ - 1].timestamp)) {
+		for (const auto &msg : msgs) {
+			push_back(msg);
+		}
+		return;
+	}
+	// merged after the messages we hold from the same time, as insert does
+	size_t position =
+		lowerBound(msgs.front().timestamp + std::chrono::nanoseconds(1));
+	size_t first_chunk = position / CHUNK_SIZE;
+	std::vector<Message> held;
+	held.reserve(size_ - first_chunk * CHUNK_SIZE);
+	for (size_t i = first_chunk * CHUNK_SIZE; i < size_; ++i) {
+		held.push_back((*this)[i]);
+	}
+	std::vector<Message> tail;
+	tail.reserve(held.size() + msgs.size());
+	std::merge(held.begin(), held.end(), msgs.begin(), msgs.end(),
+			   std::back_inserter(tail), [](const Message &a, const Message &b) {
+				   return a.timestamp < b.timestamp;
+			   });
+	chunks_.resize(first_chunk);
+	size_ = first_chunk * CHUNK_SIZE;
+	for (const auto &message : tail) {
+		push_back(message);
+	}
+	++reorders_;
+}
+
+size_t
+MessageLog::lowerBound(std::chrono::system_clock::time_point time) const {
+	size_t low = 0;
+	size_t high = size_;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if ((*this)[middle].timestamp < time) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+const Message &MessageLog::operator[](size_t index) const {
+	return (*chunks_[index / CHUNK_SIZE])[index % CHUNK_SIZE];
+}
+
+const MessageLog &ViewModel::getHistory(std::shared_ptr<Peer> peer) const {
+	auto history = histories.find(peer);
+	if (history == histories.end()) {
+		static const MessageLog empty_history;
+		return empty_history;
+	}
+	return history->second;
+}
+
+const MessageLog &
+ViewModel::getGroupHistory(const std::string &group_id) const {
+	auto history = group_histories.find(group_id);
+	if (history == group_histories.end()) {
+		static const MessageLog empty_history;
+		return empty_history;
+	}
+	return history->second;
+}
+
+const GroupView *ViewModel::findGroup(const std::string &group_id) const {
+	for (const auto &group : groups) {
+		if (group.id == group_id) {
+			return &group;
+		}
+	}
+	return nullptr;
+}
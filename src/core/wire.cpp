@@ -0,0 +1,182 @@
+#include "core/wire.hpp"
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// the whole of text has to be the number
+template <typename T> static T parseNumber(std::string_view text) {
+	T value = 0;
+	auto result =
+		std::from_chars(text.data(), text.data() + text.size(), value);
+	if (text.empty() || result.ec != std::errc() ||
+		result.ptr != text.data() + text.size()) {
+		throw std::invalid_argument("bad number in frame");
+	}
+	return value;
+}
+
+static void checkSeparators(std::string_view value, bool last,
+							std::string_view separators) {
+	if (!last && value.find_first_of(separators) != std::string_view::npos) {
+		throw std::invalid_argument("field holds a separator");
+	}
+}
+
+bool isWireName(std::string_view name) {
+	return !name.empty() && name.find_first_of("|,") == std::string_view::npos;
+}
+
+bool isWireMillis(std::int64_t millis) {
+	using std::chrono::duration_cast;
+	using std::chrono::milliseconds;
+	using std::chrono::system_clock;
+	return millis >= duration_cast<milliseconds>(
+						 system_clock::duration::min()).count() &&
+		   millis <= duration_cast<milliseconds>(
+						 system_clock::duration::max()).count();
+}
+
+WireReader::WireReader(std::string_view frame, char kind)
+	: frame_(frame), pos_(2) {
+	if (frame.size() < 2 || frame[0] != kind || frame[1] != '|') {
+		throw std::invalid_argument("not a frame of this kind");
+	}
+}
+
+std::string_view WireReader::next(bool last) {
+	if (pos_ > frame_.size()) {
+		throw std::invalid_argument("truncated frame");
+	}
+	if (last) {
+		auto field = frame_.substr(pos_);
+		pos_ = frame_.size() + 1;
+		return field;
+	}
+	size_t pipe = frame_.find('|', pos_);
+	if (pipe == std::string_view::npos) {
+		throw std::invalid_argument("truncated frame");
+	}
+	auto field = frame_.substr(pos_, pipe - pos_);
+	pos_ = pipe + 1;
+	return field;
+}
+
+void WireText::encode(std::string &out, const std::string &value, bool last) {
+	checkSeparators(value, last, "|");
+	out += value;
+}
+
+void WireText::decode(std::string_view text, std::string &value) {
+	value.assign(text.data(), text.size());
+}
+
+void WireLetter::encode(std::string &out, char value, bool last) {
+	checkSeparators(std::string_view(&value, 1), last, "|");
+	out += value;
+}
+
+void WireLetter::decode(std::string_view text, char &value) {
+	if (text.size() != 1) {
+		throw std::invalid_argument("bad letter in frame");
+	}
+	value = text[0];
+}
+
+void WireInt::encode(std::string &out, int value, bool) {
+	out += std::to_string(value);
+}
+
+void WireInt::decode(std::string_view text, int &value) {
+	value = parseNumber<int>(text);
+}
+
+void WireInt::encode(std::string &out, std::int64_t value, bool) {
+	out += std::to_string(value);
+}
+
+void WireInt::decode(std::string_view text, std::int64_t &value) {
+	value = parseNumber<std::int64_t>(text);
+}
+
+void WireMillis::encode(std::string &out,
+						std::chrono::system_clock::time_point value, bool) {
+	out += std::to_string(
+		std::chrono::duration_cast<std::chrono::milliseconds>(
+			value.time_since_epoch())
+			.count());
+}
+
+void WireMillis::decode(std::string_view text,
+						std::chrono::system_clock::time_point &value) {
+	auto millis = parseNumber<std::int64_t>(text);
+	if (!isWireMillis(millis)) {
+		throw std::invalid_argument("time out of range in frame");
+	}
+	value = std::chrono::system_clock::time_point(
+		std::chrono::milliseconds(millis));
+}
+
+void WireHex::encode(std::string &out, const std::string &value, bool) {
+	static const char digits[] = "0123456789abcdef";
+	out.reserve(out.size() + value.size() * 2);
+	for (unsigned char c : value) {
+		out += digits[c >> 4];
+		out += digits[c & 0x0f];
+	}
+}
+
+static int hexDigit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	throw std::invalid_argument("bad hex in frame");
+}
+
+void WireHex::decode(std::string_view text, std::string &value) {
+	if (text.size() % 2 != 0) {
+		throw std::invalid_argument("odd length hex");
+	}
+	value.clear();
+	value.reserve(text.size() / 2);
+	for (size_t i = 0; i < text.size(); i += 2) {
+		value += static_cast<char>(hexDigit(text[i]) << 4 |
+								   hexDigit(text[i + 1]));
+	}
+}
+
+void WireList::encode(std::string &out, const std::vector<std::string> &value,
+					  bool last) {
+	for (size_t i = 0; i < value.size(); ++i) {
+		// the last field may hold pipes, but commas always split it
+		checkSeparators(value[i], false, last ? "," : ",|");
+		out += (i ? "," : "");
+		out += value[i];
+	}
+}
+
+void WireList::decode(std::string_view text, std::vector<std::string> &value) {
+	value.clear();
+	if (text.empty()) {
+		return;
+	}
+	size_t start = 0;
+	while (true) {
+		size_t comma = text.find(',', start);
+		value.emplace_back(text.substr(start, comma - start));
+		if (comma == std::string_view::npos) {
+			return;
+		}
+		start = comma + 1;
+	}
+}
@@ -0,0 +1,405 @@
+#include "crypto/crypto.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/pem.h>
+#include <stdexcept>
+#include <vector>
+
+constexpr const char *HKDF_INFO = "p2p_chat session keys";
+
+static EVP_PKEY *generateKey(int type) {
+	EVP_PKEY *key = nullptr;
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(type, nullptr);
+	if (!ctx || EVP_PKEY_keygen_init(ctx) <= 0 ||
+		EVP_PKEY_keygen(ctx, &key) <= 0) {
+		EVP_PKEY_CTX_free(ctx);
+		throw std::runtime_error("failed to generate key");
+	}
+	EVP_PKEY_CTX_free(ctx);
+	return key;
+}
+
+// null if there is no file to read, throws if it doesn't hold a key of
+// this type
+static EVP_PKEY *readKey(const std::string &path, int type) {
+	std::FILE *file = std::fopen(path.c_str(), "r");
+	if (!file) {
+		return nullptr;
+	}
+	EVP_PKEY *key = PEM_read_PrivateKey(file, nullptr, nullptr, nullptr);
+	std::fclose(file);
+	if (!key || EVP_PKEY_id(key) != type) {
+		EVP_PKEY_free(key);
+		throw std::runtime_error("key at " + path + " is invalid");
+	}
+	return key;
+}
+
+EVP_PKEY *loadOrCreateKey(const std::string &path, int type) {
+	if (EVP_PKEY *key = readKey(path, type)) {
+		return key;
+	}
+
+	// first run, create the key. the file is owner only from the moment it
+	// exists, and one that appeared meanwhile is never written over
+	EVP_PKEY *key = generateKey(type);
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		// another process created it first, use theirs
+		EVP_PKEY_free(key);
+		if (EVP_PKEY *existing = readKey(path, type)) {
+			return existing;
+		}
+		throw std::runtime_error("key at " + path + " can't be read");
+	}
+	std::FILE *file = fd < 0 ? nullptr : ::fdopen(fd, "w");
+	if (!file) {
+		if (fd >= 0) {
+			::close(fd);
+			::unlink(path.c_str());
+		}
+		// keep going with a key for this run only
+		return key;
+	}
+	bool written =
+		PEM_write_PrivateKey(file, key, nullptr, nullptr, 0, nullptr, nullptr) > 0;
+	if (std::fclose(file) != 0 || !written) {
+		// a partial key would be refused on the next run
+		::unlink(path.c_str());
+	}
+	return key;
+}
+
+KeyExchange::KeyExchange() : key_(generateKey(EVP_PKEY_X25519)) {}
+
+KeyExchange::KeyExchange(const std::string &path)
+	: key_(loadOrCreateKey(path, EVP_PKEY_X25519)) {}
+
+KeyExchange::~KeyExchange() { EVP_PKEY_free(key_); }
+
+PublicKey KeyExchange::getPublicKey() const {
+	PublicKey public_key;
+	size_t len = public_key.size();
+	if (EVP_PKEY_get_raw_public_key(key_, public_key.data(), &len) <= 0) {
+		throw std::runtime_error("failed to read X25519 public key");
+	}
+	return public_key;
+}
+
+SymmetricKey KeyExchange::deriveSharedSecret(const PublicKey &peer_key) const {
+	EVP_PKEY *peer = EVP_PKEY_new_raw_public_key(
+		EVP_PKEY_X25519, nullptr, peer_key.data(), peer_key.size());
+	if (!peer) {
+		throw std::runtime_error("invalid X25519 public key");
+	}
+
+	SymmetricKey secret;
+	size_t secret_len = secret.size();
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key_, nullptr);
+	bool ok = ctx && EVP_PKEY_derive_init(ctx) > 0 &&
+			  EVP_PKEY_derive_set_peer(ctx, peer) > 0 &&
+			  EVP_PKEY_derive(ctx, secret.data(), &secret_len) > 0;
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(peer);
+	if (!ok) {
+		throw std::runtime_error("X25519 key agreement failed");
+	}
+	return secret;
+}
+
+SessionKeys expandSessionKeys(const SymmetricKey &secret,
+							  const std::uint8_t *salt, size_t salt_len,
+							  bool initiator) {
+	// dialer->acceptor key and nonce, acceptor->dialer key and nonce, then
+	// the resumption secret and ticket id
+	constexpr size_t direction_len = AEAD_KEY_SIZE + AEAD_NONCE_SIZE;
+	std::uint8_t okm[2 * direction_len + AEAD_KEY_SIZE + sizeof(TicketId)];
+	size_t okm_len = sizeof(okm);
+	EVP_PKEY_CTX *hkdf = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+	bool ok = hkdf && EVP_PKEY_derive_init(hkdf) > 0 &&
+			  EVP_PKEY_CTX_set_hkdf_md(hkdf, EVP_sha256()) > 0 &&
+			  EVP_PKEY_CTX_set1_hkdf_salt(hkdf, salt,
+										  static_cast<int>(salt_len)) > 0 &&
+			  EVP_PKEY_CTX_set1_hkdf_key(hkdf, secret.data(),
+										 static_cast<int>(secret.size())) > 0 &&
+			  EVP_PKEY_CTX_add1_hkdf_info(
+				  hkdf, reinterpret_cast<const unsigned char *>(HKDF_INFO),
+				  static_cast<int>(std::strlen(HKDF_INFO))) > 0 &&
+			  EVP_PKEY_derive(hkdf, okm, &okm_len) > 0;
+	EVP_PKEY_CTX_free(hkdf);
+	if (!ok) {
+		throw std::runtime_error("HKDF failed");
+	}
+
+	const std::uint8_t *dialer = okm;
+	const std::uint8_t *acceptor = okm + direction_len;
+	const std::uint8_t *send = initiator ? dialer : acceptor;
+	const std::uint8_t *receive = initiator ? acceptor : dialer;
+	const std::uint8_t *resumption = okm + 2 * direction_len;
+
+	SessionKeys keys;
+	std::memcpy(keys.send_key.data(), send, AEAD_KEY_SIZE);
+	std::memcpy(keys.send_nonce.data(), send + AEAD_KEY_SIZE, AEAD_NONCE_SIZE);
+	std::memcpy(keys.receive_key.data(), receive, AEAD_KEY_SIZE);
+	std::memcpy(keys.receive_nonce.data(), receive + AEAD_KEY_SIZE,
+				AEAD_NONCE_SIZE);
+	std::memcpy(keys.resumption_secret.data(), resumption, AEAD_KEY_SIZE);
+	std::memcpy(keys.ticket.data(), resumption + AEAD_KEY_SIZE,
+				keys.ticket.size());
+	OPENSSL_cleanse(okm, sizeof(okm));
+	return keys;
+}
+
+static const EVP_CIPHER *cipherFor(CipherSuite suite) {
+	switch (suite) {
+	case CipherSuite::Aes256Gcm:
+		return EVP_aes_256_gcm();
+	case CipherSuite::ChaCha20Poly1305:
+	default:
+		return EVP_chacha20_poly1305();
+	}
+}
+
+FrameCipher::FrameCipher(CipherSuite suite, const SymmetricKey &key,
+						 const Nonce &nonce, bool encrypt)
+	: ctx_(EVP_CIPHER_CTX_new()), base_nonce_(nonce) {
+	// key schedule runs once here, frames only swap the nonce. both suites
+	// default to a 12 byte nonce and 16 byte tag
+	if (!ctx_ || EVP_CipherInit_ex(ctx_, cipherFor(suite), nullptr, key.data(),
+								   nonce.data(), encrypt) <= 0) {
+		EVP_CIPHER_CTX_free(ctx_);
+		throw std::runtime_error("failed to set up frame cipher");
+	}
+}
+
+FrameCipher::~FrameCipher() { EVP_CIPHER_CTX_free(ctx_); }
+
+Nonce FrameCipher::nextNonce() {
+	Nonce nonce = base_nonce_;
+	std::uint64_t counter = counter_++;
+	for (size_t i = 0; i < 8; ++i) {
+		nonce[AEAD_NONCE_SIZE - 1 - i] ^=
+			static_cast<std::uint8_t>(counter >> (8 * i));
+	}
+	return nonce;
+}
+
+void FrameCipher::seal(const std::uint8_t *in, std::uint8_t *out, size_t len,
+					   std::uint8_t *tag) {
+	Nonce nonce = nextNonce();
+	int out_len = 0;
+	if (EVP_CipherInit_ex(ctx_, nullptr, nullptr, nullptr, nonce.data(), 1) <=
+			0 ||
+		EVP_CipherUpdate(ctx_, out, &out_len, in, static_cast<int>(len)) <= 0 ||
+		EVP_CipherFinal_ex(ctx_, out + out_len, &out_len) <= 0 ||
+		EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_SIZE, tag) <=
+			0) {
+		throw std::runtime_error("frame encryption failed");
+	}
+}
+
+bool FrameCipher::open(std::uint8_t *data, size_t len, const std::uint8_t *tag) {
+	Nonce nonce = nextNonce();
+	int out_len = 0;
+	if (EVP_CipherInit_ex(ctx_, nullptr, nullptr, nullptr, nonce.data(), 0) <=
+			0 ||
+		EVP_CipherUpdate(ctx_, data, &out_len, data, static_cast<int>(len)) <=
+			0 ||
+		EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_SIZE,
+							const_cast<std::uint8_t *>(tag)) <= 0) {
+		return false;
+	}
+	return EVP_CipherFinal_ex(ctx_, data + out_len, &out_len) > 0;
+}
+
+// sealed layout: ephemeral public key, ciphertext, tag. both ends use the
+// "dialer" direction of the expanded keys
+std::string sealToKey(const PublicKey &recipient, const std::string &plaintext) {
+	KeyExchange ephemeral;
+	PublicKey ephemeral_key = ephemeral.getPublicKey();
+	std::uint8_t salt[2 * sizeof(PublicKey)];
+	std::memcpy(salt, ephemeral_key.data(), sizeof(PublicKey));
+	std::memcpy(salt + sizeof(PublicKey), recipient.data(), sizeof(PublicKey));
+	SessionKeys keys = expandSessionKeys(
+		ephemeral.deriveSharedSecret(recipient), salt, sizeof(salt), true);
+
+	std::string sealed(sizeof(PublicKey) + plaintext.size() + AEAD_TAG_SIZE,
+					   '\0');
+	auto *out = reinterpret_cast<std::uint8_t *>(&sealed[0]);
+	std::memcpy(out, ephemeral_key.data(), sizeof(PublicKey));
+	FrameCipher cipher(CipherSuite::ChaCha20Poly1305, keys.send_key,
+					   keys.send_nonce, true);
+	cipher.seal(reinterpret_cast<const std::uint8_t *>(plaintext.data()),
+				out + sizeof(PublicKey), plaintext.size(),
+				out + sizeof(PublicKey) + plaintext.size());
+	OPENSSL_cleanse(&keys, sizeof(keys));
+	return sealed;
+}
+
+bool openSealed(const KeyExchange &own_key, const std::string &sealed,
+				std::string &plaintext) {
+	if (sealed.size() < sizeof(PublicKey) + AEAD_TAG_SIZE) {
+		return false;
+	}
+	PublicKey ephemeral_key;
+	std::memcpy(ephemeral_key.data(), sealed.data(), sizeof(PublicKey));
+	PublicKey recipient = own_key.getPublicKey();
+	std::uint8_t salt[2 * sizeof(PublicKey)];
+	std::memcpy(salt, ephemeral_key.data(), sizeof(PublicKey));
+	std::memcpy(salt + sizeof(PublicKey), recipient.data(), sizeof(PublicKey));
+
+	SessionKeys keys;
+	try {
+		keys = expandSessionKeys(own_key.deriveSharedSecret(ephemeral_key),
+								 salt, sizeof(salt), true);
+	} catch (const std::exception &e) {
+		return false;
+	}
+
+	size_t len = sealed.size() - sizeof(PublicKey) - AEAD_TAG_SIZE;
+	plaintext.assign(sealed, sizeof(PublicKey), len);
+	auto *data = reinterpret_cast<std::uint8_t *>(&plaintext[0]);
+	FrameCipher cipher(CipherSuite::ChaCha20Poly1305, keys.send_key,
+					   keys.send_nonce, false);
+	OPENSSL_cleanse(&keys, sizeof(keys));
+	return cipher.open(data, len,
+					   reinterpret_cast<const std::uint8_t *>(sealed.data()) +
+						   sizeof(PublicKey) + len);
+}
+
+const char *cipherSuiteName(CipherSuite suite) {
+	switch (suite) {
+	case CipherSuite::Aes256Gcm:
+		return "aes-256-gcm";
+	case CipherSuite::ChaCha20Poly1305:
+	default:
+		return "chacha20-poly1305";
+	}
+}
+
+double measureCipherThroughput(CipherSuite suite, size_t frame_size,
+							   std::chrono::milliseconds duration) {
+	SymmetricKey key{};
+	Nonce nonce{};
+	FrameCipher cipher(suite, key, nonce, true);
+	std::vector<std::uint8_t> frame(frame_size);
+	std::uint8_t tag[AEAD_TAG_SIZE];
+
+	// check the clock every batch so timing doesn't dominate small frames
+	constexpr int batch = 64;
+	size_t bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed = std::chrono::steady_clock::duration::zero();
+	while (elapsed < duration) {
+		for (int i = 0; i < batch; ++i) {
+			cipher.seal(frame.data(), frame.data(), frame.size(), tag);
+		}
+		bytes += batch * frame_size;
+		elapsed = std::chrono::steady_clock::now() - start;
+	}
+	return bytes / std::chrono::duration<double>(elapsed).count();
+}
+
+CipherScores benchmarkCipherSuites() {
+	// chat frames are small, so measure at a typical frame size
+	constexpr size_t probe_frame_size = 1024;
+	constexpr std::chrono::milliseconds probe_duration(10);
+
+	CipherScores scores{};
+	for (size_t i = 0; i < CIPHER_SUITE_COUNT; ++i) {
+		double bytes_per_second = measureCipherThroughput(
+			static_cast<CipherSuite>(i), probe_frame_size, probe_duration);
+		scores[i] = static_cast<std::uint32_t>(bytes_per_second / 1e6);
+	}
+	return scores;
+}
+
+CipherSuite negotiateCipherSuite(const CipherScores &own,
+								 const CipherScores &peer) {
+	size_t best = 0;
+	std::uint32_t best_score = 0;
+	for (size_t i = 0; i < CIPHER_SUITE_COUNT; ++i) {
+		std::uint32_t pair_score = std::min(own[i], peer[i]);
+		if (pair_score > best_score) {
+			best = i;
+			best_score = pair_score;
+		}
+	}
+	return static_cast<CipherSuite>(best);
+}
+
+std::string encodeCipherScores(const CipherScores &scores) {
+	std::string text;
+	for (size_t i = 0; i < CIPHER_SUITE_COUNT; ++i) {
+		if (!text.empty()) {
+			text += ",";
+		}
+		text += cipherSuiteName(static_cast<CipherSuite>(i));
+		text += ":" + std::to_string(scores[i]);
+	}
+	return text;
+}
+
+// suites we don't know are skipped, suites the peer didn't list score 0
+CipherScores parseCipherScores(const std::string &text) {
+	CipherScores scores{};
+	size_t start = 0;
+	while (start < text.size()) {
+		size_t comma = text.find(',', start);
+		std::string entry = text.substr(start, comma - start);
+		size_t colon = entry.find(':');
+		if (colon != std::string::npos) {
+			std::string name = entry.substr(0, colon);
+			for (size_t i = 0; i < CIPHER_SUITE_COUNT; ++i) {
+				if (name == cipherSuiteName(static_cast<CipherSuite>(i))) {
+					scores[i] = static_cast<std::uint32_t>(
+						std::strtoul(entry.c_str() + colon + 1, nullptr, 10));
+				}
+			}
+		}
+		if (comma == std::string::npos) {
+			break;
+		}
+		start = comma + 1;
+	}
+	return scores;
+}
+
+std::string toHex(const std::uint8_t *data, size_t len) {
+	static const char digits[] = "0123456789abcdef";
+	std::string hex(len * 2, '0');
+	for (size_t i = 0; i < len; ++i) {
+		hex[2 * i] = digits[data[i] >> 4];
+		hex[2 * i + 1] = digits[data[i] & 0x0f];
+	}
+	return hex;
+}
+
+bool fromHex(const std::string &hex, std::uint8_t *out, size_t len) {
+	if (hex.size() != len * 2) {
+		return false;
+	}
+	auto nibble = [](char c) -> int {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	};
+	for (size_t i = 0; i < len; ++i) {
+		int high = nibble(hex[2 * i]);
+		int low = nibble(hex[2 * i + 1]);
+		if (high < 0 || low < 0) {
+			return false;
+		}
+		out[i] = static_cast<std::uint8_t>((high << 4) | low);
+	}
+	return true;
+}
@@ -0,0 +1,209 @@
+#include "crypto/identity.hpp"
+#include <cstring>
+#include <fstream>
+#include <openssl/evp.h>
+#include <sstream>
+#include <stdexcept>
+
+constexpr const char *HANDSHAKE_SIGNATURE_LABEL = "p2p_chat handshake key";
+
+Identity::Identity(const std::string &path)
+	: key_(loadOrCreateKey(path, EVP_PKEY_ED25519)) {}
+
+Identity::~Identity() { EVP_PKEY_free(key_); }
+
+PublicKey Identity::getPublicKey() const {
+	PublicKey public_key;
+	size_t len = public_key.size();
+	if (EVP_PKEY_get_raw_public_key(key_, public_key.data(), &len) <= 0) {
+		throw std::runtime_error("failed to read identity public key");
+	}
+	return public_key;
+}
+
+Signature Identity::sign(const std::uint8_t *data, size_t len) const {
+	Signature signature;
+	size_t signature_len = signature.size();
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	bool ok = ctx &&
+			  EVP_DigestSignInit(ctx, nullptr, nullptr, nullptr, key_) > 0 &&
+			  EVP_DigestSign(ctx, signature.data(), &signature_len, data, len) > 0;
+	EVP_MD_CTX_free(ctx);
+	if (!ok) {
+		throw std::runtime_error("signing failed");
+	}
+	return signature;
+}
+
+SignatureCache::SignatureCache(size_t capacity) : capacity_(capacity) {}
+
+bool SignatureCache::verify(const PublicKey &key, const std::uint8_t *data,
+							size_t len, const Signature &signature) {
+	// the cache key covers everything the verify depends on
+	Digest digest;
+	EVP_MD_CTX *md = EVP_MD_CTX_new();
+	bool hashed = md && EVP_DigestInit_ex(md, EVP_sha256(), nullptr) > 0 &&
+				  EVP_DigestUpdate(md, key.data(), key.size()) > 0 &&
+				  EVP_DigestUpdate(md, data, len) > 0 &&
+				  EVP_DigestUpdate(md, signature.data(), signature.size()) > 0 &&
+				  EVP_DigestFinal_ex(md, digest.data(), nullptr) > 0;
+	EVP_MD_CTX_free(md);
+	if (!hashed) {
+		return false;
+	}
+
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		if (verified_.count(digest)) {
+			return true;
+		}
+	}
+
+	EVP_PKEY *public_key = EVP_PKEY_new_raw_public_key(
+		EVP_PKEY_ED25519, nullptr, key.data(), key.size());
+	if (!public_key) {
+		return false;
+	}
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	bool ok =
+		ctx &&
+		EVP_DigestVerifyInit(ctx, nullptr, nullptr, nullptr, public_key) > 0 &&
+		EVP_DigestVerify(ctx, signature.data(), signature.size(), data, len) ==
+			1;
+	EVP_MD_CTX_free(ctx);
+	EVP_PKEY_free(public_key);
+	if (!ok) {
+		return false;
+	}
+
+	const std::lock_guard<std::mutex> lock(mutex_);
+	if (verified_.insert(digest).second) {
+		order_.push_back(digest);
+		if (order_.size() > capacity_) {
+			verified_.erase(order_.front());
+			order_.pop_front();
+		}
+	}
+	return true;
+}
+
+TrustStore::TrustStore(const std::string &path) : path_(path) {
+	// "hostname identity [envelope key]" per line, keys in hex
+	std::ifstream file(path_);
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		std::string name;
+		std::string identity_hex;
+		std::string envelope_hex;
+		fields >> name >> identity_hex >> envelope_hex;
+
+		Pin pin;
+		if (!fromHex(identity_hex, pin.identity.data(), pin.identity.size())) {
+			continue;
+		}
+		pin.has_envelope_key = fromHex(envelope_hex, pin.envelope_key.data(),
+									   pin.envelope_key.size());
+		pins_[name] = pin;
+	}
+}
+
+void TrustStore::save() const {
+	std::ofstream file(path_, std::ios::trunc);
+	for (const auto &[name, pin] : pins_) {
+		file << name << " " << toHex(pin.identity.data(), pin.identity.size());
+		if (pin.has_envelope_key) {
+			file << " "
+				 << toHex(pin.envelope_key.data(), pin.envelope_key.size());
+		}
+		file << "\n";
+	}
+}
+
+bool TrustStore::checkAndPin(const std::string &name, const PublicKey &key) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	auto it = pins_.find(name);
+	if (it != pins_.end()) {
+		return it->second.identity == key;
+	}
+	pins_[name].identity = key;
+	save();
+	return true;
+}
+
+bool TrustStore::getPin(const std::string &name, PublicKey &key) const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	auto it = pins_.find(name);
+	if (it == pins_.end()) {
+		return false;
+	}
+	key = it->second.identity;
+	return true;
+}
+
+void TrustStore::setEnvelopeKey(const std::string &name, const PublicKey &key) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	auto it = pins_.find(name);
+	if (it == pins_.end() ||
+		(it->second.has_envelope_key && it->second.envelope_key == key)) {
+		return;
+	}
+	it->second.has_envelope_key = true;
+	it->second.envelope_key = key;
+	save();
+}
+
+bool TrustStore::getEnvelopeKey(const std::string &name, PublicKey &key) const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	auto it = pins_.find(name);
+	if (it == pins_.end() || !it->second.has_envelope_key) {
+		return false;
+	}
+	key = it->second.envelope_key;
+	return true;
+}
+
+void SessionCache::store(const PublicKey &identity, const TicketId &ticket,
+						 const SymmetricKey &secret) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	sessions_[identity] = {ticket, secret};
+}
+
+bool SessionCache::find(const PublicKey &identity, TicketId &ticket,
+						SymmetricKey &secret) const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	auto it = sessions_.find(identity);
+	if (it == sessions_.end()) {
+		return false;
+	}
+	ticket = it->second.ticket;
+	secret = it->second.secret;
+	return true;
+}
+
+SecurityContext::SecurityContext(std::uint64_t node_id,
+								 const std::string &data_dir)
+	: node_id(node_id), identity(data_dir + "/identity.pem"),
+	  envelope_key(data_dir + "/envelope.pem"), cipher_scores(benchmarkCipherSuites()),
+	  trust_store(data_dir + "/known_peers") {
+	std::string signed_data =
+		handshakeSignedData(node_id, handshake_key.getPublicKey(),
+							envelope_key.getPublicKey());
+	handshake_signature = identity.sign(
+		reinterpret_cast<const std::uint8_t *>(signed_data.data()),
+		signed_data.size());
+}
+
+std::string handshakeSignedData(std::uint64_t node_id,
+								const PublicKey &handshake_key,
+								const PublicKey &envelope_key) {
+	std::string data = HANDSHAKE_SIGNATURE_LABEL;
+	for (int i = 7; i >= 0; --i) {
+		data += static_cast<char>(node_id >> (8 * i));
+	}
+	data.append(reinterpret_cast<const char *>(handshake_key.data()),
+				handshake_key.size());
+	data.append(reinterpret_cast<const char *>(envelope_key.data()),
+				envelope_key.size());
+	return data;
+}
@@ -1,16 +1,35 @@
 #include "core/app.hpp"
+#include "core/config.hpp"
 #include "ui/chat_window.hpp"
 #include "ui/peer_list.hpp"
 #include <atomic>
 #include <boost/asio.hpp>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <ftxui/component/component.hpp>
 #include <ftxui/component/screen_interactive.hpp>
+#include <stdexcept>
+#include <string>
 #include <thread>
 
-int main() {
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == "--help") {
+			std::printf("%s", Config::usage());
+			return 0;
+		}
+	}
+	Config config;
+	try {
+		config = Config::fromArgs(argc, argv);
+	} catch (const std::invalid_argument &e) {
+		std::fprintf(stderr, "%s\n%s", e.what(), Config::usage());
+		return 1;
+	}
+
 	boost::asio::io_context io_context;
-	App app(io_context);
+	App app(io_context, config);
 
 	// start the discovery service and get the initial list of peers
 	app.performInitialDiscovery();
@@ -30,33 +49,22 @@ int main() {
 
 	std::thread poller([&app, &running, &screen] {
 		auto last_peer_refresh = std::chrono::steady_clock::now();
-		std::string last_status_message;
+		std::uint64_t last_version = 0;
 
 		while (running) {
-			bool should_refresh_ui = false;
-
-			// check new messages
-			if (!app.pollIncomingMessages().empty()) {
-				should_refresh_ui = true;
-			}
-
 			// peer list refresh (every 3 seconds)
 			auto now = std::chrono::steady_clock::now();
 			if (now - last_peer_refresh > std::chrono::seconds(3)) {
 				app.refreshPeers();
 				last_peer_refresh = now;
-				should_refresh_ui = true;
-			}
-
-			// check status message change
-			std::string current_status = app.getStatusMessage();
-			if (current_status != last_status_message) {
-				last_status_message = current_status;
-				should_refresh_ui = true;
 			}
 
-			// if anything changed, post a single refresh event
-			if (should_refresh_ui) {
+			// redraw only when a new snapshot was published, by us or by the
+			// UI thread after handling input
+			app.publishView();
+			std::uint64_t version = app.getView()->version;
+			if (version != last_version) {
+				last_version = version;
 				screen.PostEvent(ftxui::Event::Custom);
 			}
 
@@ -0,0 +1,15 @@
+#include "media/audio.hpp"
+#include <cmath>
+#include <cstdint>
+
+ToneSource::ToneSource(double frequency, double amplitude)
+	: frequency_(frequency), amplitude_(amplitude) {}
+
+bool ToneSource::read(AudioFrame &frame) {
+	const double step = 2.0 * M_PI * frequency_ / AUDIO_SAMPLE_RATE;
+	for (auto &sample : frame.samples) {
+		sample = static_cast<std::int16_t>(amplitude_ * 32767.0 *
+										   std::sin(step * sample_++));
+	}
+	return true;
+}
@@ -0,0 +1,126 @@
+#include "media/jitter_buffer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+std::uint64_t JitterBuffer::extendSequence(std::uint16_t sequence) {
+	if (!has_previous_) {
+		highest_sequence_ = sequence;
+		return (sequence_cycles_ << 16) + sequence;
+	}
+	// a jump backwards by more than half the range is a wraparound
+	std::int16_t delta = static_cast<std::int16_t>(sequence - highest_sequence_);
+	std::uint64_t extended = (sequence_cycles_ << 16) + highest_sequence_ + delta;
+	if (delta > 0) {
+		if (sequence < highest_sequence_) {
+			++sequence_cycles_;
+		}
+		highest_sequence_ = sequence;
+	}
+	return extended;
+}
+
+void JitterBuffer::push(std::uint16_t sequence, const AudioFrame &frame,
+						std::chrono::steady_clock::time_point arrival) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	std::uint64_t extended = extendSequence(sequence);
+
+	if (has_previous_) {
+		// difference between arrival spacing and send spacing
+		double arrival_ms = std::chrono::duration<double, std::milli>(
+								arrival - previous_arrival_)
+								.count();
+		double send_ms =
+			static_cast<std::int32_t>(frame.timestamp - previous_timestamp_) *
+			1000.0 / AUDIO_SAMPLE_RATE;
+		jitter_ms_ += (std::abs(arrival_ms - send_ms) - jitter_ms_) / 16.0;
+	}
+	has_previous_ = true;
+	previous_arrival_ = arrival;
+	previous_timestamp_ = frame.timestamp;
+
+	// enough delay to absorb about three times the mean jitter
+	target_frames_ = std::clamp<size_t>(
+		MIN_DELAY_FRAMES +
+			static_cast<size_t>(3.0 * jitter_ms_ / AUDIO_FRAME_MS),
+		MIN_DELAY_FRAMES, MAX_DELAY_FRAMES);
+
+	if (playing_ && extended < next_sequence_) {
+		// its slot was already concealed, the delay is too short
+		++late_;
+		stretch_pending_ = true;
+		return;
+	}
+	frames_.emplace(extended, frame);
+}
+
+AudioFrame JitterBuffer::conceal(std::uint32_t timestamp) {
+	// fade the last frame out over a few frames, then silence
+	AudioFrame frame = last_frame_;
+	frame.timestamp = timestamp;
+	last_frame_.timestamp = timestamp;
+	frame.concealed = true;
+	++concealed_run_;
+	double gain = concealed_run_ > MAX_CONCEALED_RUN
+					  ? 0.0
+					  : std::pow(0.5, static_cast<double>(concealed_run_));
+	for (auto &sample : frame.samples) {
+		sample = static_cast<std::int16_t>(sample * gain);
+	}
+	++concealed_;
+	return frame;
+}
+
+AudioFrame JitterBuffer::pop() {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	if (!playing_) {
+		// fill up to the target delay before starting
+		if (frames_.size() < target_frames_) {
+			AudioFrame silence;
+			silence.concealed = true;
+			return silence;
+		}
+		playing_ = true;
+		next_sequence_ = frames_.begin()->first;
+	}
+
+	// a frame arrived too late, hold playout back a frame to add delay
+	if (stretch_pending_) {
+		stretch_pending_ = false;
+		surplus_ticks_ = 0;
+		return conceal(last_frame_.timestamp);
+	}
+
+	// more buffered than the jitter calls for, for long enough that it is
+	// not just a burst. skip a frame to bring the delay back down
+	surplus_ticks_ = frames_.size() > target_frames_ ? surplus_ticks_ + 1 : 0;
+	if (surplus_ticks_ >= SHRINK_AFTER_TICKS) {
+		auto oldest = frames_.begin();
+		next_sequence_ = oldest->first + 1;
+		frames_.erase(oldest);
+		surplus_ticks_ = 0;
+		++dropped_;
+	}
+
+	auto due = frames_.find(next_sequence_);
+	if (due != frames_.end()) {
+		last_frame_ = due->second;
+		last_frame_.concealed = false;
+		frames_.erase(due);
+		++next_sequence_;
+		++played_;
+		concealed_run_ = 0;
+		return last_frame_;
+	}
+
+	// the due frame is treated as lost. if it still turns up it is counted
+	// late and the delay grows instead
+	++next_sequence_;
+	return conceal(last_frame_.timestamp + AUDIO_FRAME_SAMPLES);
+}
+
+JitterBuffer::Stats JitterBuffer::getStats() const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	return {played_, concealed_, late_, dropped_, target_frames_, jitter_ms_};
+}
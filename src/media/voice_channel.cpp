@@ -0,0 +1,153 @@
+#include "media/voice_channel.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using boost::asio::ip::udp;
+
+// RTP version 2 header with a dynamic payload type for 16 kHz L16
+constexpr std::uint8_t RTP_VERSION_BYTE = 0x80;
+constexpr std::uint8_t RTP_PAYLOAD_TYPE = 96;
+constexpr size_t RTP_HEADER_SIZE = 12;
+constexpr size_t RTP_PACKET_SIZE =
+	RTP_HEADER_SIZE + AUDIO_FRAME_SAMPLES * sizeof(std::int16_t);
+
+static void writeUint16(std::uint8_t *out, std::uint16_t value) {
+	out[0] = static_cast<std::uint8_t>(value >> 8);
+	out[1] = static_cast<std::uint8_t>(value);
+}
+
+static void writeUint32(std::uint8_t *out, std::uint32_t value) {
+	writeUint16(out, static_cast<std::uint16_t>(value >> 16));
+	writeUint16(out + 2, static_cast<std::uint16_t>(value));
+}
+
+static std::uint16_t readUint16(const std::uint8_t *in) {
+	return static_cast<std::uint16_t>((in[0] << 8) | in[1]);
+}
+
+static std::uint32_t readUint32(const std::uint8_t *in) {
+	return (static_cast<std::uint32_t>(readUint16(in)) << 16) |
+		   readUint16(in + 2);
+}
+
+VoiceChannel::VoiceChannel(boost::asio::io_context &io_ctx,
+						   unsigned short local_port)
+	: socket_(io_ctx, udp::endpoint(udp::v4(), local_port)) {
+	std::random_device rd;
+	ssrc_ = rd();
+	loss_rng_.seed(rd());
+}
+
+VoiceChannel::~VoiceChannel() { stop(); }
+
+unsigned short VoiceChannel::getLocalPort() const {
+	return socket_.local_endpoint().port();
+}
+
+void VoiceChannel::start(const udp::endpoint &remote,
+						 std::shared_ptr<AudioSource> source,
+						 std::shared_ptr<AudioSink> sink) {
+	remote_ = remote;
+	source_ = source;
+	sink_ = sink;
+	running_ = true;
+	receive_thread_ = std::thread(&VoiceChannel::receiveLoop, this);
+	send_thread_ = std::thread(&VoiceChannel::sendLoop, this);
+	playout_thread_ = std::thread(&VoiceChannel::playoutLoop, this);
+}
+
+void VoiceChannel::stop() {
+	if (!running_.exchange(false)) {
+		return;
+	}
+	// an empty datagram to ourselves wakes the blocked receive, closing the
+	// socket under it would race
+	boost::system::error_code ec;
+	socket_.send_to(boost::asio::buffer(&RTP_VERSION_BYTE, 0),
+					udp::endpoint(boost::asio::ip::address_v4::loopback(),
+								  getLocalPort()),
+					0, ec);
+	for (auto *thread : {&send_thread_, &receive_thread_, &playout_thread_}) {
+		if (thread->joinable()) {
+			thread->join();
+		}
+	}
+	socket_.close(ec);
+}
+
+void VoiceChannel::setSendLossRate(double rate) { send_loss_rate_ = rate; }
+
+JitterBuffer::Stats VoiceChannel::getStats() const {
+	return jitter_buffer_.getStats();
+}
+
+void VoiceChannel::sendLoop() {
+	std::vector<std::uint8_t> packet(RTP_PACKET_SIZE);
+	std::uniform_real_distribution<double> loss(0.0, 1.0);
+	std::uint16_t sequence = 0;
+	std::uint32_t timestamp = 0;
+	AudioFrame frame;
+
+	// paced against absolute deadlines so scheduling delays don't drift
+	auto deadline = std::chrono::steady_clock::now();
+	while (running_ && source_->read(frame)) {
+		packet[0] = RTP_VERSION_BYTE;
+		packet[1] = RTP_PAYLOAD_TYPE;
+		writeUint16(&packet[2], sequence++);
+		writeUint32(&packet[4], timestamp);
+		writeUint32(&packet[8], ssrc_);
+		for (size_t i = 0; i < AUDIO_FRAME_SAMPLES; ++i) {
+			writeUint16(&packet[RTP_HEADER_SIZE + i * 2],
+						static_cast<std::uint16_t>(frame.samples[i]));
+		}
+
+		if (loss(loss_rng_) >= send_loss_rate_) {
+			boost::system::error_code ec;
+			socket_.send_to(boost::asio::buffer(packet), remote_, 0, ec);
+		}
+
+		timestamp += AUDIO_FRAME_SAMPLES;
+		deadline += std::chrono::milliseconds(AUDIO_FRAME_MS);
+		std::this_thread::sleep_until(deadline);
+	}
+}
+
+void VoiceChannel::receiveLoop() {
+	std::vector<std::uint8_t> packet(RTP_PACKET_SIZE);
+	AudioFrame frame;
+	while (running_) {
+		udp::endpoint sender;
+		boost::system::error_code ec;
+		size_t len =
+			socket_.receive_from(boost::asio::buffer(packet), sender, 0, ec);
+		auto arrival = std::chrono::steady_clock::now();
+		if (ec || !running_) {
+			continue;
+		}
+		// anything but a full audio packet from our remote is ignored
+		if (sender != remote_ || len != RTP_PACKET_SIZE ||
+			packet[0] != RTP_VERSION_BYTE ||
+			(packet[1] & 0x7f) != RTP_PAYLOAD_TYPE) {
+			continue;
+		}
+
+		frame.timestamp = readUint32(&packet[4]);
+		for (size_t i = 0; i < AUDIO_FRAME_SAMPLES; ++i) {
+			frame.samples[i] = static_cast<std::int16_t>(
+				readUint16(&packet[RTP_HEADER_SIZE + i * 2]));
+		}
+		jitter_buffer_.push(readUint16(&packet[2]), frame, arrival);
+	}
+}
+
+void VoiceChannel::playoutLoop() {
+	auto deadline = std::chrono::steady_clock::now();
+	while (running_) {
+		sink_->write(jitter_buffer_.pop());
+		deadline += std::chrono::milliseconds(AUDIO_FRAME_MS);
+		std::this_thread::sleep_until(deadline);
+	}
+}
@@ -1,50 +1,200 @@
 #include "network/connection.hpp"
 #include "core/message.hpp"
 #include "network/peer.hpp"
-#include <boost/asio/read_until.hpp>
-#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <functional>
-#include <iostream>
-#include <istream>
 #include <mutex>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-constexpr unsigned short DEFAULT_PORT = 9000;
+constexpr const char *HELLO_MESSAGE = "HELLO|";
+constexpr size_t FRAME_HEADER_SIZE = 4;
+constexpr size_t MAX_FRAME_SIZE = 1 << 20;
+constexpr size_t MAX_HELLO_SIZE = 4096;
+// reads ask the stream for this much, frames at least this large skip
+// the read buffer
+constexpr size_t READ_CHUNK_SIZE = 16384;
+// sendMessage buffers kept for reuse, enough for a burst of messages
+constexpr size_t MAX_SPARE_PAYLOADS = 16;
+// queued frames are sealed back to back and written together until a batch
+// holds this much
+constexpr size_t MAX_BATCH_SIZE = 64 * 1024;
+// how long a peer is shown as throttled after being held back
+constexpr std::chrono::seconds THROTTLE_DISPLAY_TIME(3);
+// pings per dead timeout, a few can go missing before the peer is dropped
+constexpr int HEARTBEATS_PER_TIMEOUT = 5;
+// a peer that doesn't finish the handshake by then is given up on, before
+// the dead timeout watches the connection
+constexpr std::chrono::seconds HANDSHAKE_TIMEOUT(10);
 using boost::asio::ip::tcp;
+using HandshakeNonce = std::array<std::uint8_t, 16>;
+
+// HELLO|node id|handshake key|identity key|signature|ticket or -|nonce|
+// cipher scores|envelope key
+struct HelloMessage {
+	std::uint64_t node_id = 0;
+	PublicKey handshake_key{};
+	PublicKey identity{};
+	Signature signature{};
+	bool has_ticket = false;
+	TicketId ticket{};
+	HandshakeNonce nonce{};
+	CipherScores cipher_scores{};
+	PublicKey envelope_key{};
+};
+
+static std::string encodeHello(const HelloMessage &hello) {
+	std::string line = HELLO_MESSAGE + std::to_string(hello.node_id);
+	line += "|" + toHex(hello.handshake_key.data(), hello.handshake_key.size());
+	line += "|" + toHex(hello.identity.data(), hello.identity.size());
+	line += "|" + toHex(hello.signature.data(), hello.signature.size());
+	line += "|" + (hello.has_ticket
+					   ? toHex(hello.ticket.data(), hello.ticket.size())
+					   : std::string("-"));
+	line += "|" + toHex(hello.nonce.data(), hello.nonce.size());
+	line += "|" + encodeCipherScores(hello.cipher_scores);
+	line += "|" + toHex(hello.envelope_key.data(), hello.envelope_key.size());
+	return line + '\n';
+}
+
+// F|transcript hash, the first frame each side sends
+struct Finished {
+	std::string transcript;
+};
+
+struct FinishedFrame {
+	using Type = Finished;
+	static constexpr char KIND = 'F';
+	static constexpr auto FIELDS =
+		std::make_tuple(wireField<WireHex>(&Finished::transcript));
+};
+
+// SHA-256 over both hello lines, dialer first
+static std::string transcriptHash(const std::string &dialer_line,
+								  const std::string &acceptor_line) {
+	std::string hash(EVP_MAX_MD_SIZE, '\0');
+	unsigned int len = 0;
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	bool ok = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) > 0 &&
+			  EVP_DigestUpdate(ctx, dialer_line.data(), dialer_line.size()) > 0 &&
+			  EVP_DigestUpdate(ctx, acceptor_line.data(), acceptor_line.size()) >
+				  0 &&
+			  EVP_DigestFinal_ex(
+				  ctx, reinterpret_cast<unsigned char *>(&hash[0]), &len) > 0;
+	EVP_MD_CTX_free(ctx);
+	if (!ok) {
+		throw std::runtime_error("failed to hash the handshake");
+	}
+	hash.resize(len);
+	return hash;
+}
+
+static HelloMessage parseHello(const std::string &line) {
+	if (line.rfind(HELLO_MESSAGE, 0) != 0) {
+		throw std::runtime_error("unexpected handshake from peer");
+	}
+
+	std::vector<std::string> fields;
+	size_t start = std::char_traits<char>::length(HELLO_MESSAGE);
+	while (true) {
+		size_t pipe = line.find('|', start);
+		fields.push_back(line.substr(start, pipe - start));
+		if (pipe == std::string::npos) {
+			break;
+		}
+		start = pipe + 1;
+	}
+	if (fields.size() != 8) {
+		throw std::runtime_error("malformed handshake from peer");
+	}
+
+	HelloMessage hello;
+	hello.node_id = std::stoull(fields[0]);
+	hello.has_ticket = fields[4] != "-";
+	hello.cipher_scores = parseCipherScores(fields[6]);
+	bool ok =
+		fromHex(fields[1], hello.handshake_key.data(),
+				hello.handshake_key.size()) &&
+		fromHex(fields[2], hello.identity.data(), hello.identity.size()) &&
+		fromHex(fields[3], hello.signature.data(), hello.signature.size()) &&
+		(!hello.has_ticket ||
+		 fromHex(fields[4], hello.ticket.data(), hello.ticket.size())) &&
+		fromHex(fields[5], hello.nonce.data(), hello.nonce.size()) &&
+		fromHex(fields[7], hello.envelope_key.data(),
+				hello.envelope_key.size());
+	if (!ok) {
+		throw std::runtime_error("malformed handshake from peer");
+	}
+	return hello;
+}
 
 Connection::Connection(std::shared_ptr<Peer> peer,
+					   std::shared_ptr<SecurityContext> security,
 					   boost::asio::io_context &io_ctx,
-					   std::function<void(const Message &)> message_callback,
-					   std::function<void()> on_disconnect_)
-	: peer_(peer), socket_(io_ctx), on_message_received_(message_callback),
-	  on_disconnect_(on_disconnect_), connected_(false) {};
+					   FrameRoute route,
+					   std::function<void()> on_disconnect_,
+					   const boost::asio::ip::address &local_address)
+	: peer_(peer), io_ctx_(&io_ctx), local_address_(local_address),
+	  route_(route), on_disconnect_(on_disconnect_),
+	  connected_(false), security_(security), local_node_id_(security->node_id),
+	  initiated_(true) {};
 
 Connection::Connection(std::shared_ptr<Peer> peer,
-					   std::function<void(const Message &)> message_callback,
+					   std::shared_ptr<SecurityContext> security,
+					   FrameRoute route,
 					   std::function<void()> on_disconnect,
 					   boost::asio::ip::tcp::socket socket)
-	: peer_(peer), socket_(std::move(socket)),
-	  on_message_received_(message_callback), on_disconnect_(on_disconnect),
-	  connected_(true) {
-	receive_thread_ = std::thread(&Connection::receiveLoop, this);
-}
+	: peer_(peer), stream_(std::make_unique<TcpStream>(std::move(socket))),
+	  route_(route), on_disconnect_(on_disconnect),
+	  connected_(true), security_(security), local_node_id_(security->node_id),
+	  initiated_(false) {}
+
+Connection::Connection(std::shared_ptr<Peer> peer,
+					   std::shared_ptr<SecurityContext> security,
+					   FrameRoute route,
+					   std::function<void()> on_disconnect,
+					   std::unique_ptr<Stream> stream, bool initiated)
+	: peer_(peer), stream_(std::move(stream)),
+	  route_(route), on_disconnect_(on_disconnect),
+	  connected_(true), security_(security), local_node_id_(security->node_id),
+	  initiated_(initiated) {}
 
 Connection::~Connection() { disconnect(); };
 
 void Connection::connect() {
 	try {
 		// create endpoint (peer)
-		tcp::endpoint endpoint(peer_->getIpAddr(), DEFAULT_PORT);
+		tcp::endpoint endpoint(peer_->getIpAddr(), peer_->getPort());
 
-		// connect to peer
-		socket_.connect(endpoint);
+		// connect to peer, from our own address if we have one so the peer
+		// can tell us apart from other nodes on this machine
+		tcp::socket socket(*io_ctx_);
+		if (!local_address_.is_unspecified()) {
+			socket.open(endpoint.protocol());
+			socket.bind(tcp::endpoint(local_address_, 0));
+		}
+		socket.connect(endpoint);
+		auto stream = std::make_unique<TcpStream>(std::move(socket));
 
 		{
 			std::lock_guard<std::mutex> lock(mutex_);
+			// aborted while dialing, there was no stream to shut down yet
+			if (handshake_ended_) {
+				throw std::runtime_error("handshake aborted");
+			}
+			stream_ = std::move(stream);
 			connected_ = true;
 		}
 
-		// start recieve thread
-		receive_thread_ = std::thread(&Connection::receiveLoop, this);
+		handshake();
 
 	} catch (const boost::system::system_error &e) {
 		// connection failed
@@ -53,74 +203,616 @@ void Connection::connect() {
 	}
 }
 
+void Connection::handshake() {
+	// the deadline waits on a thread of its own. shutting the stream down
+	// wakes whatever read or write the handshake is blocked in
+	bool expired = false;
+	std::thread deadline([this, &expired] {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!handshake_cv_.wait_for(lock, HANDSHAKE_TIMEOUT,
+									[this] { return handshake_ended_; })) {
+			handshake_ended_ = true;
+			expired = true;
+			stream_->shutdown();
+		}
+	});
+	auto end = [this, &deadline] {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			handshake_ended_ = true;
+		}
+		handshake_cv_.notify_all();
+		deadline.join();
+	};
+	try {
+		exchangeHandshake();
+	} catch (...) {
+		end();
+		throw;
+	}
+	end();
+	// it may have run out right after the last write went through
+	if (expired) {
+		throw std::runtime_error("handshake timed out");
+	}
+}
+
+void Connection::abortHandshake() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (handshake_ended_) {
+			return;
+		}
+		handshake_ended_ = true;
+		if (stream_) {
+			stream_->shutdown();
+		}
+	}
+	handshake_cv_.notify_all();
+}
+
+void Connection::exchangeHandshake() {
+	SecurityContext &security = *security_;
+
+	HelloMessage own;
+	own.node_id = local_node_id_;
+	own.handshake_key = security.handshake_key.getPublicKey();
+	own.identity = security.identity.getPublicKey();
+	own.signature = security.handshake_signature;
+	own.cipher_scores = security.cipher_scores;
+	own.envelope_key = security.envelope_key.getPublicKey();
+	if (RAND_bytes(own.nonce.data(), static_cast<int>(own.nonce.size())) != 1) {
+		throw std::runtime_error("failed to generate handshake nonce");
+	}
+
+	// the dialer speaks first and offers its ticket for this peer, the
+	// acceptor answers once it knows whether it can resume. then each side
+	// proves it holds the session keys, see below
+	SymmetricKey resumption_secret{};
+	bool offered = false;
+	std::string own_line;
+	if (initiated_) {
+		PublicKey pinned;
+		offered = security.trust_store.getPin(peer_->getHostname(), pinned) &&
+				  security.sessions.find(pinned, own.ticket, resumption_secret);
+		own.has_ticket = offered;
+		own_line = encodeHello(own);
+		stream_->write(reinterpret_cast<const std::uint8_t *>(own_line.data()),
+					   own_line.size());
+	}
+
+	std::string remote_line = readLine();
+	HelloMessage remote = parseHello(remote_line);
+	if (remote.node_id == local_node_id_) {
+		throw std::runtime_error("connected to ourselves");
+	}
+
+	bool resumed = false;
+	if (initiated_) {
+		resumed = offered && remote.has_ticket && remote.ticket == own.ticket;
+	} else {
+		TicketId cached_ticket;
+		resumed =
+			remote.has_ticket &&
+			security.sessions.find(remote.identity, cached_ticket,
+								   resumption_secret) &&
+			cached_ticket == remote.ticket;
+		own.has_ticket = resumed;
+		own.ticket = remote.ticket;
+		own_line = encodeHello(own);
+	}
+
+	// a resuming peer proved its identity on the earlier handshake. the
+	// ticket travels in the clear, so it only names the session, holding
+	// its secret is proved by the finished frame below
+	if (!resumed) {
+		std::string signed_data = handshakeSignedData(
+			remote.node_id, remote.handshake_key, remote.envelope_key);
+		if (!security.signatures.verify(
+				remote.identity,
+				reinterpret_cast<const std::uint8_t *>(signed_data.data()),
+				signed_data.size(), remote.signature)) {
+			throw std::runtime_error("peer handshake signature is invalid");
+		}
+	}
+
+	// both sides run the same pure function over both score lists
+	CipherSuite suite =
+		negotiateCipherSuite(own.cipher_scores, remote.cipher_scores);
+
+	// salt covers both nonces and handshake keys in dialer, acceptor order,
+	// then the suite so both ends must have agreed on it
+	const HelloMessage &dialer = initiated_ ? own : remote;
+	const HelloMessage &acceptor = initiated_ ? remote : own;
+	std::uint8_t salt[2 * sizeof(HandshakeNonce) + 2 * sizeof(PublicKey) + 1];
+	std::uint8_t *cursor = salt;
+	for (const auto *part : {dialer.nonce.data(), acceptor.nonce.data()}) {
+		std::memcpy(cursor, part, sizeof(HandshakeNonce));
+		cursor += sizeof(HandshakeNonce);
+	}
+	for (const auto *part :
+		 {dialer.handshake_key.data(), acceptor.handshake_key.data()}) {
+		std::memcpy(cursor, part, sizeof(PublicKey));
+		cursor += sizeof(PublicKey);
+	}
+	*cursor = static_cast<std::uint8_t>(suite);
+
+	SymmetricKey secret =
+		resumed ? resumption_secret
+				: security.handshake_key.deriveSharedSecret(remote.handshake_key);
+	SessionKeys keys = expandSessionKeys(secret, salt, sizeof(salt), initiated_);
+	OPENSSL_cleanse(secret.data(), secret.size());
+	OPENSSL_cleanse(resumption_secret.data(), resumption_secret.size());
+	send_cipher_ = std::make_unique<FrameCipher>(suite, keys.send_key,
+												 keys.send_nonce, true);
+	receive_cipher_ = std::make_unique<FrameCipher>(
+		suite, keys.receive_key, keys.receive_nonce, false);
+	TicketId next_ticket = keys.ticket;
+	SymmetricKey next_resumption_secret = keys.resumption_secret;
+	OPENSSL_cleanse(&keys, sizeof(keys));
+
+	// key confirmation. each side's first frame is a hash of both hellos,
+	// sealed with its session keys, so it proves the keys and that both
+	// saw the same handshake. a replayed hello or ticket gets no further.
+	// the acceptor sends its hello and finished frame together, the dialer
+	// answers once it checked the acceptor's, and nothing is trusted or
+	// stored before both checked out. the lines are hashed as read, without
+	// their newline
+	std::string own_text = own_line.substr(0, own_line.size() - 1);
+	const std::string &dialer_line = initiated_ ? own_text : remote_line;
+	const std::string &acceptor_line = initiated_ ? remote_line : own_text;
+	std::string finished = encodeFrame<FinishedFrame>(
+		{transcriptHash(dialer_line, acceptor_line)});
+	auto checkFinished = [this, &finished] {
+		if (readFrame() != finished) {
+			throw std::runtime_error("peer failed key confirmation");
+		}
+	};
+	if (initiated_) {
+		checkFinished();
+		size_t len = sealFrame(finished, 0);
+		stream_->write(send_buffer_.data(), len);
+	} else {
+		std::string flight = own_line;
+		size_t len = sealFrame(finished, 0);
+		flight.append(reinterpret_cast<const char *>(send_buffer_.data()), len);
+		stream_->write(reinterpret_cast<const std::uint8_t *>(flight.data()),
+					   flight.size());
+		checkFinished();
+	}
+
+	if (!security.trust_store.checkAndPin(peer_->getHostname(),
+										  remote.identity)) {
+		throw std::runtime_error("peer identity does not match its pin");
+	}
+	// the envelope key is only trusted when the signature above covered it
+	if (!resumed) {
+		security.trust_store.setEnvelopeKey(peer_->getHostname(),
+											remote.envelope_key);
+	}
+	security.sessions.store(remote.identity, next_ticket,
+							  next_resumption_secret);
+	OPENSSL_cleanse(next_resumption_secret.data(),
+					next_resumption_secret.size());
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	remote_node_id_ = remote.node_id;
+	remote_identity_ = remote.identity;
+	resumed_ = resumed;
+	cipher_suite_ = suite;
+}
+
+// TCP gave up on the peer, as opposed to the peer closing or misbehaving
+static bool isTimeout(const std::exception &e) {
+	auto *error = dynamic_cast<const boost::system::system_error *>(&e);
+	return error && error->code() == boost::asio::error::timed_out;
+}
+
+static std::int64_t steadyMicroseconds(std::chrono::steady_clock::time_point time) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			   time.time_since_epoch())
+		.count();
+}
+
+void Connection::start() {
+	started_ = true;
+	last_heard_ = std::chrono::steady_clock::now().time_since_epoch().count();
+	receive_thread_ = std::thread(&Connection::receiveLoop, this);
+	send_thread_ = std::thread(&Connection::sendLoop, this);
+}
+
+void Connection::setInboundLimits(double frame_rate, double byte_rate) {
+	frame_bucket_ = TokenBucket(frame_rate, 2 * frame_rate);
+	byte_bucket_ = TokenBucket(byte_rate, 2 * byte_rate);
+}
+
+void Connection::setDeadTimeout(std::chrono::milliseconds timeout) {
+	dead_timeout_ = timeout;
+	heartbeat_interval_ = timeout / HEARTBEATS_PER_TIMEOUT;
+	if (stream_) {
+		stream_->setDeadTimeout(timeout);
+	}
+}
+
+void Connection::retire() {
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		if (retired_) {
+			return;
+		}
+		retired_ = true;
+		send_closed_ = true;
+	}
+	// the send thread half closes once everything queued has gone out
+	send_cv_.notify_one();
+}
+
 bool Connection::sendMessage(const Message &msg) {
+	std::shared_ptr<std::string> payload;
 	{
 		std::lock_guard<std::mutex> lock(mutex_);
-		if (!connected_) {
+		if (!spare_payloads_.empty()) {
+			payload = std::move(spare_payloads_.back());
+			spare_payloads_.pop_back();
+		}
+	}
+	if (!payload) {
+		payload = std::make_shared<std::string>();
+	}
+	msg.serialize(*payload);
+	return queueFrame(send_queue_, {payload, payload});
+}
+
+bool Connection::sendFrame(std::shared_ptr<const std::string> payload) {
+	return queueFrame(send_queue_, {std::move(payload), nullptr});
+}
+
+bool Connection::sendBulkFrame(std::shared_ptr<const std::string> payload) {
+	return queueFrame(bulk_queue_, {std::move(payload), nullptr});
+}
+
+bool Connection::queueFrame(std::deque<QueuedFrame> &queue, QueuedFrame frame) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!connected_ || send_closed_) {
 			return false;
 		}
+		queue.push_back(std::move(frame));
 	}
+	send_cv_.notify_one();
+	return true;
+}
 
-	try { // try send a message
-		std::string data = msg.serialize();
-		data += '\n';
-		boost::asio::write(socket_, boost::asio::buffer(data));
-		return true;
-	} catch (const boost::system::system_error &e) {
-		{
-			const std::lock_guard<std::mutex> lock(mutex_);
-			if (!connected_) {
-				return false;
+void Connection::sendLoop() {
+	using std::chrono::steady_clock;
+	bool heartbeats = heartbeat_interval_ > steady_clock::duration::zero();
+	auto next_ping = steady_clock::now() + heartbeat_interval_;
+	auto ready = [this] {
+		return !send_queue_.empty() || !bulk_queue_.empty() || send_closed_;
+	};
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		// pings go out on a timer, busy or idle, ahead of anything queued
+		auto now = steady_clock::now();
+		if (heartbeats && !send_closed_ && now >= next_ping) {
+			steady_clock::time_point heard(
+				steady_clock::duration(last_heard_.load()));
+			if (now - heard > dead_timeout_) {
+				lock.unlock();
+				expire();
+				return;
 			}
+			send_queue_.push_front({std::make_shared<const std::string>(
+										encodeFrame<HeartbeatFrame>(
+											{'P', steadyMicroseconds(now)})),
+									nullptr});
+			next_ping = now + heartbeat_interval_;
 		}
-		if (on_disconnect_) {
-			on_disconnect_();
+		if (heartbeats) {
+			send_cv_.wait_until(lock, next_ping, ready);
+			if (!ready()) {
+				continue;
+			}
+		} else {
+			send_cv_.wait(lock, ready);
 		}
-		connected_ = false;
-		return false;
+		// chat messages go first, bulk frames fill the gaps. whatever is
+		// queued goes out in one write, up to a batch
+		size_t batch_bytes = 0;
+		while (batch_bytes < MAX_BATCH_SIZE) {
+			auto &queue = send_queue_.empty() ? bulk_queue_ : send_queue_;
+			if (queue.empty()) {
+				break;
+			}
+			batch_bytes += queue.front().payload->size();
+			send_batch_.push_back(std::move(queue.front()));
+			queue.pop_front();
+		}
+		if (send_batch_.empty()) {
+			break;
+		}
+		lock.unlock();
+
+		try { // try send the batch
+			size_t len = 0;
+			for (const auto &frame : send_batch_) {
+				len = sealFrame(*frame.payload, len);
+			}
+			stream_->write(send_buffer_.data(), len);
+		} catch (const std::exception &e) {
+			lock.lock();
+			send_queue_.clear();
+			bulk_queue_.clear();
+			send_batch_.clear();
+			lock.unlock();
+			if (isTimeout(e)) {
+				timed_out_ = true;
+			}
+			fail();
+			return;
+		}
+		lock.lock();
+		for (auto &frame : send_batch_) {
+			if (frame.spare && spare_payloads_.size() < MAX_SPARE_PAYLOADS) {
+				frame.payload.reset();
+				spare_payloads_.push_back(std::move(frame.spare));
+			}
+		}
+		send_batch_.clear();
+	}
+
+	// a retired connection sends its FIN after the last queued frame
+	bool half_close = retired_;
+	lock.unlock();
+	if (half_close) {
+		stream_->shutdownSend();
 	}
 }
 
 void Connection::receiveLoop() {
 	try {
-		boost::asio::streambuf buffer;
-		while (connected_) {
-			boost::asio::read_until(socket_, buffer, "\n");
-			std::istream is(&buffer); // place the buffer into an input stream
-			std::string data;
-			std::getline(is, data); // remove the delimiter
-			on_message_received_(Message::deserialize(data));
+		while (isConnected()) {
+			std::string_view frame = readFrame();
+			if (!frame.empty() && frame[0] == HeartbeatFrame::KIND) {
+				onHeartbeat(decodeFrame<HeartbeatFrame>(frame));
+				continue;
+			}
+			// chat messages, relayed envelopes and history sync share the
+			// stream, the frame's kind picks the handler
+			route_.dispatch(route_.handler, peer_, frame);
 		}
 	} catch (const std::exception &e) {
+		if (isTimeout(e)) {
+			timed_out_ = true;
+		}
+		fail();
+	}
+	finished_ = true;
+}
+
+void Connection::fail() {
+	bool notify = false;
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		// check if another thread has already handled the disconnect.
+		// a retired connection ending is expected, so nobody is told
+		if (connected_) {
+			notify = !retired_;
+			connected_ = false;
+		}
+	}
+	// no longer holding our internal lock, it is safe to call the
+	// external callback.
+	if (notify && on_disconnect_) {
+		on_disconnect_();
+	}
+}
+
+void Connection::expire() {
+	timed_out_ = true;
+	fail();
+	// the receive thread's read fails and it finds the connection gone
+	throttle_cv_.notify_one();
+	stream_->shutdown();
+}
+
+void Connection::onHeartbeat(const Heartbeat &heartbeat) {
+	auto now = std::chrono::steady_clock::now();
+	if (heartbeat.kind == 'P') {
+		// answered ahead of anything queued, so the round trip doesn't
+		// include our backlog
 		{
 			const std::lock_guard<std::mutex> lock(mutex_);
-			// check if another thread has already handled the disconnect.
-			if (connected_) {
-				// no longer holding our internal lock, it is safe to call the
-				// external callback.
-				if (on_disconnect_) {
-					on_disconnect_();
-				}
-				connected_ = false;
+			if (!connected_ || send_closed_) {
 				return;
 			}
+			send_queue_.push_front({std::make_shared<const std::string>(
+										encodeFrame<HeartbeatFrame>(
+											{'A', heartbeat.stamp})),
+									nullptr});
+		}
+		send_cv_.notify_one();
+		return;
+	}
+	if (heartbeat.kind != 'A') {
+		throw std::invalid_argument("unknown heartbeat");
+	}
+	double sample = (steadyMicroseconds(now) - heartbeat.stamp) / 1000.0;
+	if (sample < 0) {
+		return;
+	}
+	const std::lock_guard<std::mutex> lock(mutex_);
+	if (srtt_ms_ < 0) {
+		srtt_ms_ = sample;
+		rttvar_ms_ = sample / 2;
+	} else {
+		rttvar_ms_ = 0.75 * rttvar_ms_ + 0.25 * std::abs(srtt_ms_ - sample);
+		srtt_ms_ = 0.875 * srtt_ms_ + 0.125 * sample;
+	}
+}
+
+// moves the unread bytes to the front and reads what fits behind them
+void Connection::fillReadBuffer() {
+	if (read_buffer_.empty()) {
+		read_buffer_.resize(READ_CHUNK_SIZE);
+	}
+	if (read_pos_ > 0) {
+		std::memmove(read_buffer_.data(), read_buffer_.data() + read_pos_,
+					 read_end_ - read_pos_);
+		read_end_ -= read_pos_;
+		read_pos_ = 0;
+	}
+	read_end_ += stream_->readSome(read_buffer_.data() + read_end_,
+								   read_buffer_.size() - read_end_);
+	// a large frame trickling in still shows the peer is alive
+	last_heard_ = std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// anything the peer sends after the line stays in read_buffer_ for the
+// receive loop
+std::string Connection::readLine() {
+	while (true) {
+		const std::uint8_t *begin = read_buffer_.data() + read_pos_;
+		const std::uint8_t *end = read_buffer_.data() + read_end_;
+		const std::uint8_t *newline = std::find(begin, end, '\n');
+		if (newline != end) {
+			read_pos_ += newline - begin + 1;
+			return std::string(reinterpret_cast<const char *>(begin),
+							   newline - begin);
+		}
+		if (read_end_ - read_pos_ > MAX_HELLO_SIZE) {
+			throw std::length_error("peer sent an oversized handshake");
+		}
+		fillReadBuffer();
+	}
+}
+
+void Connection::readExactly(std::uint8_t *data, size_t len) {
+	size_t done = 0;
+	while (done < len) {
+		size_t buffered = read_end_ - read_pos_;
+		if (buffered > 0) {
+			size_t n = std::min(len - done, buffered);
+			std::memcpy(data + done, read_buffer_.data() + read_pos_, n);
+			read_pos_ += n;
+			done += n;
+		} else if (len - done >= READ_CHUNK_SIZE) {
+			// the rest of a large frame is read straight into place
+			done += stream_->readSome(data + done, len - done);
+			last_heard_ =
+				std::chrono::steady_clock::now().time_since_epoch().count();
+		} else {
+			read_pos_ = read_end_ = 0;
+			fillReadBuffer();
 		}
 	}
 }
 
+// frame layout: 4 byte big endian length, ciphertext, 16 byte tag. the
+// shared payload is encrypted straight into this connection's send buffer,
+// so fan-out never copies it
+size_t Connection::sealFrame(const std::string &payload, size_t offset) {
+	size_t len = payload.size();
+	if (len > MAX_FRAME_SIZE) {
+		throw std::length_error("frame too large");
+	}
+	size_t end = offset + FRAME_HEADER_SIZE + len + AEAD_TAG_SIZE;
+	// grows to the largest batch and stays there
+	if (send_buffer_.size() < end) {
+		send_buffer_.resize(end);
+	}
+	std::uint8_t *frame = send_buffer_.data() + offset;
+	frame[0] = static_cast<std::uint8_t>(len >> 24);
+	frame[1] = static_cast<std::uint8_t>(len >> 16);
+	frame[2] = static_cast<std::uint8_t>(len >> 8);
+	frame[3] = static_cast<std::uint8_t>(len);
+	send_cipher_->seal(reinterpret_cast<const std::uint8_t *>(payload.data()),
+					   frame + FRAME_HEADER_SIZE, len,
+					   frame + FRAME_HEADER_SIZE + len);
+	return end;
+}
+
+std::string_view Connection::readFrame() {
+	std::uint8_t header[FRAME_HEADER_SIZE];
+	readExactly(header, sizeof(header));
+	size_t len = (static_cast<size_t>(header[0]) << 24) |
+				 (static_cast<size_t>(header[1]) << 16) |
+				 (static_cast<size_t>(header[2]) << 8) | header[3];
+	if (len > MAX_FRAME_SIZE) {
+		throw std::length_error("peer sent an oversized frame");
+	}
+	throttle(len);
+
+	receive_buffer_.resize(len + AEAD_TAG_SIZE);
+	readExactly(receive_buffer_.data(), receive_buffer_.size());
+	if (!receive_cipher_->open(receive_buffer_.data(), len,
+							   receive_buffer_.data() + len)) {
+		throw std::runtime_error("frame failed authentication");
+	}
+	return std::string_view(
+		reinterpret_cast<const char *>(receive_buffer_.data()), len);
+}
+
+void Connection::throttle(size_t len) {
+	bool held_back = false;
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		auto wait = std::max(frame_bucket_.waitFor(1, now),
+							 byte_bucket_.waitFor(static_cast<double>(len), now));
+		if (wait <= std::chrono::steady_clock::duration::zero()) {
+			frame_bucket_.take(1, now);
+			byte_bucket_.take(static_cast<double>(len), now);
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!held_back) {
+			held_back = true;
+			++throttled_frames_;
+		}
+		throttled_time_ += wait;
+		throttled_until_ = now + wait;
+		// we aren't reading, so the peer can't be heard
+		last_heard_ = (now + wait).time_since_epoch().count();
+		if (throttle_cv_.wait_for(lock, wait, [this] { return !connected_; })) {
+			throw std::runtime_error("connection closed while throttled");
+		}
+	}
+}
+
+Connection::Stats Connection::getStats() const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	std::chrono::duration<double, std::milli> throttled_time = throttled_time_;
+	return {throttled_frames_, throttled_time.count(),
+			std::chrono::steady_clock::now() <
+				throttled_until_ + THROTTLE_DISPLAY_TIME,
+			srtt_ms_, rttvar_ms_};
+}
+
 void Connection::disconnect() {
 	{
 		std::lock_guard<std::mutex> lock(mutex_);
 		connected_ = false;
+		send_closed_ = true;
+		send_queue_.clear();
+		bulk_queue_.clear();
 	}
-	try {
-		socket_.close();
-	} catch (const std::exception &e) {
-		// ignore
+	send_cv_.notify_one();
+	throttle_cv_.notify_one();
+	// shutdown wakes a blocked receive thread without yanking the socket
+	// from under it, the socket is closed once that thread is gone
+	if (stream_) {
+		stream_->shutdown();
+	}
+	for (auto *thread : {&receive_thread_, &send_thread_}) {
+		if (thread->joinable() &&
+			thread->get_id() != std::this_thread::get_id()) {
+			thread->join();
+		}
 	}
-	if (receive_thread_.joinable() &&
-		receive_thread_.get_id() != std::this_thread::get_id()) {
-		receive_thread_.join();
+	if (stream_) {
+		stream_->close();
 	}
 }
 
@@ -128,3 +820,49 @@ bool Connection::isConnected() const {
 	std::lock_guard<std::mutex> lock(mutex_);
 	return connected_;
 }
+
+bool Connection::isRetired() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return retired_;
+}
+
+// a connection whose receive thread never started has nothing to wait for
+bool Connection::isFinished() const {
+	return finished_ || !started_;
+}
+
+bool Connection::hasTimedOut() const { return timed_out_; }
+
+bool Connection::hasGoneQuiet() const {
+	if (heartbeat_interval_ <= std::chrono::steady_clock::duration::zero()) {
+		return true;
+	}
+	std::chrono::steady_clock::time_point heard(
+		std::chrono::steady_clock::duration(last_heard_.load()));
+	return std::chrono::steady_clock::now() - heard > 2 * heartbeat_interval_;
+}
+
+bool Connection::isResumed() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return resumed_;
+}
+
+CipherSuite Connection::getCipherSuite() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return cipher_suite_;
+}
+
+PublicKey Connection::getRemoteIdentity() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return remote_identity_;
+}
+
+std::uint64_t Connection::getRemoteNodeId() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return remote_node_id_;
+}
+
+std::uint64_t Connection::getDialerNodeId() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return initiated_ ? local_node_id_ : remote_node_id_;
+}
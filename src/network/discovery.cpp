@@ -1,15 +1,30 @@
 #include "network/discovery.hpp"
+#include "core/wire.hpp"
 #include "network/peer.hpp"
+#include "network/peer_registry.hpp"
 #include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
-constexpr unsigned short DISCOVERY_PORT = 9001;
 constexpr const char *PING_MESSAGE = "P2P_PING";
-
-Discovery::Discovery() : socket_(io_context_) {}
+// nodes from before per-instance ports answer without one
+constexpr unsigned short LEGACY_CHAT_PORT = 9000;
+// spoofed source addresses can't grow the bucket map past this, the
+// least recently heard from makes room
+constexpr size_t MAX_TRACKED_SOURCES = 1024;
+
+Discovery::Discovery(const Config &config, PeerRegistry &registry)
+	: socket_(io_context_), hostname_(config.hostname),
+	  chat_port_(config.port),
+	  local_endpoint_(config.bind_address, config.discovery_port),
+	  broadcast_(config.broadcast), seeds_(config.discovery_seeds),
+	  source_rate_(config.discovery_rate), registry_(registry) {}
 
 Discovery::~Discovery() { stop(); }
 
@@ -18,8 +33,7 @@ void Discovery::start() {
 		socket_.open(boost::asio::ip::udp::v4());
 		socket_.set_option(boost::asio::socket_base::reuse_address(true));
 		socket_.set_option(boost::asio::socket_base::broadcast(true));
-		socket_.bind(boost::asio::ip::udp::endpoint(
-			boost::asio::ip::address_v4::any(), DISCOVERY_PORT));
+		socket_.bind(local_endpoint_);
 	} catch (const boost::system::system_error &e) {
 		return;
 	}
@@ -30,41 +44,47 @@ void Discovery::start() {
 }
 
 void Discovery::stop() {
-	running_ = false;
+	{
+		const std::lock_guard<std::mutex> lock(running_mutex_);
+		running_ = false;
+	}
+	running_cv_.notify_all();
+	// closing doesn't wake a blocked receive, shutting down does even
+	// though the socket isn't connected. it is closed once nobody uses it
 	boost::system::error_code ec;
-	socket_.close(ec);
+	socket_.shutdown(boost::asio::ip::udp::socket::shutdown_both, ec);
 	if (broadcast_thread_.joinable()) {
 		broadcast_thread_.join();
 	}
 	if (receive_thread_.joinable()) {
 		receive_thread_.join();
 	}
+	socket_.close(ec);
 }
 
-void Discovery::addPeer(const std::shared_ptr<Peer> &new_peer) {
-	// don't add our own device to the peer list
-	try {
-		if (new_peer->getHostname() == boost::asio::ip::host_name()) {
-			return;
-		}
-	} catch (const boost::system::system_error &) {
-		// failed to get local hostname
+bool Discovery::admit(const boost::asio::ip::address &source) {
+	if (source_rate_ <= 0) {
+		return true;
 	}
-
-	const std::lock_guard<std::mutex> lock(peers_mutex_);
-
-	bool exists = false;
-	for (const auto &existing_peer : discovered_peers_) {
-		if (existing_peer->getIpAddr() == new_peer->getIpAddr()) {
-			exists = true;
-			break;
-		}
+	auto now = std::chrono::steady_clock::now();
+	auto found = source_buckets_.find(source);
+	if (found != source_buckets_.end()) {
+		source_lru_.splice(source_lru_.begin(), source_lru_, found->second);
+		return found->second->second.take(1, now);
 	}
-	if (!exists) {
-		discovered_peers_.push_back(new_peer);
+	if (source_buckets_.size() >= MAX_TRACKED_SOURCES) {
+		// a flooding source is heard from all the time, the one that goes
+		// has been quiet longest and gets a fresh bucket when it is back
+		source_buckets_.erase(source_lru_.back().first);
+		source_lru_.pop_back();
 	}
+	source_lru_.emplace_front(source, TokenBucket(source_rate_, 2 * source_rate_));
+	source_buckets_.emplace(source, source_lru_.begin());
+	return source_lru_.front().second.take(1, now);
 }
 
+Discovery::Stats Discovery::getStats() const { return {received_, dropped_}; }
+
 void Discovery::receiveLoop() {
 	while (running_) {
 		try {
@@ -73,24 +93,38 @@ void Discovery::receiveLoop() {
 
 			size_t len = socket_.receive_from(boost::asio::buffer(recv_buffer),
 											  sender_endpoint);
+			++received_;
+			if (!admit(sender_endpoint.address())) {
+				++dropped_;
+				continue;
+			}
 
 			std::string message(recv_buffer.data(), len);
+			// P2P_PONG|hostname|chat port
 			if (message.rfind("P2P_PONG|", 0) == 0) {
 				size_t first_pipe = message.find("|");
-				if (first_pipe != std::string::npos) {
-					std::string hostname = message.substr(first_pipe + 1);
-					std::string ip_addr = sender_endpoint.address().to_string();
-					auto new_peer = std::make_shared<Peer>(hostname, ip_addr);
-					addPeer(new_peer);
+				size_t second_pipe = message.find("|", first_pipe + 1);
+				std::string hostname =
+					message.substr(first_pipe + 1, second_pipe - first_pipe - 1);
+				unsigned short port = LEGACY_CHAT_PORT;
+				if (second_pipe != std::string::npos) {
+					try {
+						port = static_cast<unsigned short>(
+							std::stoul(message.substr(second_pipe + 1)));
+					} catch (const std::exception &e) {
+						continue;
+					}
 				}
-			} else if (message == PING_MESSAGE) {
-				std::string hostname = "unknown_host";
-				try {
-					hostname = boost::asio::ip::host_name();
-				} catch (const boost::system::system_error &) {
+				// our own pong, nowhere to dial, or a name we couldn't
+				// put on the wire
+				if (hostname == hostname_ || port == 0 ||
+					!isWireName(hostname)) {
+					continue;
 				}
-
-				std::string response_message = "P2P_PONG|" + hostname;
+				registry_.upsert(hostname, sender_endpoint.address(), port);
+			} else if (message == PING_MESSAGE) {
+				std::string response_message =
+					"P2P_PONG|" + hostname_ + "|" + std::to_string(chat_port_);
 
 				socket_.send_to(boost::asio::buffer(response_message),
 								sender_endpoint);
@@ -104,22 +138,20 @@ void Discovery::receiveLoop() {
 void Discovery::broadcastLoop() {
 	using namespace std::chrono_literals;
 
-	auto broadcast_address = boost::asio::ip::address_v4::broadcast();
-	boost::asio::ip::udp::endpoint broadcast_endpoint(broadcast_address,
-													  DISCOVERY_PORT);
+	std::vector<boost::asio::ip::udp::endpoint> targets = seeds_;
+	if (broadcast_) {
+		targets.emplace_back(boost::asio::ip::address_v4::broadcast(),
+							 local_endpoint_.port());
+	}
 	std::string message = PING_MESSAGE;
 
+	std::unique_lock<std::mutex> lock(running_mutex_);
 	while (running_) {
-		try {
-			socket_.send_to(boost::asio::buffer(message), broadcast_endpoint);
-			std::this_thread::sleep_for(3s);
-		} catch (const boost::system::system_error &e) {
-			// Errors are expected here when the socket is closed.
+		for (const auto &target : targets) {
+			// one unreachable seed doesn't stop the others
+			boost::system::error_code ec;
+			socket_.send_to(boost::asio::buffer(message), target, 0, ec);
 		}
+		running_cv_.wait_for(lock, 3s, [this] { return !running_; });
 	}
 }
-
-std::vector<std::shared_ptr<Peer>> Discovery::getPeers() const {
-	const std::lock_guard<std::mutex> lock(peers_mutex_);
-	return discovered_peers_;
-}
@@ -1,11 +1,45 @@
 #include "network/peer.hpp"
 #include <boost/asio/ip/address.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
 
-Peer::Peer(const std::string &hostname, const std::string &ip_str)
-	: hostname_(hostname), ip_addr_(boost::asio::ip::make_address(ip_str)) {}
+Peer::Peer(const std::string &hostname, const std::string &ip_str,
+		   unsigned short port)
+	: Peer(0, hostname, boost::asio::ip::make_address(ip_str), port) {}
 
-// Getter: return reference to hostname
-const std::string &Peer::getHostname() const { return hostname_; }
+Peer::Peer(std::uint64_t id, const std::string &hostname,
+		   const boost::asio::ip::address &ip_addr, unsigned short port)
+	: id_(id), hostname_(std::make_shared<const std::string>(hostname)),
+	  ip_addr_(ip_addr), port_(port) {}
+
+std::uint64_t Peer::getId() const { return id_; }
+
+// Getter: a copy, the registry may rename the peer meanwhile
+std::string Peer::getHostname() const { return *std::atomic_load(&hostname_); }
 
 // Getter: return IP address by value
 boost::asio::ip::address Peer::getIpAddr() const { return ip_addr_; }
+
+unsigned short Peer::getPort() const { return port_; }
+
+std::chrono::system_clock::time_point Peer::getLastSeen() const {
+	return std::chrono::system_clock::time_point(
+		std::chrono::milliseconds(last_seen_ms_.load()));
+}
+
+void Peer::setHostname(const std::string &hostname) {
+	std::atomic_store(&hostname_,
+					  std::make_shared<const std::string>(hostname));
+}
+
+void Peer::touch(std::chrono::system_clock::time_point seen) {
+	std::int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+						  seen.time_since_epoch())
+						  .count();
+	// only ever moves forward, a cached time doesn't undo a fresh one
+	std::int64_t current = last_seen_ms_.load();
+	while (current < ms &&
+		   !last_seen_ms_.compare_exchange_weak(current, ms)) {
+	}
+}
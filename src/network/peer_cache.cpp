@@ -0,0 +1,133 @@
+#include "network/peer_cache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static long long toSeconds(std::chrono::system_clock::time_point time) {
+	return std::chrono::duration_cast<std::chrono::seconds>(
+			   time.time_since_epoch())
+		.count();
+}
+
+// a damaged file can hold any number, the clock can't
+static bool fitsClock(long long seconds) {
+	using std::chrono::duration_cast;
+	using std::chrono::system_clock;
+	return seconds >= duration_cast<std::chrono::seconds>(
+						  system_clock::duration::min()).count() &&
+		   seconds <= duration_cast<std::chrono::seconds>(
+						  system_clock::duration::max()).count();
+}
+
+static std::chrono::system_clock::time_point fromSeconds(long long seconds) {
+	return std::chrono::system_clock::time_point(std::chrono::seconds(seconds));
+}
+
+PeerCache::PeerCache(const std::string &path, size_t max_entries)
+	: path_(path), max_entries_(max_entries) {
+	// "hostname address port identity last seen last connected" per line,
+	// the identity in hex or - and times in seconds since the epoch
+	std::ifstream file(path_);
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		Entry entry;
+		std::string address;
+		std::string identity_hex;
+		long long last_seen = 0;
+		long long last_connected = 0;
+		if (!(fields >> entry.hostname >> address >> entry.port >>
+			  identity_hex >> last_seen >> last_connected) ||
+			!fitsClock(last_seen) || !fitsClock(last_connected)) {
+			continue;
+		}
+		boost::system::error_code ec;
+		entry.address = boost::asio::ip::make_address(address, ec);
+		if (ec || entry.port == 0) {
+			continue;
+		}
+		entry.has_identity = fromHex(identity_hex, entry.identity.data(),
+									 entry.identity.size());
+		entry.last_seen = fromSeconds(last_seen);
+		entry.last_connected = fromSeconds(last_connected);
+		entries_[entry.hostname] = entry;
+	}
+	trim(max_entries_);
+}
+
+void PeerCache::trim(size_t max) {
+	if (entries_.size() <= max) {
+		return;
+	}
+	std::vector<Entry> newest;
+	for (auto &[hostname, entry] : entries_) {
+		newest.push_back(std::move(entry));
+	}
+	std::nth_element(newest.begin(), newest.begin() + max, newest.end(),
+					 [](const Entry &a, const Entry &b) {
+						 return a.last_seen > b.last_seen;
+					 });
+	newest.resize(max);
+	entries_.clear();
+	for (auto &entry : newest) {
+		entries_[entry.hostname] = std::move(entry);
+	}
+}
+
+PeerCache::Entry &PeerCache::touch(const Peer &peer) {
+	if (!entries_.count(peer.getHostname())) {
+		trim(max_entries_ - 1);
+	}
+	auto &entry = entries_[peer.getHostname()];
+	entry.hostname = peer.getHostname();
+	entry.address = peer.getIpAddr();
+	entry.port = peer.getPort();
+	entry.last_seen = std::chrono::system_clock::now();
+	return entry;
+}
+
+void PeerCache::seen(const Peer &peer) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	// when discovery last heard from it, unless we talked since
+	auto last_seen = peer.getLastSeen();
+	auto it = entries_.find(peer.getHostname());
+	if (it != entries_.end()) {
+		last_seen = std::max(last_seen, it->second.last_seen);
+	}
+	touch(peer).last_seen = last_seen;
+}
+
+void PeerCache::connected(const Peer &peer, const PublicKey &identity) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	auto &entry = touch(peer);
+	entry.has_identity = true;
+	entry.identity = identity;
+	entry.last_connected = entry.last_seen;
+}
+
+std::vector<PeerCache::Entry> PeerCache::getEntries() const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<Entry> entries;
+	for (const auto &[hostname, entry] : entries_) {
+		entries.push_back(entry);
+	}
+	return entries;
+}
+
+void PeerCache::save() const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	std::ofstream file(path_, std::ios::trunc);
+	for (const auto &[hostname, entry] : entries_) {
+		file << hostname << " " << entry.address.to_string() << " "
+			 << entry.port << " "
+			 << (entry.has_identity
+					 ? toHex(entry.identity.data(), entry.identity.size())
+					 : std::string("-"))
+			 << " " << toSeconds(entry.last_seen) << " "
+			 << toSeconds(entry.last_connected) << "\n";
+	}
+}
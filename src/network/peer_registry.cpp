@@ -0,0 +1,212 @@
+#include "network/peer_registry.hpp"
+#include <boost/asio/ip/address.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+
+size_t PeerRegistry::AddressHash::operator()(
+	const boost::asio::ip::address &address) const {
+	if (address.is_v4()) {
+		return std::hash<std::uint32_t>()(address.to_v4().to_uint());
+	}
+	auto bytes = address.to_v6().to_bytes();
+	return std::hash<std::string_view>()(std::string_view(
+		reinterpret_cast<const char *>(bytes.data()), bytes.size()));
+}
+
+bool PeerRegistry::Endpoint::operator==(const Endpoint &other) const {
+	return port == other.port && address == other.address;
+}
+
+size_t PeerRegistry::EndpointHash::operator()(const Endpoint &endpoint) const {
+	return AddressHash()(endpoint.address) * 31 + endpoint.port;
+}
+
+size_t PeerRegistry::IdentityHash::operator()(const PublicKey &key) const {
+	// the key is uniformly random already
+	size_t hash;
+	std::memcpy(&hash, key.data(), sizeof(hash));
+	return hash;
+}
+
+// lookups into a snapshot, nullptr if it isn't there
+template <typename Map, typename Key>
+static std::shared_ptr<Peer> find(const Map &map, const Key &key) {
+	auto it = map.find(key);
+	return it == map.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<Peer> PeerRegistry::Snapshot::findByEndpoint(
+	const boost::asio::ip::address &address, unsigned short port) const {
+	return find(by_endpoint, Endpoint{address, port});
+}
+
+std::shared_ptr<Peer> PeerRegistry::Snapshot::findByAddress(
+	const boost::asio::ip::address &address) const {
+	return find(by_address, address);
+}
+
+std::shared_ptr<Peer>
+PeerRegistry::Snapshot::findByHostname(const std::string &hostname) const {
+	return find(by_hostname, hostname);
+}
+
+std::shared_ptr<Peer>
+PeerRegistry::Snapshot::findByIdentity(const PublicKey &key) const {
+	return find(by_identity, key);
+}
+
+PeerRegistry::PeerRegistry(size_t max_peers)
+	: snapshot_(std::make_shared<const Snapshot>()), max_peers_(max_peers) {}
+
+std::shared_ptr<const PeerRegistry::Snapshot>
+PeerRegistry::getSnapshot() const {
+	return std::atomic_load(&snapshot_);
+}
+
+void PeerRegistry::index(Snapshot &snapshot,
+						 const std::shared_ptr<Peer> &peer) {
+	bool direct = peer->getPort() != 0;
+	std::string hostname = peer->getHostname();
+	if (direct) {
+		snapshot.by_endpoint[{peer->getIpAddr(), peer->getPort()}] = peer;
+	} else {
+		snapshot.remote[hostname] = peer;
+	}
+	auto &by_address = snapshot.by_address[peer->getIpAddr()];
+	if (!by_address || (direct && by_address->getPort() == 0)) {
+		by_address = peer;
+	}
+	auto &by_hostname = snapshot.by_hostname[hostname];
+	if (!by_hostname || (direct && by_hostname->getPort() == 0)) {
+		by_hostname = peer;
+	}
+}
+
+void PeerRegistry::publish(std::shared_ptr<Snapshot> snapshot) {
+	++snapshot->version;
+	std::atomic_store(&snapshot_,
+					  std::shared_ptr<const Snapshot>(std::move(snapshot)));
+}
+
+std::shared_ptr<Peer>
+PeerRegistry::upsert(const std::string &hostname,
+					 const boost::asio::ip::address &address,
+					 unsigned short port,
+					 std::chrono::system_clock::time_point seen) {
+	// the common case, a known peer answering again, doesn't lock
+	auto peer = getSnapshot()->findByEndpoint(address, port);
+	if (peer && peer->getHostname() == hostname) {
+		peer->touch(seen);
+		return peer;
+	}
+
+	const std::lock_guard<std::mutex> lock(write_mutex_);
+	auto current = std::atomic_load(&snapshot_);
+	peer = current->findByEndpoint(address, port);
+	if (peer && peer->getHostname() == hostname) {
+		peer->touch(seen);
+		return peer;
+	}
+	if (!peer && current->peers.size() >= max_peers_) {
+		return nullptr;
+	}
+	auto next = std::make_shared<Snapshot>(*current);
+	if (peer) {
+		// renamed in place, the name indexes are rebuilt around it
+		peer->setHostname(hostname);
+		next->by_hostname.clear();
+		next->remote.clear();
+		for (const auto &known : next->peers) {
+			index(*next, known);
+		}
+	} else {
+		peer = std::make_shared<Peer>(next_id_++, hostname, address, port);
+		next->peers.push_back(peer);
+		index(*next, peer);
+	}
+	peer->touch(seen);
+	publish(std::move(next));
+	return peer;
+}
+
+std::shared_ptr<Peer>
+PeerRegistry::upsertRemote(const std::string &hostname,
+						   const boost::asio::ip::address &address) {
+	// listed by the server or calling in through it counts as heard from
+	auto now = std::chrono::system_clock::now();
+	auto peer = find(getSnapshot()->remote, hostname);
+	if (peer) {
+		peer->touch(now);
+		return peer;
+	}
+
+	const std::lock_guard<std::mutex> lock(write_mutex_);
+	auto current = std::atomic_load(&snapshot_);
+	peer = find(current->remote, hostname);
+	if (peer) {
+		peer->touch(now);
+		return peer;
+	}
+	if (current->peers.size() >= max_peers_) {
+		return nullptr;
+	}
+	auto next = std::make_shared<Snapshot>(*current);
+	peer = std::make_shared<Peer>(next_id_++, hostname, address, 0);
+	peer->touch(now);
+	next->peers.push_back(peer);
+	index(*next, peer);
+	publish(std::move(next));
+	return peer;
+}
+
+size_t PeerRegistry::expire(std::chrono::system_clock::time_point cutoff,
+							const std::set<std::shared_ptr<Peer>> &keep) {
+	auto kept = [&](const std::shared_ptr<Peer> &peer) {
+		return peer->getLastSeen() >= cutoff || keep.count(peer);
+	};
+	const std::lock_guard<std::mutex> lock(write_mutex_);
+	auto current = std::atomic_load(&snapshot_);
+	if (std::all_of(current->peers.begin(), current->peers.end(), kept)) {
+		return 0;
+	}
+	// the rest keep their ids, the indexes are rebuilt without the others
+	auto next = std::make_shared<Snapshot>();
+	next->version = current->version;
+	for (const auto &peer : current->peers) {
+		if (kept(peer)) {
+			next->peers.push_back(peer);
+			index(*next, peer);
+		}
+	}
+	for (const auto &[key, peer] : current->by_identity) {
+		if (std::find(next->peers.begin(), next->peers.end(), peer) !=
+			next->peers.end()) {
+			next->by_identity[key] = peer;
+		}
+	}
+	size_t dropped = current->peers.size() - next->peers.size();
+	publish(std::move(next));
+	return dropped;
+}
+
+void PeerRegistry::bindIdentity(const std::shared_ptr<Peer> &peer,
+								const PublicKey &key) {
+	if (getSnapshot()->findByIdentity(key) == peer) {
+		return;
+	}
+
+	const std::lock_guard<std::mutex> lock(write_mutex_);
+	auto next = std::make_shared<Snapshot>(*std::atomic_load(&snapshot_));
+	next->by_identity[key] = peer;
+	publish(std::move(next));
+}
@@ -0,0 +1,114 @@
+#include "network/relay.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+// double hashing, the second hash is forced odd so every probe differs
+static void bloomHashes(const std::string &id, std::uint64_t &h1,
+						std::uint64_t &h2) {
+	h1 = std::hash<std::string>{}(id);
+	h2 = 1469598103934665603ULL; // FNV-1a
+	for (unsigned char c : id) {
+		h2 = (h2 ^ c) * 1099511628211ULL;
+	}
+	h2 |= 1;
+}
+
+RotatingBloomFilter::RotatingBloomFilter(size_t generation_capacity)
+	: generation_capacity_(generation_capacity) {}
+
+bool RotatingBloomFilter::contains(const std::string &id) const {
+	std::uint64_t h1;
+	std::uint64_t h2;
+	bloomHashes(id, h1, h2);
+	bool in_current = true;
+	bool in_previous = true;
+	for (int i = 0; i < HASHES; ++i) {
+		size_t bit = (h1 + i * h2) % BITS;
+		in_current = in_current && current_.test(bit);
+		in_previous = in_previous && previous_.test(bit);
+	}
+	return in_current || in_previous;
+}
+
+void RotatingBloomFilter::insert(const std::string &id) {
+	if (inserted_ >= generation_capacity_) {
+		previous_ = current_;
+		current_.reset();
+		inserted_ = 0;
+	}
+	std::uint64_t h1;
+	std::uint64_t h2;
+	bloomHashes(id, h1, h2);
+	for (int i = 0; i < HASHES; ++i) {
+		current_.set((h1 + i * h2) % BITS);
+	}
+	++inserted_;
+}
+
+RelayStore::RelayStore(size_t max_envelopes, size_t max_bytes,
+					   std::chrono::system_clock::duration max_lifetime)
+	: max_envelopes_(max_envelopes), max_bytes_(max_bytes),
+	  max_lifetime_(max_lifetime) {}
+
+bool RelayStore::markSeen(const std::string &id) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	if (seen_.contains(id)) {
+		return false;
+	}
+	seen_.insert(id);
+	return true;
+}
+
+void RelayStore::dropExpired() {
+	auto now = std::chrono::system_clock::now();
+	auto it = envelopes_.begin();
+	while (it != envelopes_.end()) {
+		if (now >= it->until) {
+			bytes_ -= it->envelope.sealed.size();
+			it = envelopes_.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void RelayStore::store(const Envelope &envelope) {
+	if (envelope.sealed.size() > max_bytes_) {
+		return;
+	}
+	const std::lock_guard<std::mutex> lock(mutex_);
+	dropExpired();
+	envelopes_.push_back({envelope, std::min(envelope.expires,
+											 std::chrono::system_clock::now() +
+												 max_lifetime_)});
+	bytes_ += envelope.sealed.size();
+	while (envelopes_.size() > max_envelopes_ || bytes_ > max_bytes_) {
+		bytes_ -= envelopes_.front().envelope.sealed.size();
+		envelopes_.pop_front();
+	}
+}
+
+std::vector<Envelope> RelayStore::takeFor(const std::string &recipient) {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	dropExpired();
+	std::vector<Envelope> taken;
+	auto it = envelopes_.begin();
+	while (it != envelopes_.end()) {
+		if (it->envelope.recipient == recipient) {
+			bytes_ -= it->envelope.sealed.size();
+			taken.push_back(std::move(it->envelope));
+			it = envelopes_.erase(it);
+		} else {
+			++it;
+		}
+	}
+	return taken;
+}
+
+size_t RelayStore::size() const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	return envelopes_.size();
+}
@@ -0,0 +1,303 @@
+#include "network/rendezvous.hpp"
+#include "network/udp_stream.hpp"
+#include <chrono>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using boost::asio::ip::udp;
+
+// server protocol, one text datagram per message:
+//   REGISTER|name             -> REGISTERED|public ip:port
+//   LIST                      -> PEERS|name@ip,name@ip
+//   CONNECT|session|from|to|candidates (from the dialer's session socket)
+//                             -> INVITE|session|from to the target
+//   ACCEPT|session|candidates (from the target's session socket)
+//                             -> PEER|session|candidates to both ends
+//   RELAY|session|payload     -> forwarded to the other end of the session
+//   ERROR|session|reason
+//   ERROR||reason             a REGISTER was refused
+// only registered nodes are answered, session sockets have to share the
+// address their node's control socket registered from
+constexpr std::chrono::seconds REGISTER_INTERVAL(15);
+constexpr std::chrono::milliseconds REQUEST_RETRY(500);
+constexpr std::chrono::seconds REQUEST_TIMEOUT(5);
+constexpr std::chrono::milliseconds PUNCH_INTERVAL(100);
+constexpr std::chrono::seconds PUNCH_TIMEOUT(3);
+constexpr size_t MAX_DATAGRAM_SIZE = 2048;
+
+static std::vector<std::string> splitFields(const std::string &line,
+											char separator) {
+	std::vector<std::string> fields;
+	std::istringstream stream(line);
+	std::string field;
+	while (std::getline(stream, field, separator)) {
+		fields.push_back(field);
+	}
+	return fields;
+}
+
+static std::string endpointString(const udp::endpoint &endpoint) {
+	return endpoint.address().to_string() + ":" +
+		   std::to_string(endpoint.port());
+}
+
+static udp::endpoint parseEndpoint(const std::string &text) {
+	size_t colon = text.rfind(':');
+	if (colon == std::string::npos) {
+		throw std::invalid_argument("malformed endpoint");
+	}
+	return udp::endpoint(boost::asio::ip::make_address(text.substr(0, colon)),
+						 static_cast<unsigned short>(
+							 std::stoi(text.substr(colon + 1))));
+}
+
+// our own interface addresses with the socket's port, so peers on the same
+// network behind the same NAT can reach us without hairpinning
+static std::string localCandidates(const udp::socket &socket) {
+	unsigned short port = socket.local_endpoint().port();
+	std::string candidates;
+	ifaddrs *interfaces = nullptr;
+	if (getifaddrs(&interfaces) != 0) {
+		return candidates;
+	}
+	for (ifaddrs *it = interfaces; it; it = it->ifa_next) {
+		if (!it->ifa_addr || it->ifa_addr->sa_family != AF_INET) {
+			continue;
+		}
+		auto *in = reinterpret_cast<sockaddr_in *>(it->ifa_addr);
+		boost::asio::ip::address_v4 address(ntohl(in->sin_addr.s_addr));
+		if (address.is_loopback()) {
+			continue;
+		}
+		candidates += (candidates.empty() ? "" : ",") +
+					  endpointString(udp::endpoint(address, port));
+	}
+	freeifaddrs(interfaces);
+	return candidates;
+}
+
+static std::string receiveText(udp::socket &socket, udp::endpoint &sender) {
+	char buffer[MAX_DATAGRAM_SIZE];
+	boost::system::error_code ec;
+	size_t len = socket.receive_from(boost::asio::buffer(buffer), sender, 0, ec);
+	return ec ? std::string() : std::string(buffer, len);
+}
+
+static udp::socket openSocket(boost::asio::io_context &io_ctx) {
+	return udp::socket(io_ctx, udp::endpoint(udp::v4(), 0));
+}
+
+RendezvousClient::RendezvousClient(
+	boost::asio::io_context &io_ctx, const udp::endpoint &server,
+	const std::string &name,
+	std::function<void(const std::string &, std::unique_ptr<Stream>)>
+		on_incoming)
+	: io_ctx_(io_ctx), server_(server), name_(name),
+	  control_(openSocket(io_ctx)), on_incoming_(on_incoming) {}
+
+RendezvousClient::~RendezvousClient() { stop(); }
+
+void RendezvousClient::start() {
+	running_ = true;
+	control_thread_ = std::thread(&RendezvousClient::controlLoop, this);
+}
+
+void RendezvousClient::stop() {
+	running_ = false;
+	if (control_thread_.joinable()) {
+		control_thread_.join();
+	}
+	std::vector<std::thread> invite_threads;
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		invite_threads.swap(invite_threads_);
+	}
+	for (auto &thread : invite_threads) {
+		thread.join();
+	}
+	boost::system::error_code ec;
+	control_.close(ec);
+}
+
+std::vector<std::pair<std::string, boost::asio::ip::address>>
+RendezvousClient::getPeers() const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	return peers_;
+}
+
+// re-registers often enough to keep our NAT mapping to the server open,
+// and waits for introductions in between
+void RendezvousClient::controlLoop() {
+	auto next_register = std::chrono::steady_clock::now();
+	while (running_) {
+		auto now = std::chrono::steady_clock::now();
+		if (now >= next_register) {
+			boost::system::error_code ec;
+			control_.send_to(boost::asio::buffer("REGISTER|" + name_), server_,
+							 0, ec);
+			control_.send_to(boost::asio::buffer(std::string("LIST")), server_,
+							 0, ec);
+			next_register = now + REGISTER_INTERVAL;
+		}
+		if (!waitReadable(control_, std::chrono::milliseconds(200))) {
+			continue;
+		}
+
+		udp::endpoint sender;
+		std::string message = receiveText(control_, sender);
+		if (sender != server_) {
+			continue;
+		}
+		auto fields = splitFields(message, '|');
+		if (fields.empty()) {
+			continue;
+		}
+
+		if (fields[0] == "PEERS") {
+			std::vector<std::pair<std::string, boost::asio::ip::address>> peers;
+			if (fields.size() > 1) {
+				for (const auto &entry : splitFields(fields[1], ',')) {
+					size_t at = entry.find('@');
+					boost::system::error_code ec;
+					auto address =
+						boost::asio::ip::make_address(entry.substr(at + 1), ec);
+					if (at == std::string::npos || ec ||
+						entry.substr(0, at) == name_) {
+						continue;
+					}
+					peers.push_back({entry.substr(0, at), address});
+				}
+			}
+			const std::lock_guard<std::mutex> lock(mutex_);
+			peers_ = std::move(peers);
+		} else if (fields[0] == "INVITE" && fields.size() == 3) {
+			const std::lock_guard<std::mutex> lock(mutex_);
+			if (!invited_sessions_.insert(fields[1]).second) {
+				continue;
+			}
+			invite_threads_.emplace_back(&RendezvousClient::acceptInvite, this,
+										 fields[1], fields[2]);
+		}
+	}
+}
+
+void RendezvousClient::acceptInvite(const std::string &session,
+									const std::string &from) {
+	try {
+		auto socket = openSocket(io_ctx_);
+		auto candidates = exchangeCandidates(
+			socket, "ACCEPT|" + session + "|" + localCandidates(socket),
+			session);
+		auto stream = punch(std::move(socket), session, candidates);
+		if (on_incoming_) {
+			on_incoming_(from, std::move(stream));
+		}
+	} catch (const std::exception &e) {
+		// the dialer gave up or the server went away
+	}
+}
+
+std::unique_ptr<Stream> RendezvousClient::connect(const std::string &name) {
+	std::random_device rd;
+	std::string session = std::to_string(rd()) + std::to_string(rd());
+	auto socket = openSocket(io_ctx_);
+	auto candidates = exchangeCandidates(
+		socket,
+		"CONNECT|" + session + "|" + name_ + "|" + name + "|" +
+			localCandidates(socket),
+		session);
+	return punch(std::move(socket), session, candidates);
+}
+
+std::vector<udp::endpoint>
+RendezvousClient::exchangeCandidates(udp::socket &socket,
+									 const std::string &request,
+									 const std::string &session) {
+	auto deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+	while (std::chrono::steady_clock::now() < deadline) {
+		boost::system::error_code ec;
+		socket.send_to(boost::asio::buffer(request), server_, 0, ec);
+		if (!waitReadable(socket, REQUEST_RETRY)) {
+			continue;
+		}
+		udp::endpoint sender;
+		auto fields = splitFields(receiveText(socket, sender), '|');
+		if (sender != server_ || fields.size() < 2 || fields[1] != session) {
+			continue;
+		}
+		if (fields[0] == "ERROR") {
+			throw std::runtime_error(fields.size() > 2 ? fields[2]
+													   : "rendezvous error");
+		}
+		if (fields[0] == "PEER" && fields.size() == 3) {
+			std::vector<udp::endpoint> candidates;
+			for (const auto &candidate : splitFields(fields[2], ',')) {
+				try {
+					candidates.push_back(parseEndpoint(candidate));
+				} catch (const std::exception &e) {
+					// skip malformed candidates
+				}
+			}
+			if (candidates.empty()) {
+				throw std::runtime_error("peer sent no candidates");
+			}
+			return candidates;
+		}
+	}
+	throw std::runtime_error("rendezvous server did not answer");
+}
+
+// both ends run this at the same time. the first candidate that answers
+// becomes the path, the first candidate is the address the server saw and
+// is also where relayed traffic claims to come from
+std::unique_ptr<Stream>
+RendezvousClient::punch(udp::socket socket, const std::string &session,
+						const std::vector<udp::endpoint> &candidates) {
+	const std::string punch_message = "PUNCH|" + session;
+	const std::string ack_message = "PUNCH_ACK|" + session;
+	const std::string relay_prefix = "RELAY|" + session + "|";
+
+	auto deadline = std::chrono::steady_clock::now() + PUNCH_TIMEOUT;
+	auto next_punch = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() < deadline) {
+		boost::system::error_code ec;
+		if (std::chrono::steady_clock::now() >= next_punch) {
+			for (const auto &candidate : candidates) {
+				socket.send_to(boost::asio::buffer(punch_message), candidate, 0,
+							   ec);
+			}
+			next_punch += PUNCH_INTERVAL;
+		}
+		if (!waitReadable(socket, std::chrono::milliseconds(20))) {
+			continue;
+		}
+
+		udp::endpoint sender;
+		std::string message = receiveText(socket, sender);
+		if (sender == server_ && message.rfind(relay_prefix, 0) == 0) {
+			// the other end already gave up punching
+			return std::make_unique<UdpStream>(std::move(socket),
+											   candidates.front(), server_,
+											   session, true);
+		}
+		bool from_candidate = false;
+		for (const auto &candidate : candidates) {
+			from_candidate = from_candidate || candidate == sender;
+		}
+		if (!from_candidate) {
+			continue;
+		}
+		if (message == punch_message) {
+			socket.send_to(boost::asio::buffer(ack_message), sender, 0, ec);
+		}
+		// anything from the peer proves the path works, a stream segment
+		// that raced ahead of its ack is simply retransmitted
+		return std::make_unique<UdpStream>(std::move(socket), sender, server_,
+										   session, false);
+	}
+	return std::make_unique<UdpStream>(std::move(socket), candidates.front(),
+									   server_, session, true);
+}
@@ -0,0 +1,62 @@
+#include "network/stream.hpp"
+#include <boost/asio/write.hpp>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+using boost::asio::ip::tcp;
+
+TcpStream::TcpStream(tcp::socket socket) : socket_(std::move(socket)) {
+	// every frame is written whole, so waiting to coalesce small ones only
+	// holds a message back behind the ack for a heartbeat
+	boost::system::error_code ec;
+	socket_.set_option(tcp::no_delay(true), ec);
+}
+
+size_t TcpStream::readSome(std::uint8_t *data, size_t len) {
+	return socket_.read_some(boost::asio::buffer(data, len));
+}
+
+void TcpStream::write(const std::uint8_t *data, size_t len) {
+	boost::asio::write(socket_, boost::asio::buffer(data, len));
+}
+
+void TcpStream::shutdownSend() {
+	boost::system::error_code ec;
+	socket_.shutdown(tcp::socket::shutdown_send, ec);
+}
+
+void TcpStream::shutdown() {
+	boost::system::error_code ec;
+	socket_.shutdown(tcp::socket::shutdown_both, ec);
+}
+
+void TcpStream::close() {
+	boost::system::error_code ec;
+	socket_.close(ec);
+}
+
+void TcpStream::setDeadTimeout(std::chrono::milliseconds timeout) {
+	int fd = socket_.native_handle();
+	int keepalive = timeout.count() > 0;
+	::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+	if (!keepalive) {
+		return;
+	}
+	// idle for half the timeout, then three probes over the other half
+	int seconds = static_cast<int>(
+		std::chrono::duration_cast<std::chrono::seconds>(timeout).count());
+	int idle = std::max(1, seconds / 2);
+	int interval = std::max(1, (seconds - idle) / 3);
+	int probes = 3;
+	unsigned int user_timeout = static_cast<unsigned int>(std::min<long long>(
+		timeout.count(), std::numeric_limits<unsigned int>::max()));
+	::setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+	::setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+	::setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+	::setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout,
+				 sizeof(user_timeout));
+}
@@ -0,0 +1,42 @@
+#include "network/token_bucket.hpp"
+#include <algorithm>
+#include <chrono>
+
+TokenBucket::TokenBucket(double rate, double burst)
+	: rate_(rate), burst_(burst), tokens_(burst),
+	  last_refill_(std::chrono::steady_clock::now()) {}
+
+void TokenBucket::refill(std::chrono::steady_clock::time_point now) {
+	if (now <= last_refill_) {
+		return;
+	}
+	std::chrono::duration<double> elapsed = now - last_refill_;
+	tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+	last_refill_ = now;
+}
+
+bool TokenBucket::take(double n, std::chrono::steady_clock::time_point now) {
+	if (rate_ <= 0) {
+		return true;
+	}
+	refill(now);
+	if (tokens_ < std::min(n, burst_)) {
+		return false;
+	}
+	tokens_ -= n;
+	return true;
+}
+
+std::chrono::steady_clock::duration
+TokenBucket::waitFor(double n, std::chrono::steady_clock::time_point now) {
+	if (rate_ <= 0) {
+		return std::chrono::steady_clock::duration::zero();
+	}
+	refill(now);
+	double missing = std::min(n, burst_) - tokens_;
+	if (missing <= 0) {
+		return std::chrono::steady_clock::duration::zero();
+	}
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(missing / rate_));
+}
@@ -0,0 +1,416 @@
+#include "network/udp_stream.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+
+using boost::asio::ip::udp;
+
+// kind, sequence, cumulative ack, receive window
+constexpr size_t SEGMENT_HEADER_SIZE = 13;
+constexpr size_t MAX_SEGMENT_PAYLOAD = 1200;
+constexpr size_t MAX_DATAGRAM_SIZE = 2048;
+constexpr size_t WINDOW_SEGMENTS = 64;
+// bytes delivered in order but not read yet, past it the window closes
+constexpr size_t RECEIVE_BUFFER_LIMIT = 4 * WINDOW_SEGMENTS * MAX_SEGMENT_PAYLOAD;
+constexpr int MAX_TRANSMISSIONS = 12;
+constexpr int DUPLICATE_ACK_THRESHOLD = 3;
+constexpr double MIN_RTO_MS = 100;
+constexpr double MAX_RTO_MS = 4000;
+constexpr int MAX_BACKOFF = 6;
+constexpr std::chrono::milliseconds TICK(10);
+// keeps the NAT mapping open while nothing else is sent
+constexpr std::chrono::seconds KEEPALIVE_INTERVAL(15);
+
+constexpr std::uint8_t SEGMENT_DATA = 1;
+constexpr std::uint8_t SEGMENT_ACK = 2;
+constexpr std::uint8_t SEGMENT_FIN = 3;
+// asks for an ack while the peer's window is closed, in case the ack that
+// opened it was lost
+constexpr std::uint8_t SEGMENT_PROBE = 4;
+
+// sequence comparison that survives wraparound
+static bool before(std::uint32_t a, std::uint32_t b) {
+	return static_cast<std::int32_t>(a - b) < 0;
+}
+
+static void writeUint32(std::uint8_t *out, std::uint32_t value) {
+	out[0] = static_cast<std::uint8_t>(value >> 24);
+	out[1] = static_cast<std::uint8_t>(value >> 16);
+	out[2] = static_cast<std::uint8_t>(value >> 8);
+	out[3] = static_cast<std::uint8_t>(value);
+}
+
+static std::uint32_t readUint32(const std::uint8_t *in) {
+	return (static_cast<std::uint32_t>(in[0]) << 24) |
+		   (static_cast<std::uint32_t>(in[1]) << 16) |
+		   (static_cast<std::uint32_t>(in[2]) << 8) | in[3];
+}
+
+bool waitReadable(udp::socket &socket, std::chrono::milliseconds timeout) {
+	pollfd fd{socket.native_handle(), POLLIN, 0};
+	return ::poll(&fd, 1, static_cast<int>(timeout.count())) > 0;
+}
+
+UdpStream::UdpStream(udp::socket socket, const udp::endpoint &remote,
+					 const udp::endpoint &relay, const std::string &session,
+					 bool relayed)
+	: socket_(std::move(socket)), remote_(remote), relay_(relay),
+	  relay_prefix_("RELAY|" + session + "|"), relayed_(relayed),
+	  last_sent_(Clock::now()), peer_window_(WINDOW_SEGMENTS),
+	  advertised_window_(receiveWindow()) {
+	io_thread_ = std::thread(&UdpStream::ioLoop, this);
+}
+
+UdpStream::~UdpStream() { close(); }
+
+void UdpStream::ioLoop() {
+	std::vector<std::uint8_t> buffer(MAX_DATAGRAM_SIZE);
+	while (true) {
+		{
+			const std::lock_guard<std::mutex> lock(mutex_);
+			if (stopping_) {
+				return;
+			}
+			retransmitExpired();
+		}
+		if (!waitReadable(socket_, TICK)) {
+			continue;
+		}
+		udp::endpoint sender;
+		boost::system::error_code ec;
+		size_t len =
+			socket_.receive_from(boost::asio::buffer(buffer), sender, 0, ec);
+		if (!ec) {
+			handleDatagram(buffer.data(), len, sender);
+		}
+	}
+}
+
+void UdpStream::handleDatagram(const std::uint8_t *data, size_t len,
+							   const udp::endpoint &sender) {
+	std::string text(reinterpret_cast<const char *>(data),
+					 std::min(len, relay_prefix_.size()));
+
+	if (sender == relay_ && text == relay_prefix_) {
+		// the peer is relaying, follow it there
+		const std::lock_guard<std::mutex> lock(mutex_);
+		relayed_ = true;
+		data += relay_prefix_.size();
+		len -= relay_prefix_.size();
+	} else if (sender == remote_ && text.rfind("PUNCH|", 0) == 0) {
+		// the peer is still punching and missed our answer
+		const std::lock_guard<std::mutex> lock(mutex_);
+		std::string reply =
+			"PUNCH_ACK|" + std::string(reinterpret_cast<const char *>(data) + 6,
+									   len - 6);
+		boost::system::error_code ec;
+		socket_.send_to(boost::asio::buffer(reply), remote_, 0, ec);
+		return;
+	} else if (sender != remote_) {
+		return;
+	}
+	handleSegment(data, len);
+}
+
+void UdpStream::handleSegment(const std::uint8_t *data, size_t len) {
+	if (len < SEGMENT_HEADER_SIZE || data[0] < SEGMENT_DATA ||
+		data[0] > SEGMENT_PROBE) {
+		return;
+	}
+	std::uint8_t kind = data[0];
+	std::uint32_t sequence = readUint32(data + 1);
+	std::uint32_t ack = readUint32(data + 5);
+	std::uint32_t window = readUint32(data + 9);
+	auto now = Clock::now();
+
+	const std::lock_guard<std::mutex> lock(mutex_);
+
+	// acks can arrive out of order, only the latest one says how much room
+	// the peer has
+	if (!before(ack, peer_ack_)) {
+		peer_ack_ = ack;
+		if (window != peer_window_) {
+			peer_window_ = window;
+			writable_cv_.notify_all();
+		}
+	}
+
+	// everything before ack has arrived
+	bool acked = false;
+	Segment newest;
+	while (!unacked_.empty() && before(unacked_.begin()->first, ack)) {
+		newest = std::move(unacked_.begin()->second);
+		unacked_.erase(unacked_.begin());
+		acked = true;
+	}
+	// one round trip sample per ack, from the newest segment it covers.
+	// resent segments are ambiguous (Karn) and an ack for anything sent
+	// before the last resend may have been held back by that hole
+	if (acked && newest.transmissions == 1 &&
+		newest.sent_at > last_retransmit_) {
+		double sample =
+			std::chrono::duration<double, std::milli>(now - newest.sent_at)
+				.count();
+		if (!has_rtt_) {
+			srtt_ = sample;
+			rttvar_ = sample / 2;
+			has_rtt_ = true;
+		} else {
+			rttvar_ = 0.75 * rttvar_ + 0.25 * std::abs(srtt_ - sample);
+			srtt_ = 0.875 * srtt_ + 0.125 * sample;
+		}
+		rto_ = std::clamp(srtt_ + 4 * rttvar_, MIN_RTO_MS, MAX_RTO_MS);
+	}
+	if (acked) {
+		// forward progress, the path is alive so the backoff is dropped
+		duplicate_acks_ = 0;
+		backoff_ = 0;
+		timer_started_ = now;
+		// a partial ack during recovery points at the next hole
+		if (recovering_ && !unacked_.empty() && before(ack, recovery_point_)) {
+			retransmitFirst();
+		} else {
+			recovering_ = false;
+		}
+		writable_cv_.notify_all();
+	} else if (kind == SEGMENT_ACK && !unacked_.empty() &&
+			   unacked_.begin()->first == ack &&
+			   ++duplicate_acks_ == DUPLICATE_ACK_THRESHOLD) {
+		// the peer keeps asking for the same segment, resend it without
+		// waiting for the timer (fast retransmit). a resend lost during
+		// recovery is caught the same way
+		if (!recovering_) {
+			recovering_ = true;
+			recovery_point_ = next_sequence_;
+		}
+		retransmitFirst();
+	}
+
+	if (kind == SEGMENT_ACK) {
+		return;
+	}
+	if (kind == SEGMENT_PROBE) {
+		sendAck();
+		return;
+	}
+
+	// data and fin take a sequence number, keep them until they are next
+	if (!before(sequence, expected_) &&
+		before(sequence, expected_ + 4 * WINDOW_SEGMENTS)) {
+		if (kind == SEGMENT_FIN) {
+			fin_received_ = true;
+			fin_sequence_ = sequence;
+		} else {
+			out_of_order_.emplace(
+				sequence, std::vector<std::uint8_t>(data + SEGMENT_HEADER_SIZE,
+													data + len));
+		}
+	}
+	if (deliverInOrder()) {
+		readable_cv_.notify_all();
+	}
+	// duplicates are acked too, our previous ack may have been lost
+	sendAck();
+}
+
+bool UdpStream::deliverInOrder() {
+	// a full buffer stops expected_, so nothing past it is acked until the
+	// reader catches up
+	bool delivered = false;
+	while (received_.size() < RECEIVE_BUFFER_LIMIT) {
+		auto next = out_of_order_.find(expected_);
+		if (next != out_of_order_.end()) {
+			received_.insert(received_.end(), next->second.begin(),
+							 next->second.end());
+			out_of_order_.erase(next);
+		} else if (fin_received_ && fin_sequence_ == expected_) {
+			peer_finished_ = true;
+		} else {
+			break;
+		}
+		++expected_;
+		delivered = true;
+	}
+	return delivered;
+}
+
+std::uint32_t UdpStream::receiveWindow() const {
+	if (received_.size() >= RECEIVE_BUFFER_LIMIT) {
+		return 0;
+	}
+	return static_cast<std::uint32_t>((RECEIVE_BUFFER_LIMIT - received_.size()) /
+									  MAX_SEGMENT_PAYLOAD);
+}
+
+void UdpStream::writeHeader(std::uint8_t *header, std::uint8_t kind,
+							std::uint32_t sequence) {
+	header[0] = kind;
+	writeUint32(header + 1, sequence);
+	writeUint32(header + 5, expected_);
+	advertised_window_ = receiveWindow();
+	writeUint32(header + 9, advertised_window_);
+}
+
+void UdpStream::queueSegment(std::uint8_t kind, const std::uint8_t *data,
+							 size_t len) {
+	Segment segment;
+	segment.datagram.resize(SEGMENT_HEADER_SIZE + len);
+	writeHeader(segment.datagram.data(), kind, next_sequence_);
+	if (len > 0) {
+		std::memcpy(&segment.datagram[SEGMENT_HEADER_SIZE], data, len);
+	}
+	segment.sent_at = Clock::now();
+	segment.transmissions = 1;
+	if (unacked_.empty()) {
+		timer_started_ = segment.sent_at;
+	}
+	transmit(segment.datagram);
+	unacked_.emplace(next_sequence_++, std::move(segment));
+}
+
+void UdpStream::sendAck() {
+	std::vector<std::uint8_t> datagram(SEGMENT_HEADER_SIZE);
+	writeHeader(datagram.data(), SEGMENT_ACK, next_sequence_);
+	transmit(datagram);
+}
+
+void UdpStream::sendProbe() {
+	std::vector<std::uint8_t> datagram(SEGMENT_HEADER_SIZE);
+	writeHeader(datagram.data(), SEGMENT_PROBE, next_sequence_);
+	transmit(datagram);
+	last_probe_ = Clock::now();
+}
+
+void UdpStream::transmit(const std::vector<std::uint8_t> &datagram) {
+	boost::system::error_code ec;
+	if (relayed_) {
+		std::vector<std::uint8_t> wrapped(relay_prefix_.begin(),
+										  relay_prefix_.end());
+		wrapped.insert(wrapped.end(), datagram.begin(), datagram.end());
+		socket_.send_to(boost::asio::buffer(wrapped), relay_, 0, ec);
+	} else {
+		socket_.send_to(boost::asio::buffer(datagram), remote_, 0, ec);
+	}
+	last_sent_ = Clock::now();
+}
+
+void UdpStream::retransmitFirst() {
+	Segment &segment = unacked_.begin()->second;
+	// the ack and window in a resent segment are refreshed too
+	writeHeader(segment.datagram.data(), segment.datagram[0],
+				unacked_.begin()->first);
+	transmit(segment.datagram);
+	segment.sent_at = Clock::now();
+	timer_started_ = segment.sent_at;
+	last_retransmit_ = segment.sent_at;
+	++segment.transmissions;
+	duplicate_acks_ = 0;
+}
+
+void UdpStream::retransmitExpired() {
+	auto now = Clock::now();
+	// a single timer runs for the oldest unacked segment, the rest of the
+	// window follows through partial acks
+	if (!unacked_.empty()) {
+		auto age =
+			std::chrono::duration<double, std::milli>(now - timer_started_);
+		if (age.count() >= std::min(rto_ * (1 << backoff_), MAX_RTO_MS)) {
+			if (unacked_.begin()->second.transmissions >= MAX_TRANSMISSIONS) {
+				failed_ = true;
+				readable_cv_.notify_all();
+				writable_cv_.notify_all();
+				return;
+			}
+			recovering_ = true;
+			recovery_point_ = next_sequence_;
+			retransmitFirst();
+			backoff_ = std::min(backoff_ + 1, MAX_BACKOFF);
+		}
+	}
+	if (unacked_.empty() && peer_window_ == 0 &&
+		std::chrono::duration<double, std::milli>(now - last_probe_).count() >=
+			rto_) {
+		sendProbe();
+	}
+	if (unacked_.empty() && now - last_sent_ >= KEEPALIVE_INTERVAL) {
+		sendAck();
+	}
+}
+
+size_t UdpStream::readSome(std::uint8_t *data, size_t len) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	readable_cv_.wait(lock, [this] {
+		return !received_.empty() || peer_finished_ || failed_ || shut_;
+	});
+	if (received_.empty() || shut_) {
+		throw std::runtime_error("udp stream closed");
+	}
+	size_t n = std::min(len, received_.size());
+	std::copy(received_.begin(), received_.begin() + n, data);
+	received_.erase(received_.begin(), received_.begin() + n);
+	// segments held back by a full buffer move up, and once half a window
+	// is free again the peer hears of it without waiting for a probe
+	deliverInOrder();
+	if (advertised_window_ < WINDOW_SEGMENTS &&
+		receiveWindow() >= advertised_window_ + WINDOW_SEGMENTS / 2) {
+		sendAck();
+	}
+	return n;
+}
+
+void UdpStream::write(const std::uint8_t *data, size_t len) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (len > 0) {
+		writable_cv_.wait(lock, [this] {
+			return unacked_.size() <
+					   std::min<size_t>(WINDOW_SEGMENTS, peer_window_) ||
+				   failed_ || shut_;
+		});
+		if (failed_ || shut_ || send_closed_) {
+			throw std::runtime_error("udp stream closed");
+		}
+		size_t n = std::min(len, MAX_SEGMENT_PAYLOAD);
+		queueSegment(SEGMENT_DATA, data, n);
+		data += n;
+		len -= n;
+	}
+}
+
+void UdpStream::shutdownSend() {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	if (send_closed_ || failed_ || shut_) {
+		return;
+	}
+	send_closed_ = true;
+	queueSegment(SEGMENT_FIN, nullptr, 0);
+}
+
+void UdpStream::shutdown() {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	shut_ = true;
+	readable_cv_.notify_all();
+	writable_cv_.notify_all();
+}
+
+void UdpStream::close() {
+	{
+		const std::lock_guard<std::mutex> lock(mutex_);
+		shut_ = true;
+		stopping_ = true;
+		readable_cv_.notify_all();
+		writable_cv_.notify_all();
+	}
+	if (io_thread_.joinable() &&
+		io_thread_.get_id() != std::this_thread::get_id()) {
+		io_thread_.join();
+	}
+	boost::system::error_code ec;
+	socket_.close(ec);
+}
+
+bool UdpStream::isRelayed() const {
+	const std::lock_guard<std::mutex> lock(mutex_);
+	return relayed_;
+}
@@ -6,15 +6,49 @@
 #include <ftxui/dom/elements.hpp>
 #include <ftxui/screen/color.hpp>
 #include <ftxui/screen/terminal.hpp>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+// messages built above the viewport, so a slightly stale viewport size
+// never leaves a gap
+constexpr size_t OVERSCAN = 8;
+constexpr int WHEEL_LINES = 3;
+
 ChatWindow::ChatWindow(App *app) : app_(app), input_text_("") {
 	input_component_ = ftxui::Input(&input_text_, "Type here..");
 
 	// event handler
-	input_component_ |= ftxui::CatchEvent([this](const ftxui::Event &event) {
+	input_component_ |= ftxui::CatchEvent([this](ftxui::Event event) {
 		if (event == ftxui::Event::Return && input_text_ != "") {
-			app_->sendMessageToSelected(input_text_);
+			// "/group host host ..." starts a group chat with those peers
+			if (input_text_.rfind("/group ", 0) == 0) {
+				std::istringstream hostnames(input_text_.substr(7));
+				std::vector<std::string> members;
+				std::string hostname;
+				while (hostnames >> hostname) {
+					members.push_back(hostname);
+				}
+				if (!members.empty()) {
+					try {
+						app_->createGroup(members);
+					} catch (const std::invalid_argument &e) {
+						app_->setStatusMessage(
+							std::string("Group not created: ") + e.what());
+					}
+				}
+			} else if (input_text_.rfind("/export ", 0) == 0) {
+				// "/export path" archives every conversation to path
+				app_->exportHistory(input_text_.substr(8));
+			} else if (input_text_.rfind("/import ", 0) == 0) {
+				app_->importHistory(input_text_.substr(8));
+			} else {
+				app_->sendMessageToSelected(input_text_);
+			}
+			// show our own message in the frame drawn after this event
+			app_->publishView();
 			input_text_.clear();
 			return true;
 		}
@@ -23,55 +57,66 @@ ChatWindow::ChatWindow(App *app) : app_(app), input_text_("") {
 			peer_list_->TakeFocus();
 			return true;
 		}
+
+		// scrollback
+		if (event == ftxui::Event::PageUp) {
+			scroll(viewportHeight());
+			return true;
+		}
+		if (event == ftxui::Event::PageDown) {
+			scroll(-viewportHeight());
+			return true;
+		}
+		if (event.is_mouse() &&
+			event.mouse().button == ftxui::Mouse::WheelUp) {
+			scroll(WHEEL_LINES);
+			return true;
+		}
+		if (event.is_mouse() &&
+			event.mouse().button == ftxui::Mouse::WheelDown) {
+			scroll(-WHEEL_LINES);
+			return true;
+		}
 		return false;
 	});
 
 	container_ = ftxui::Renderer(input_component_, [this]() {
 		ftxui::Elements elements;
 
+		// one snapshot per frame, no locks taken while drawing
+		auto view = app_->getView();
 		auto selected = app_->getSelectedPeer();
-		auto status = app_->getStatusMessage();
-
-		// set title to hostname of peer
-		auto title = ftxui::text(selected ? selected->getHostname()
-										  : "No user selected") |
-					 ftxui::bold | ftxui::center;
+		auto selected_group = app_->getSelectedGroup();
+		const auto &status = view->status;
+		hostname_ = view->hostname;
+
+		// set title to hostname of peer, or the members of the group
+		std::string title_text = selected ? selected->getHostname()
+										  : "No user selected";
+		if (!selected_group.empty()) {
+			title_text = "Group:";
+			if (const auto *group = view->findGroup(selected_group)) {
+				for (const auto &member : group->members) {
+					title_text += " " + member;
+				}
+			}
+		}
+		auto title = ftxui::text(title_text) | ftxui::bold | ftxui::center;
 
 		auto status_display = ftxui::text(status);
 		status_display |= ftxui::color(ftxui::Color::Red);
 
 		// messages area
-		auto messages = ftxui::text("Messages will appear here") | ftxui::dim;
-		ftxui::Element messages_display;
-		const auto &message_history = app_->getMessageHistory(selected);
-
-		if (!message_history.empty()) {
-			ftxui::Elements message_elements;
-			for (const auto &msg : message_history) {
-				auto sender_element = ftxui::text(msg.sender) | ftxui::bold;
-				auto content_element = ftxui::text(": " + msg.content);
-				auto time_elemenet =
-					ftxui::text(" [" + msg.getFormattedTime() + "]") |
-					ftxui::color(ftxui::Color(ftxui::Color::GrayDark));
-
-				if (msg.sender == "You") {
-					sender_element |= ftxui::color(ftxui::Color::Green);
-				} else {
-					sender_element |= ftxui::color(ftxui::Color::Cyan);
-				}
-
-				auto line = ftxui::hbox({
-					sender_element,
-					content_element,
-					time_elemenet,
-				});
-				message_elements.push_back(line);
-			}
-			messages_display = ftxui::vbox(message_elements);
-		} else {
-			messages_display =
-				ftxui::text("No messages yet.") | ftxui::center | ftxui::dim;
+		const auto &message_history =
+			selected_group.empty() ? view->getHistory(selected)
+								   : view->getGroupHistory(selected_group);
+		std::string conversation;
+		if (!selected_group.empty()) {
+			conversation = "group:" + selected_group;
+		} else if (selected) {
+			conversation = "peer:" + selected->getHostname();
 		}
+		auto messages_display = renderMessages(message_history, conversation);
 
 		// input
 		auto input_display =
@@ -83,7 +128,8 @@ ChatWindow::ChatWindow(App *app) : app_(app), input_text_("") {
 		elements.push_back(ftxui::text("") |
 						   ftxui::size(ftxui::HEIGHT, ftxui::EQUAL,
 									   static_cast<float>(0.5))); // spacing
-		elements.push_back(messages_display | ftxui::flex);
+		elements.push_back(messages_display | ftxui::flex |
+						   ftxui::reflect(messages_box_));
 		elements.push_back(ftxui::text("") |
 						   ftxui::size(ftxui::HEIGHT, ftxui::EQUAL, 1));
 		if (status != "") {
@@ -100,6 +146,102 @@ ChatWindow::ChatWindow(App *app) : app_(app), input_text_("") {
 	});
 }
 
+int ChatWindow::viewportHeight() const {
+	int height = messages_box_.y_max - messages_box_.y_min + 1;
+	// nothing laid out yet, assume the whole terminal
+	if (height <= 1) {
+		height = ftxui::Terminal::Size().dimy;
+	}
+	return std::max(height, 1);
+}
+
+void ChatWindow::scroll(int lines) {
+	if (lines < 0 && static_cast<size_t>(-lines) >= scroll_offset_) {
+		scroll_offset_ = 0;
+		return;
+	}
+	// clamped against the history length when rendering
+	scroll_offset_ += lines;
+}
+
+ftxui::Element ChatWindow::renderMessage(const Message &msg) const {
+	bool ours = msg.sender == hostname_;
+	auto sender_element = ftxui::text(ours ? "You" : msg.sender) | ftxui::bold;
+	auto content_element = ftxui::text(": " + msg.content);
+	auto time_element = ftxui::text(" [" + msg.getFormattedTime() + "]") |
+						 ftxui::color(ftxui::Color(ftxui::Color::GrayDark));
+
+	if (ours) {
+		sender_element |= ftxui::color(ftxui::Color::Green);
+	} else {
+		sender_element |= ftxui::color(ftxui::Color::Cyan);
+	}
+
+	return ftxui::hbox({
+		sender_element,
+		content_element,
+		time_element,
+	});
+}
+
+// builds the visible window of the history. every message is a single line,
+// so the window is just an index range ending scroll_offset_ lines above
+// the newest message
+ftxui::Element ChatWindow::renderMessages(const MessageLog &history,
+										  const std::string &conversation) {
+	if (conversation != cached_conversation_) {
+		cached_conversation_ = conversation;
+		line_cache_.clear();
+		last_history_size_ = 0;
+		scroll_offset_ = 0;
+	}
+	// synced messages can land above the newest one, shifting every line
+	// after them
+	if (history.reorders() != last_reorders_) {
+		last_reorders_ = history.reorders();
+		line_cache_.clear();
+	}
+
+	size_t total = history.size();
+	if (total == 0) {
+		return ftxui::text("No messages yet.") | ftxui::center | ftxui::dim;
+	}
+
+	// keep the same messages in view while scrolled back and new ones arrive
+	if (scroll_offset_ > 0 && total > last_history_size_) {
+		scroll_offset_ += total - last_history_size_;
+	}
+	last_history_size_ = total;
+	line_cache_.resize(total);
+	scroll_offset_ = std::min(scroll_offset_, total - 1);
+
+	size_t end = total - scroll_offset_;
+	size_t window = static_cast<size_t>(viewportHeight()) + OVERSCAN;
+	size_t begin = end > window ? end - window : 0;
+
+	ftxui::Elements lines;
+	lines.reserve(end - begin + 1);
+	for (size_t i = begin; i < end; ++i) {
+		if (!line_cache_[i]) {
+			line_cache_[i] = renderMessage(history[i]);
+		}
+		lines.push_back(line_cache_[i]);
+	}
+	// the frame scrolls to the focused line, pinning the newest in view
+	lines.back() = lines.back() | ftxui::focus;
+
+	auto messages = ftxui::vbox(lines) | ftxui::yframe;
+	if (scroll_offset_ == 0) {
+		return messages;
+	}
+	return ftxui::vbox({
+		messages | ftxui::flex,
+		ftxui::text(std::to_string(scroll_offset_) +
+					" newer message(s), PageDown to return") |
+			ftxui::dim | ftxui::center,
+	});
+}
+
 ftxui::Component ChatWindow::getComponent() { return container_; }
 
 // setter to link peer_list
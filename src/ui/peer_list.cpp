@@ -5,41 +5,78 @@
 #include <ftxui/component/event.hpp>
 #include <ftxui/dom/elements.hpp>
 #include <ftxui/screen/color.hpp>
+#include <cstdio>
 #include <memory>
 #include <vector>
 
 PeerList::PeerList(App *app, ftxui::Component chat_input)
 	: app_(app), chat_input_(chat_input) {
-	// extract hostnames
-	auto peers = app_->getPeers();
-
 	container_ = ftxui::Renderer([this] {
-		auto peers = app_->getPeers();
+		// one snapshot per frame, no locks taken while drawing
+		auto view = app_->getView();
+		auto selected = app_->getSelectedPeer();
+		auto selected_group = app_->getSelectedGroup();
 		ftxui::Elements elements;
 
 		// loop through peers and build a list of them
-		for (size_t i = 0; i < peers.size(); ++i) {
-			const auto &peer = peers[i];
-
-			auto name_element = ftxui::text(peer->getHostname());
+		for (const auto &peer_view : view->peers) {
+			const auto &hostname = peer_view.peer->getHostname();
 
-			if (app_->isConnectedTo(peer)) {
-				name_element = ftxui::text("[●] " + peer->getHostname()) |
+			ftxui::Element name_element;
+			if (peer_view.state == ConnectionState::Connected) {
+				name_element = ftxui::text("[●] " + hostname) |
 							   ftxui::color(ftxui::Color::Green);
-			} else if (app_->isConnectingTo(peer)) {
-				name_element = ftxui::text("[~] " + peer->getHostname()) |
+			} else if (peer_view.state == ConnectionState::Connecting) {
+				name_element = ftxui::text("[~] " + hostname) |
 							   ftxui::color(ftxui::Color::Yellow);
 			} else {
-				name_element = ftxui::text("[ ] " + peer->getHostname());
+				name_element = ftxui::text("[ ] " + hostname);
 			}
 
 			// apply a style when a peer is selected
-			if (static_cast<int>(i) == app_->getSelectedIndex()) {
+			if (peer_view.peer == selected) {
 				name_element |= ftxui::inverted;
 			}
+			// round trip of the live connection, from its heartbeats
+			if (peer_view.state == ConnectionState::Connected &&
+				peer_view.rtt_ms >= 0) {
+				char rtt[32];
+				std::snprintf(rtt, sizeof(rtt),
+							  peer_view.rtt_ms < 10 ? " %.1f ms" : " %.0f ms",
+							  peer_view.rtt_ms);
+				name_element = ftxui::hbox({
+					name_element,
+					ftxui::text(rtt) | ftxui::dim,
+				});
+			}
+			// sending faster than we let it, its messages are slowed down
+			if (peer_view.throttled) {
+				name_element = ftxui::hbox({
+					name_element,
+					ftxui::text(" throttled") | ftxui::color(ftxui::Color::Red),
+				});
+			}
 			elements.push_back(name_element);
 		}
 
+		// groups are listed under the peers
+		if (!view->groups.empty()) {
+			elements.push_back(ftxui::separator());
+			elements.push_back(ftxui::text("Groups") | ftxui::bold |
+							   ftxui::center);
+		}
+		for (const auto &group : view->groups) {
+			std::string label;
+			for (const auto &member : group.members) {
+				label += (label.empty() ? "" : ",") + member;
+			}
+			auto group_element = ftxui::text("# " + label);
+			if (group.id == selected_group) {
+				group_element |= ftxui::inverted;
+			}
+			elements.push_back(group_element);
+		}
+
 		return ftxui::vbox({
 				   ftxui::text("Peers") | ftxui::bold | ftxui::center,
 				   ftxui::separator(),
@@ -49,29 +86,42 @@ PeerList::PeerList(App *app, ftxui::Component chat_input)
 	});
 
 	container_ |= ftxui::CatchEvent([this](const ftxui::Event &event) {
-		if (event == ftxui::Event::ArrowDown) {
-			int current_index = app_->getSelectedIndex();
-			int peer_count = app_->getPeers().size();
+		if (event == ftxui::Event::ArrowDown ||
+			event == ftxui::Event::ArrowUp) {
+			// peers and groups form one list, in the order they are drawn
+			auto view = app_->getView();
+			int peer_count = view->peers.size();
+			int entry_count = peer_count + view->groups.size();
 
-			if (peer_count == 0) {
+			if (entry_count == 0) {
 				return true;
 			}
 
-			int new_index = (current_index + 1) % peer_count;
-			app_->selectPeer(new_index);
-			return true;
-		}
-
-		if (event == ftxui::Event::ArrowUp) {
-			int current_index = app_->getSelectedIndex();
-			int peer_count = app_->getPeers().size();
-
-			if (peer_count == 0) {
-				return true;
+			int current_index = -1;
+			auto selected = app_->getSelectedPeer();
+			auto selected_group = app_->getSelectedGroup();
+			for (int i = 0; i < peer_count; ++i) {
+				if (view->peers[i].peer == selected) {
+					current_index = i;
+				}
+			}
+			for (size_t i = 0; i < view->groups.size(); ++i) {
+				if (!selected_group.empty() &&
+					view->groups[i].id == selected_group) {
+					current_index = peer_count + i;
+				}
 			}
 
-			int new_index = (current_index - 1 + peer_count) % peer_count;
-			app_->selectPeer(new_index);
+			int step = event == ftxui::Event::ArrowDown ? 1 : -1;
+			int new_index = current_index < 0 && step < 0
+								? entry_count - 1
+								: (current_index + step + entry_count) %
+									  entry_count;
+			if (new_index < peer_count) {
+				app_->selectPeer(view->peers[new_index].peer);
+			} else {
+				app_->selectGroup(view->groups[new_index - peer_count].id);
+			}
 			return true;
 		}
 
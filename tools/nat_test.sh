@@ -0,0 +1,89 @@
+#!/bin/sh
+# runs the rendezvous server and two probes behind their own NATs, all in
+# network namespaces on this machine. needs root, iproute2 and iptables.
+#
+#   rv-lan1 192.168.1.2 -- rv-nat1 10.99.1.2
+#                                        |
+#                                      rv-srv 10.99.0.1
+#                                        |
+#   rv-lan2 192.168.2.2 -- rv-nat2 10.99.2.2
+#
+# both NATs masquerade their LAN, the server namespace routes between them
+# and plays the internet. the first run has to punch through, the second
+# drops traffic between the NATs so the chat has to go through the relay.
+#
+# usage: sudo tools/nat_test.sh   (after make rendezvous punch)
+set -eu
+
+BIN=$(dirname "$0")/../bin
+PORT=9002
+SERVER=10.99.0.1:$PORT
+NAMESPACES="rv-srv rv-nat1 rv-nat2 rv-lan1 rv-lan2"
+
+cleanup() {
+	for ns in $NAMESPACES; do
+		ip netns pids "$ns" 2>/dev/null | xargs -r kill 2>/dev/null || true
+		ip netns del "$ns" 2>/dev/null || true
+	done
+}
+trap cleanup EXIT
+cleanup
+
+for ns in $NAMESPACES; do
+	ip netns add "$ns"
+	ip -n "$ns" link set lo up
+done
+
+# link ns address peer_ns peer_address, a /24 veth pair between the two
+link() {
+	ip link add "$1-$3" netns "$1" type veth peer name "$3-$1" netns "$3"
+	ip -n "$1" addr add "$2/24" dev "$1-$3"
+	ip -n "$3" addr add "$4/24" dev "$3-$1"
+	ip -n "$1" link set "$1-$3" up
+	ip -n "$3" link set "$3-$1" up
+}
+
+# the server answers from one address whichever side asked, clients drop
+# anything that doesn't come from the address they sent to
+ip -n rv-srv addr add 10.99.0.1/32 dev lo
+ip netns exec rv-srv sysctl -qw net.ipv4.ip_forward=1
+for i in 1 2; do
+	link rv-srv "10.99.$i.1" "rv-nat$i" "10.99.$i.2"
+	ip -n rv-srv route replace "10.99.$i.0/24" dev "rv-srv-rv-nat$i" \
+		src 10.99.0.1
+	link "rv-nat$i" "192.168.$i.1" "rv-lan$i" "192.168.$i.2"
+	ip netns exec "rv-nat$i" sysctl -qw net.ipv4.ip_forward=1
+	ip -n "rv-nat$i" route add default via "10.99.$i.1"
+	ip -n "rv-lan$i" route add default via "192.168.$i.1"
+	ip netns exec "rv-nat$i" iptables -t nat -A POSTROUTING \
+		-o "rv-nat$i-rv-srv" -j MASQUERADE
+done
+
+ip netns exec rv-srv "$BIN/rendezvous" "$PORT" >/tmp/rv-srv.log &
+ip netns exec rv-lan2 "$BIN/punch" "$SERVER" bob >/tmp/rv-bob.log &
+sleep 1
+
+# probe name expected_path, name dials bob and has to get there that way.
+# every probe registers under its own name, the last one still holds its
+# name until the server expires it
+probe() {
+	output=$(ip netns exec rv-lan1 "$BIN/punch" "$SERVER" "$1" bob)
+	echo "$output"
+	case "$output" in
+	*"($2)"*) ;;
+	*)
+		echo "nat_test: expected a $2 path" >&2
+		exit 1
+		;;
+	esac
+}
+
+probe alice direct
+
+# nothing is forwarded between the NATs any more. the server's own address
+# is looked up in the local table first, so both can still reach it
+ip -n rv-srv rule add iif rv-srv-rv-nat1 prohibit
+ip -n rv-srv rule add iif rv-srv-rv-nat2 prohibit
+probe carol relayed
+
+echo "nat_test: ok"
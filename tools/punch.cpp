@@ -0,0 +1,116 @@
+// checks that two nodes can reach each other through a rendezvous server.
+// without a peer it registers and echoes one line back on every stream it
+// is given. with a peer it waits for the peer to show up, opens a stream,
+// and prints whether the line came back over a punched path or the relay.
+//
+// usage: punch host:port name [peer]
+#include "network/rendezvous.hpp"
+#include "network/udp_stream.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using boost::asio::ip::udp;
+
+constexpr std::chrono::seconds PEER_WAIT(30);
+const std::string PROBE_LINE = "punch\n";
+
+static udp::endpoint parseServer(const std::string &text) {
+	size_t colon = text.rfind(':');
+	if (colon == std::string::npos) {
+		throw std::invalid_argument("server has to be host:port");
+	}
+	return udp::endpoint(boost::asio::ip::make_address(text.substr(0, colon)),
+						 static_cast<unsigned short>(
+							 std::stoul(text.substr(colon + 1))));
+}
+
+static std::string readLine(Stream &stream) {
+	std::string line;
+	std::uint8_t byte = 0;
+	while (line.empty() || line.back() != '\n') {
+		stream.readSome(&byte, 1);
+		line += static_cast<char>(byte);
+	}
+	return line;
+}
+
+static const char *pathName(const Stream &stream) {
+	auto *udp_stream = dynamic_cast<const UdpStream *>(&stream);
+	return udp_stream && udp_stream->isRelayed() ? "relayed" : "direct";
+}
+
+static void echo(const std::string &from, std::unique_ptr<Stream> stream) {
+	try {
+		std::string line = readLine(*stream);
+		stream->write(reinterpret_cast<const std::uint8_t *>(line.data()),
+					  line.size());
+		stream->shutdownSend();
+		std::printf("echoed %s (%s)\n", from.c_str(), pathName(*stream));
+		std::fflush(stdout);
+		// the peer closes once it has the line back
+		readLine(*stream);
+	} catch (const std::exception &e) {
+		// the stream ended
+	}
+}
+
+static bool probe(RendezvousClient &client, const std::string &peer) {
+	auto deadline = std::chrono::steady_clock::now() + PEER_WAIT;
+	bool listed = false;
+	while (!listed && std::chrono::steady_clock::now() < deadline) {
+		for (const auto &[name, address] : client.getPeers()) {
+			listed = listed || name == peer;
+		}
+		if (!listed) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		}
+	}
+	if (!listed) {
+		std::fprintf(stderr, "punch: %s never registered\n", peer.c_str());
+		return false;
+	}
+	auto stream = client.connect(peer);
+	stream->write(reinterpret_cast<const std::uint8_t *>(PROBE_LINE.data()),
+				  PROBE_LINE.size());
+	if (readLine(*stream) != PROBE_LINE) {
+		std::fprintf(stderr, "punch: %s echoed something else\n",
+					 peer.c_str());
+		return false;
+	}
+	std::printf("reached %s (%s)\n", peer.c_str(), pathName(*stream));
+	stream->shutdownSend();
+	stream->close();
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3 && argc != 4) {
+		std::fprintf(stderr, "usage: punch host:port name [peer]\n");
+		return 1;
+	}
+	try {
+		boost::asio::io_context io_ctx;
+		RendezvousClient client(io_ctx, parseServer(argv[1]), argv[2],
+								argc == 3 ? echo : nullptr);
+		client.start();
+		if (argc == 3) {
+			std::printf("punch: %s waiting for peers\n", argv[2]);
+			std::fflush(stdout);
+			while (true) {
+				std::this_thread::sleep_for(std::chrono::seconds(1));
+			}
+		}
+		bool reached = probe(client, argv[3]);
+		client.stop();
+		return reached ? 0 : 1;
+	} catch (const std::exception &e) {
+		std::fprintf(stderr, "punch: %s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,303 @@
+// rendezvous server for NAT traversal. nodes register their control socket
+// here, and when one wants to reach another the server introduces them:
+// it hands each side the other's public address (as seen from here) plus
+// the local addresses it reported, then both punch towards each other.
+// sessions that can't punch through are relayed datagram by datagram.
+//
+// usage: rendezvous [port]
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using boost::asio::ip::udp;
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned short DEFAULT_PORT = 9002;
+constexpr size_t MAX_DATAGRAM_SIZE = 2048;
+// nodes re-register every 15 seconds
+constexpr std::chrono::seconds REGISTRATION_LIFETIME(60);
+constexpr std::chrono::minutes SESSION_LIFETIME(10);
+constexpr size_t MAX_REGISTRATIONS = 4096;
+constexpr size_t MAX_SESSIONS = 4096;
+constexpr size_t MAX_NAME_LENGTH = 64;
+
+struct Registration {
+	udp::endpoint endpoint;
+	Clock::time_point last_seen;
+};
+
+struct Session {
+	std::string target;
+	std::string dialer_candidates;
+	std::string acceptor_candidates;
+	udp::endpoint dialer;
+	udp::endpoint acceptor;
+	bool accepted = false;
+	Clock::time_point last_seen;
+};
+
+static std::vector<std::string> splitFields(const std::string &line,
+											size_t max_fields) {
+	std::vector<std::string> fields;
+	size_t start = 0;
+	while (fields.size() + 1 < max_fields) {
+		size_t pipe = line.find('|', start);
+		if (pipe == std::string::npos) {
+			break;
+		}
+		fields.push_back(line.substr(start, pipe - start));
+		start = pipe + 1;
+	}
+	fields.push_back(line.substr(start));
+	return fields;
+}
+
+static std::string endpointString(const udp::endpoint &endpoint) {
+	return endpoint.address().to_string() + ":" +
+		   std::to_string(endpoint.port());
+}
+
+// the address we saw goes first, it is the one most likely to work
+static std::string candidateList(const udp::endpoint &seen,
+								 const std::string &local_candidates) {
+	std::string list = endpointString(seen);
+	if (!local_candidates.empty()) {
+		list += "," + local_candidates;
+	}
+	return list;
+}
+
+class RendezvousServer {
+  private:
+	udp::socket socket_;
+	std::map<std::string, Registration> registrations_;
+	// name registered from each control socket, one name per socket
+	std::map<udp::endpoint, std::string> names_;
+	std::map<std::string, Session> sessions_;
+
+	void send(const std::string &message, const udp::endpoint &to) {
+		boost::system::error_code ec;
+		socket_.send_to(boost::asio::buffer(message), to, 0, ec);
+	}
+
+	void introduce(const std::string &id, const Session &session) {
+		send("PEER|" + id + "|" +
+				 candidateList(session.acceptor, session.acceptor_candidates),
+			 session.dialer);
+		send("PEER|" + id + "|" +
+				 candidateList(session.dialer, session.dialer_candidates),
+			 session.acceptor);
+	}
+
+	// the registration under name, if it hasn't run out yet
+	const Registration *live(const std::string &name,
+							 Clock::time_point now) const {
+		auto it = registrations_.find(name);
+		if (it == registrations_.end() ||
+			now - it->second.last_seen > REGISTRATION_LIFETIME) {
+			return nullptr;
+		}
+		return &it->second;
+	}
+
+	// session sockets are opened next to the control socket, so requests
+	// for a name have to come from the address it registered from
+	bool sentBy(const Registration *registration,
+				const udp::endpoint &sender) const {
+		return registration &&
+			   registration->endpoint.address() == sender.address();
+	}
+
+	void unregister(std::map<std::string, Registration>::iterator it) {
+		names_.erase(it->second.endpoint);
+		registrations_.erase(it);
+	}
+
+	void expire() {
+		auto now = Clock::now();
+		for (auto it = registrations_.begin(); it != registrations_.end();) {
+			auto next = std::next(it);
+			if (now - it->second.last_seen > REGISTRATION_LIFETIME) {
+				unregister(it);
+			}
+			it = next;
+		}
+		for (auto it = sessions_.begin(); it != sessions_.end();) {
+			it = now - it->second.last_seen > SESSION_LIFETIME
+					 ? sessions_.erase(it)
+					 : std::next(it);
+		}
+	}
+
+	// a name belongs to the socket that registered it until it stops
+	// renewing, only then can another socket take it over
+	void registerName(const std::string &name, const udp::endpoint &sender,
+					  Clock::time_point now) {
+		if (name.empty() || name.size() > MAX_NAME_LENGTH ||
+			name.find_first_of(",@|") != std::string::npos) {
+			send("ERROR||bad name", sender);
+			return;
+		}
+		auto existing = registrations_.find(name);
+		if (existing != registrations_.end() &&
+			existing->second.endpoint != sender) {
+			if (live(name, now)) {
+				send("ERROR||name taken", sender);
+				return;
+			}
+			unregister(existing);
+			existing = registrations_.end();
+		}
+		auto previous = names_.find(sender);
+		if (previous != names_.end() && previous->second != name) {
+			unregister(registrations_.find(previous->second));
+		}
+		if (existing == registrations_.end()) {
+			if (registrations_.size() >= MAX_REGISTRATIONS) {
+				expire();
+			}
+			if (registrations_.size() >= MAX_REGISTRATIONS) {
+				send("ERROR||server full", sender);
+				return;
+			}
+			std::printf("register %s at %s\n", name.c_str(),
+						endpointString(sender).c_str());
+		}
+		registrations_[name] = {sender, now};
+		names_[sender] = name;
+		send("REGISTERED|" + endpointString(sender), sender);
+	}
+
+	void handle(const std::string &message, const udp::endpoint &sender) {
+		auto now = Clock::now();
+		if (message.rfind("REGISTER|", 0) == 0) {
+			registerName(message.substr(9), sender, now);
+		} else if (message == "LIST") {
+			auto asker = names_.find(sender);
+			if (asker == names_.end() || !live(asker->second, now)) {
+				return;
+			}
+			std::string peers;
+			for (const auto &[name, registration] : registrations_) {
+				if (now - registration.last_seen > REGISTRATION_LIFETIME) {
+					continue;
+				}
+				peers += (peers.empty() ? "" : ",") + name + "@" +
+						 registration.endpoint.address().to_string();
+			}
+			send("PEERS|" + peers, sender);
+		} else if (message.rfind("CONNECT|", 0) == 0) {
+			// CONNECT|session|from|to|candidates
+			auto fields = splitFields(message, 5);
+			if (fields.size() != 5 || !sentBy(live(fields[2], now), sender)) {
+				return;
+			}
+			const Registration *target = live(fields[3], now);
+			if (!target) {
+				send("ERROR|" + fields[1] + "|unknown peer", sender);
+				return;
+			}
+			auto existing = sessions_.find(fields[1]);
+			if (existing == sessions_.end()) {
+				if (sessions_.size() >= MAX_SESSIONS) {
+					expire();
+				}
+				if (sessions_.size() >= MAX_SESSIONS) {
+					send("ERROR|" + fields[1] + "|server busy", sender);
+					return;
+				}
+				std::printf("session %s: %s -> %s\n", fields[1].c_str(),
+							fields[2].c_str(), fields[3].c_str());
+				existing = sessions_.emplace(fields[1], Session()).first;
+				existing->second.target = fields[3];
+				existing->second.dialer = sender;
+			} else if (existing->second.dialer != sender ||
+					   existing->second.target != fields[3]) {
+				// someone else's session id
+				return;
+			}
+			auto &session = existing->second;
+			session.last_seen = now;
+			if (session.accepted) {
+				// the dialer missed our answer
+				introduce(fields[1], session);
+				return;
+			}
+			session.dialer_candidates = fields[4];
+			send("INVITE|" + fields[1] + "|" + fields[2], target->endpoint);
+		} else if (message.rfind("ACCEPT|", 0) == 0) {
+			// ACCEPT|session|candidates, only from the invited peer
+			auto fields = splitFields(message, 3);
+			auto session = sessions_.find(fields.size() == 3 ? fields[1] : "");
+			if (session == sessions_.end() ||
+				!sentBy(live(session->second.target, now), sender) ||
+				(session->second.accepted &&
+				 session->second.acceptor != sender)) {
+				return;
+			}
+			session->second.acceptor = sender;
+			session->second.acceptor_candidates = fields[2];
+			session->second.accepted = true;
+			session->second.last_seen = now;
+			introduce(fields[1], session->second);
+		} else if (message.rfind("RELAY|", 0) == 0) {
+			// RELAY|session|payload, passed on as is
+			size_t pipe = message.find('|', 6);
+			auto session = sessions_.find(message.substr(6, pipe - 6));
+			if (pipe == std::string::npos || session == sessions_.end() ||
+				!session->second.accepted) {
+				return;
+			}
+			session->second.last_seen = now;
+			if (sender == session->second.dialer) {
+				send(message, session->second.acceptor);
+			} else if (sender == session->second.acceptor) {
+				send(message, session->second.dialer);
+			}
+		}
+	}
+
+  public:
+	RendezvousServer(boost::asio::io_context &io_ctx, unsigned short port)
+		: socket_(io_ctx, udp::endpoint(udp::v4(), port)) {}
+
+	void run() {
+		char buffer[MAX_DATAGRAM_SIZE];
+		auto next_expiry = Clock::now();
+		while (true) {
+			udp::endpoint sender;
+			boost::system::error_code ec;
+			size_t len =
+				socket_.receive_from(boost::asio::buffer(buffer), sender, 0, ec);
+			if (ec) {
+				continue;
+			}
+			handle(std::string(buffer, len), sender);
+			if (Clock::now() >= next_expiry) {
+				expire();
+				next_expiry = Clock::now() + std::chrono::seconds(10);
+			}
+		}
+	}
+};
+
+int main(int argc, char **argv) {
+	unsigned short port =
+		argc > 1 ? static_cast<unsigned short>(std::stoi(argv[1]))
+				 : DEFAULT_PORT;
+	try {
+		boost::asio::io_context io_ctx;
+		RendezvousServer server(io_ctx, port);
+		std::printf("rendezvous listening on udp port %u\n", port);
+		std::fflush(stdout);
+		server.run();
+	} catch (const std::exception &e) {
+		std::fprintf(stderr, "rendezvous: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
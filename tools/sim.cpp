@@ -0,0 +1,726 @@
+// runs a cluster of nodes in one process and drives chat traffic between
+// them. node i is named node-i and gets its own loopback address,
+// 127.0.1.(i + 1), so peers can be told apart the way they are on a real
+// LAN. discovery pings every node directly instead of broadcasting.
+//
+// patterns:
+//   one-to-one  every node chats with the next one, in a ring
+//   fan-out     node-0 sends to a group of everyone else
+//   churn       one-to-one while a random node restarts every interval,
+//               messages to it are relayed and delivered when it is back
+//   simultaneous-open
+//               nodes are paired up and both ends of every pair dial each
+//               other at once, --dials times. every round has to end with
+//               both ends on the same single connection
+//
+// usage: sim [--nodes N] [--pattern P] [--seconds S] [--rate MSG/S]
+//            [--size BYTES] [--churn-interval S] [--port PORT]
+//            [--dials N]
+#include "core/app.hpp"
+#include "core/config.hpp"
+#include "core/message.hpp"
+#include "network/peer.hpp"
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// nodes take 127.0.1.1 and up
+constexpr size_t MAX_NODES = 250;
+// how long stragglers, relayed messages included, get after traffic stops
+constexpr std::chrono::seconds DRAIN_TIME(3);
+constexpr std::chrono::seconds SETUP_TIMEOUT(20);
+constexpr std::chrono::milliseconds POLL_INTERVAL(200);
+// a simultaneous open is checked again this long after it settled, by
+// then the losing connection has drained
+constexpr std::chrono::milliseconds SETTLE_TIME(5);
+
+struct SimOptions {
+	size_t nodes = 8;
+	std::string pattern = "one-to-one";
+	double seconds = 10;
+	double rate = 50; // messages per second per sending node
+	size_t message_size = 256;
+	double churn_interval = 2;
+	unsigned short port = 19000; // discovery uses the next one
+	size_t dials = 1000; // rounds of simultaneous-open
+};
+
+struct Node {
+	Config config;
+	// held while the app is used or replaced
+	std::mutex mutex;
+	std::unique_ptr<App> app;
+	// where this node sends, resolved again after a restart
+	std::string target;
+	std::shared_ptr<Peer> target_peer;
+	std::string group_id;
+	std::uint64_t next_sequence = 0;
+	// restarted with the peer table of its previous run
+	bool warm = false;
+};
+
+// deliveries are keyed by sender, sequence and receiver so duplicates show
+class Stats {
+  private:
+	std::mutex mutex_;
+	std::set<std::tuple<std::string, std::uint64_t, std::string>> seen_;
+
+  public:
+	std::vector<double> latencies_ms;
+	std::uint64_t sent = 0;
+	std::uint64_t expected = 0;
+	std::uint64_t delivered = 0;
+	std::uint64_t duplicates = 0;
+	std::uint64_t bytes = 0;
+
+	void recordSent(std::uint64_t receivers) {
+		const std::lock_guard<std::mutex> lock(mutex_);
+		++sent;
+		expected += receivers;
+	}
+
+	void recordReceived(const std::string &receiver, const Message &msg) {
+		// content is sequence|send time in ns|padding
+		size_t first = msg.content.find('|');
+		size_t second = msg.content.find('|', first + 1);
+		if (second == std::string::npos) {
+			return;
+		}
+		std::uint64_t sequence = std::stoull(msg.content.substr(0, first));
+		std::int64_t sent_ns =
+			std::stoll(msg.content.substr(first + 1, second - first - 1));
+		std::int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+								  Clock::now().time_since_epoch())
+								  .count();
+
+		const std::lock_guard<std::mutex> lock(mutex_);
+		if (!seen_.insert({msg.sender, sequence, receiver}).second) {
+			++duplicates;
+			return;
+		}
+		++delivered;
+		bytes += msg.content.size();
+		latencies_ms.push_back(static_cast<double>(now_ns - sent_ns) / 1e6);
+	}
+};
+
+static double percentile(std::vector<double> values, double p) {
+	if (values.empty()) {
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	return values[static_cast<size_t>(p * (values.size() - 1))];
+}
+
+// resident memory in bytes and live threads of the whole process
+static std::pair<size_t, size_t> processUsage() {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	size_t rss_kb = 0;
+	size_t threads = 0;
+	while (std::getline(status, line)) {
+		if (line.rfind("VmRSS:", 0) == 0) {
+			rss_kb = std::stoul(line.substr(6));
+		} else if (line.rfind("Threads:", 0) == 0) {
+			threads = std::stoul(line.substr(8));
+		}
+	}
+	return {rss_kb * 1024, threads};
+}
+
+static SimOptions parseOptions(int argc, char **argv) {
+	SimOptions options;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string flag = argv[i];
+		std::string value = argv[i + 1];
+		if (flag == "--nodes") {
+			options.nodes = std::stoul(value);
+		} else if (flag == "--pattern") {
+			options.pattern = value;
+		} else if (flag == "--seconds") {
+			options.seconds = std::stod(value);
+		} else if (flag == "--rate") {
+			options.rate = std::stod(value);
+		} else if (flag == "--size") {
+			options.message_size = std::stoul(value);
+		} else if (flag == "--churn-interval") {
+			options.churn_interval = std::stod(value);
+		} else if (flag == "--port") {
+			options.port = static_cast<unsigned short>(std::stoul(value));
+		} else if (flag == "--dials") {
+			options.dials = std::stoul(value);
+		} else {
+			throw std::invalid_argument("unknown option " + flag);
+		}
+	}
+	if (argc % 2 == 0) {
+		throw std::invalid_argument("missing value for " +
+									std::string(argv[argc - 1]));
+	}
+	if (options.nodes < 2 || options.nodes > MAX_NODES) {
+		throw std::invalid_argument("--nodes has to be between 2 and " +
+									std::to_string(MAX_NODES));
+	}
+	if (options.pattern != "one-to-one" && options.pattern != "fan-out" &&
+		options.pattern != "churn" && options.pattern != "simultaneous-open") {
+		throw std::invalid_argument("unknown pattern " + options.pattern);
+	}
+	if (options.rate <= 0 || options.seconds <= 0 ||
+		options.churn_interval <= 0) {
+		throw std::invalid_argument("rates and durations have to be positive");
+	}
+	return options;
+}
+
+class Cluster {
+  private:
+	SimOptions options_;
+	std::string data_root_;
+	boost::asio::io_context io_ctx_;
+	std::vector<std::unique_ptr<Node>> nodes_;
+	Stats stats_;
+	std::atomic<bool> sending_{false};
+	std::atomic<bool> running_{true};
+	std::uint64_t restarts_ = 0;
+	// startup to first message sent, per app that sent one
+	std::vector<double> cold_first_ms_;
+	std::vector<double> warm_first_ms_;
+
+	// called with the node's mutex held, before its app goes away
+	void recordFirstMessage(Node &node) {
+		node.app->publishView();
+		double first_ms = node.app->getView()->first_message_ms;
+		if (first_ms >= 0) {
+			(node.warm ? warm_first_ms_ : cold_first_ms_).push_back(first_ms);
+		}
+	}
+
+	// called with the node's mutex held
+	void startNode(Node &node) {
+		node.app = std::make_unique<App>(io_ctx_, node.config);
+		std::string receiver = node.config.hostname;
+		node.app->setMessageListener(
+			[this, receiver](std::shared_ptr<Peer>, const Message &msg) {
+				stats_.recordReceived(receiver, msg);
+			});
+		node.app->performInitialDiscovery();
+		node.target_peer = nullptr;
+		node.group_id.clear();
+	}
+
+	// the node's own view of a peer, null until discovery found it
+	static std::shared_ptr<Peer> findPeer(App &app, const std::string &name) {
+		app.publishView();
+		for (const auto &peer_view : app.getView()->peers) {
+			if (peer_view.peer->getHostname() == name) {
+				return peer_view.peer;
+			}
+		}
+		return nullptr;
+	}
+
+	bool isSender(size_t index) const {
+		return options_.pattern != "fan-out" || index == 0;
+	}
+
+	std::vector<std::string> groupMembers() const {
+		std::vector<std::string> members;
+		for (size_t i = 1; i < nodes_.size(); ++i) {
+			members.push_back(nodes_[i]->config.hostname);
+		}
+		return members;
+	}
+
+	// sends one message if the node is up and knows its target, returns
+	// false if it had to skip
+	bool sendOne(Node &node) {
+		const std::lock_guard<std::mutex> lock(node.mutex);
+		if (!node.app) {
+			return false;
+		}
+		std::int64_t now_ns =
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				Clock::now().time_since_epoch())
+				.count();
+		std::string content = std::to_string(node.next_sequence) + "|" +
+							  std::to_string(now_ns) + "|";
+		if (content.size() < options_.message_size) {
+			content.append(options_.message_size - content.size(), 'x');
+		}
+
+		if (options_.pattern == "fan-out") {
+			if (node.group_id.empty()) {
+				node.group_id = node.app->createGroup(groupMembers());
+			}
+			node.app->sendGroupMessage(node.group_id, content);
+			stats_.recordSent(nodes_.size() - 1);
+		} else {
+			if (!node.target_peer) {
+				node.target_peer = findPeer(*node.app, node.target);
+				if (!node.target_peer) {
+					return false;
+				}
+			}
+			node.app->sendMessage(node.target_peer, content);
+			stats_.recordSent(1);
+		}
+		++node.next_sequence;
+		return true;
+	}
+
+	void senderLoop(Node &node) {
+		auto interval = std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(1.0 / options_.rate));
+		auto next = Clock::now();
+		while (sending_) {
+			sendOne(node);
+			next += interval;
+			std::this_thread::sleep_until(next);
+		}
+	}
+
+	// what the UI poller does for a real node
+	void pollerLoop() {
+		while (running_) {
+			for (auto &node : nodes_) {
+				const std::lock_guard<std::mutex> lock(node->mutex);
+				if (node->app) {
+					node->app->refreshPeers();
+					node->app->publishView();
+				}
+			}
+			std::this_thread::sleep_for(POLL_INTERVAL);
+		}
+	}
+
+	// stops a random node, keeps it down for half an interval and starts it
+	// again with the same identity
+	void churnLoop() {
+		std::mt19937 rng(std::random_device{}());
+		auto interval = std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(options_.churn_interval));
+		while (sending_) {
+			std::this_thread::sleep_for(interval / 2);
+			if (!sending_) {
+				break;
+			}
+			Node &node = *nodes_[rng() % nodes_.size()];
+			std::unique_ptr<App> stopped;
+			{
+				const std::lock_guard<std::mutex> lock(node.mutex);
+				recordFirstMessage(node);
+				stopped = std::move(node.app);
+			}
+			stopped.reset();
+			std::this_thread::sleep_for(interval / 2);
+			const std::lock_guard<std::mutex> lock(node.mutex);
+			node.warm = true;
+			startNode(node);
+			++restarts_;
+		}
+	}
+
+	bool waitFor(const std::function<bool()> &done,
+				 std::chrono::milliseconds poll = std::chrono::milliseconds(20)) {
+		auto deadline = Clock::now() + SETUP_TIMEOUT;
+		while (!done()) {
+			if (Clock::now() > deadline) {
+				return false;
+			}
+			std::this_thread::sleep_for(poll);
+		}
+		return true;
+	}
+
+	// the node's live connection to a peer as its view shows it, the
+	// dialer's node id or 0 without one
+	static std::uint64_t liveDialer(Node &node, const std::shared_ptr<Peer> &peer) {
+		const std::lock_guard<std::mutex> lock(node.mutex);
+		if (node.app->isConnectingTo(peer)) {
+			return 0;
+		}
+		node.app->publishView();
+		for (const auto &peer_view : node.app->getView()->peers) {
+			if (peer_view.peer == peer &&
+				peer_view.state == ConnectionState::Connected) {
+				return peer_view.dialer_node_id;
+			}
+		}
+		return 0;
+	}
+
+	// pairs node 2k with node 2k + 1 and has both ends dial at once,
+	// options_.dials times. a round is done when both ends hold a
+	// connection dialed by the same node and neither is still connecting,
+	// and that connection has to outlive the loser draining. then both
+	// ends hang up for the next round
+	bool simultaneousOpens(double setup_ms) {
+		struct Pair {
+			Node *a;
+			Node *b;
+			std::shared_ptr<Peer> to_b; // b as a knows it
+			std::shared_ptr<Peer> to_a;
+			std::uint64_t lower_node_id;
+		};
+		std::vector<Pair> pairs;
+		for (size_t i = 0; i + 1 < nodes_.size(); i += 2) {
+			Node &a = *nodes_[i];
+			Node &b = *nodes_[i + 1];
+			const std::lock_guard<std::mutex> lock_a(a.mutex);
+			const std::lock_guard<std::mutex> lock_b(b.mutex);
+			pairs.push_back({&a, &b, findPeer(*a.app, b.config.hostname),
+							 findPeer(*b.app, a.config.hostname),
+							 std::min(a.app->getNodeId(), b.app->getNodeId())});
+		}
+		auto agreed = [&pairs] {
+			for (const auto &pair : pairs) {
+				std::uint64_t dialer = liveDialer(*pair.a, pair.to_b);
+				if (dialer == 0 || dialer != liveDialer(*pair.b, pair.to_a)) {
+					return false;
+				}
+			}
+			return true;
+		};
+		auto closed = [&pairs] {
+			for (const auto &pair : pairs) {
+				const std::lock_guard<std::mutex> lock_a(pair.a->mutex);
+				const std::lock_guard<std::mutex> lock_b(pair.b->mutex);
+				if (pair.a->app->isConnectedTo(pair.to_b) ||
+					pair.a->app->isConnectingTo(pair.to_b) ||
+					pair.b->app->isConnectedTo(pair.to_a) ||
+					pair.b->app->isConnectingTo(pair.to_a)) {
+					return false;
+				}
+			}
+			return true;
+		};
+
+		std::printf("== cluster: %zu nodes, simultaneous-open, %zu pair(s), "
+					"%zu round(s) ==\n",
+					options_.nodes, pairs.size(), options_.dials);
+		std::printf("setup              %.0f ms (discovery)\n", setup_ms);
+		auto [setup_rss, setup_threads] = processUsage();
+
+		std::vector<double> round_ms;
+		std::uint64_t lower_won = 0;
+		std::string failure;
+		const auto poll = std::chrono::milliseconds(1);
+		for (size_t round = 0; round < options_.dials && failure.empty();
+			 ++round) {
+			auto round_start = Clock::now();
+			for (const auto &pair : pairs) {
+				{
+					const std::lock_guard<std::mutex> lock(pair.a->mutex);
+					pair.a->app->connectToPeer(pair.to_b, true);
+				}
+				const std::lock_guard<std::mutex> lock(pair.b->mutex);
+				pair.b->app->connectToPeer(pair.to_a, true);
+			}
+			if (!waitFor(agreed, poll)) {
+				failure = "round " + std::to_string(round + 1) +
+						  " didn't settle on one connection per pair";
+				break;
+			}
+			round_ms.push_back(std::chrono::duration<double, std::milli>(
+								   Clock::now() - round_start)
+								   .count());
+			std::this_thread::sleep_for(SETTLE_TIME);
+			if (!agreed()) {
+				failure = "round " + std::to_string(round + 1) +
+						  " lost the surviving connection";
+				break;
+			}
+			for (const auto &pair : pairs) {
+				if (liveDialer(*pair.a, pair.to_b) == pair.lower_node_id) {
+					++lower_won;
+				}
+				{
+					const std::lock_guard<std::mutex> lock(pair.a->mutex);
+					pair.a->app->disconnectFromPeer(pair.to_b);
+				}
+				const std::lock_guard<std::mutex> lock(pair.b->mutex);
+				pair.b->app->disconnectFromPeer(pair.to_a);
+			}
+			if (!waitFor(closed, poll)) {
+				failure = "round " + std::to_string(round + 1) +
+						  " didn't hang up";
+			}
+		}
+		// the poller reaps the connector threads of the last rounds
+		std::this_thread::sleep_for(POLL_INTERVAL * 2);
+		auto [end_rss, end_threads] = processUsage();
+
+		double nodes = static_cast<double>(nodes_.size());
+		std::printf("rounds             %zu of %zu settled on one connection "
+					"per pair\n",
+					round_ms.size(), options_.dials);
+		std::printf("settle ms          p50 %.2f  p90 %.2f  p99 %.2f  max "
+					"%.2f\n",
+					percentile(round_ms, 0.50), percentile(round_ms, 0.90),
+					percentile(round_ms, 0.99), percentile(round_ms, 1.0));
+		std::printf("survivor           dialed by the lower node id in %llu "
+					"of %zu\n",
+					static_cast<unsigned long long>(lower_won),
+					round_ms.size() * pairs.size());
+		std::printf("memory per node    %+.2f MiB over the rounds\n",
+					(static_cast<double>(end_rss) - setup_rss) / nodes /
+						(1 << 20));
+		std::printf("threads            %zu after setup, %zu at the end\n",
+					setup_threads, end_threads);
+		if (!failure.empty()) {
+			std::printf("failed             %s\n", failure.c_str());
+			return false;
+		}
+		return true;
+	}
+
+  public:
+	explicit Cluster(const SimOptions &options) : options_(options) {
+		data_root_ = (std::filesystem::temp_directory_path() /
+					  ("p2p_sim." + std::to_string(getpid())))
+						 .string();
+		std::vector<boost::asio::ip::udp::endpoint> seeds;
+		for (size_t i = 0; i < options_.nodes; ++i) {
+			auto node = std::make_unique<Node>();
+			node->config.hostname = "node-" + std::to_string(i);
+			node->config.bind_address = boost::asio::ip::make_address(
+				"127.0.1." + std::to_string(i + 1));
+			node->config.port = options_.port;
+			node->config.discovery_port = options_.port + 1;
+			node->config.broadcast = false;
+			node->config.data_dir =
+				data_root_ + "/" + node->config.hostname;
+			seeds.emplace_back(node->config.bind_address,
+							   node->config.discovery_port);
+			nodes_.push_back(std::move(node));
+		}
+		for (size_t i = 0; i < nodes_.size(); ++i) {
+			nodes_[i]->config.discovery_seeds = seeds;
+			nodes_[i]->target = nodes_[(i + 1) % nodes_.size()]->config.hostname;
+		}
+	}
+
+	~Cluster() {
+		for (auto &node : nodes_) {
+			node->app.reset();
+		}
+		std::error_code ec;
+		std::filesystem::remove_all(data_root_, ec);
+	}
+
+	// false if the cluster didn't come up or a check failed
+	bool run() {
+		auto [baseline_rss, baseline_threads] = processUsage();
+		auto setup_start = Clock::now();
+
+		for (auto &node : nodes_) {
+			const std::lock_guard<std::mutex> lock(node->mutex);
+			startNode(*node);
+		}
+		std::thread poller(&Cluster::pollerLoop, this);
+
+		// everyone has found everyone
+		bool discovered = waitFor([this] {
+			for (auto &node : nodes_) {
+				const std::lock_guard<std::mutex> lock(node->mutex);
+				node->app->publishView();
+				if (node->app->getView()->peers.size() + 1 < nodes_.size()) {
+					return false;
+				}
+			}
+			return true;
+		});
+		if (discovered && options_.pattern == "simultaneous-open") {
+			bool passed = simultaneousOpens(std::chrono::duration<double, std::milli>(
+												Clock::now() - setup_start)
+												.count());
+			running_ = false;
+			poller.join();
+			return passed;
+		}
+
+		// senders dial their targets up front so the first messages aren't
+		// measuring connection setup
+		std::vector<std::pair<Node *, std::shared_ptr<Peer>>> links;
+		for (size_t i = 0; i < nodes_.size() && discovered; ++i) {
+			if (!isSender(i)) {
+				continue;
+			}
+			Node &node = *nodes_[i];
+			const std::lock_guard<std::mutex> lock(node.mutex);
+			std::vector<std::string> targets = {node.target};
+			if (options_.pattern == "fan-out") {
+				targets = groupMembers();
+			}
+			for (const auto &target : targets) {
+				auto peer = findPeer(*node.app, target);
+				node.app->connectToPeer(peer);
+				links.push_back({&node, peer});
+			}
+		}
+		bool connected = discovered && waitFor([&links] {
+			for (const auto &[node, peer] : links) {
+				const std::lock_guard<std::mutex> lock(node->mutex);
+				if (!node->app->isConnectedTo(peer)) {
+					return false;
+				}
+			}
+			return true;
+		});
+		double setup_ms = std::chrono::duration<double, std::milli>(
+							  Clock::now() - setup_start)
+							  .count();
+		auto [setup_rss, setup_threads] = processUsage();
+
+		std::printf("== cluster: %zu nodes, %s, %.0f s, %.0f msg/s per "
+					"sender, %zu B ==\n",
+					options_.nodes, options_.pattern.c_str(), options_.seconds,
+					options_.rate, options_.message_size);
+		if (!connected) {
+			std::printf("setup timed out after %.0f ms, %s\n", setup_ms,
+						discovered ? "not every link connected"
+								   : "not every node was discovered");
+			running_ = false;
+			poller.join();
+			return false;
+		}
+		std::printf("setup              %.0f ms (discovery and %zu "
+					"connections)\n",
+					setup_ms, links.size());
+
+		// traffic
+		sending_ = true;
+		auto traffic_start = Clock::now();
+		std::vector<std::thread> senders;
+		for (size_t i = 0; i < nodes_.size(); ++i) {
+			if (isSender(i)) {
+				senders.emplace_back(&Cluster::senderLoop, this,
+									 std::ref(*nodes_[i]));
+			}
+		}
+		std::thread churn;
+		if (options_.pattern == "churn") {
+			churn = std::thread(&Cluster::churnLoop, this);
+		}
+		std::this_thread::sleep_for(
+			std::chrono::duration<double>(options_.seconds));
+		sending_ = false;
+		for (auto &sender : senders) {
+			sender.join();
+		}
+		if (churn.joinable()) {
+			churn.join();
+		}
+		double traffic_s =
+			std::chrono::duration<double>(Clock::now() - traffic_start).count();
+		std::this_thread::sleep_for(DRAIN_TIME);
+		auto [end_rss, end_threads] = processUsage();
+		running_ = false;
+		poller.join();
+
+		// restarted nodes start their counters over
+		std::uint64_t throttled_frames = 0;
+		std::uint64_t discovery_dropped = 0;
+		for (auto &node : nodes_) {
+			const std::lock_guard<std::mutex> lock(node->mutex);
+			node->app->publishView();
+			auto view = node->app->getView();
+			for (const auto &peer_view : view->peers) {
+				throttled_frames += peer_view.throttled_frames;
+			}
+			discovery_dropped += view->discovery_dropped;
+			recordFirstMessage(*node);
+		}
+
+		double nodes = static_cast<double>(nodes_.size());
+		std::printf("sent               %llu\n",
+					static_cast<unsigned long long>(stats_.sent));
+		std::printf("delivered          %llu of %llu expected (%.1f%%), %llu "
+					"duplicate(s)\n",
+					static_cast<unsigned long long>(stats_.delivered),
+					static_cast<unsigned long long>(stats_.expected),
+					stats_.expected ? 100.0 * stats_.delivered / stats_.expected
+									: 0.0,
+					static_cast<unsigned long long>(stats_.duplicates));
+		std::printf("throughput         %.0f msg/s, %.2f MB/s delivered\n",
+					stats_.delivered / traffic_s,
+					stats_.bytes / traffic_s / 1e6);
+		std::printf("latency ms         p50 %.2f  p90 %.2f  p99 %.2f  max "
+					"%.2f\n",
+					percentile(stats_.latencies_ms, 0.50),
+					percentile(stats_.latencies_ms, 0.90),
+					percentile(stats_.latencies_ms, 0.99),
+					percentile(stats_.latencies_ms, 1.0));
+		std::printf("memory per node    %.2f MiB after setup, %.2f MiB at "
+					"the end\n",
+					(static_cast<double>(setup_rss) - baseline_rss) / nodes /
+						(1 << 20),
+					(static_cast<double>(end_rss) - baseline_rss) / nodes /
+						(1 << 20));
+		std::printf("threads per node   %.1f after setup, %.1f at the end\n",
+					(static_cast<double>(setup_threads) - baseline_threads) /
+						nodes,
+					(static_cast<double>(end_threads) - baseline_threads) /
+						nodes);
+		std::printf("rate limits        %llu frame(s) throttled, %llu "
+					"discovery packet(s) dropped\n",
+					static_cast<unsigned long long>(throttled_frames),
+					static_cast<unsigned long long>(discovery_dropped));
+		std::printf("first message      %.0f ms after a cold start",
+					percentile(cold_first_ms_, 0.50));
+		if (!warm_first_ms_.empty()) {
+			std::printf(", %.0f ms after a restart (p50 of %zu)",
+						percentile(warm_first_ms_, 0.50),
+						warm_first_ms_.size());
+		}
+		std::printf("\n");
+		if (options_.pattern == "churn") {
+			std::printf("restarts           %llu\n",
+						static_cast<unsigned long long>(restarts_));
+		}
+		return true;
+	}
+};
+
+int main(int argc, char **argv) {
+	SimOptions options;
+	try {
+		options = parseOptions(argc, argv);
+	} catch (const std::exception &e) {
+		std::fprintf(stderr,
+					 "sim: %s\nusage: sim [--nodes N] [--pattern "
+					 "one-to-one|fan-out|churn|simultaneous-open] [--seconds S] "
+					 "[--rate MSG/S] [--size BYTES] [--churn-interval S] "
+					 "[--port PORT] [--dials N]\n",
+					 e.what());
+		return 1;
+	}
+	try {
+		Cluster cluster(options);
+		if (!cluster.run()) {
+			return 1;
+		}
+	} catch (const std::exception &e) {
+		std::fprintf(stderr, "sim: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}